@@ -1,7 +1,7 @@
-from .template import Template
+from .template import CachedReply
 
 
-class AccountMap(Template):
+class AccountMap(CachedReply):
     KEYS = {"permitted_accounts": list}
 
     def __init__(self, **kw):
@@ -6,7 +6,9 @@ SCOPE_FORMAT = "https://auth.globus.org/scopes/{fqdn}/ssh"
 CONFIG_FILE = os.path.expanduser("~/.oauth-ssh.cfg")
 PROMPT = "Enter your OAuth token: "
 GLOBUS_ACCOUNT = "oauth-ssh"
-PROTOCOL_VERSION = 1
+PROTOCOL_VERSION = 2
+# Protocol features this client can use when the service advertises them
+CAPABILITIES = ["multi_command", "resolve_and_login"]
 DEFAULT_SECTION = "General"
 
 SETTINGS = {
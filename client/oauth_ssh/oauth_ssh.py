@@ -9,7 +9,9 @@ import getpass  # get the local username for SSH logins
 from . import config as Config
 from .constants import *
 from .account_map import AccountMap
+from .policy import Policy
 from .ssh_service import SSHService
+from .transport import UnexpectedSSHReply
 from .exceptions import OAuthSSHError
 from .oauth_ssh_token import find_access_token
 
@@ -95,6 +97,37 @@ def parse_args():
     return account, port, acct_fqdn, args[i:]
 
 
+def _resolve_account(fqdn, port, access_token, local_user, cached=None):
+    """
+    Fetch the account map and log in as 'local_user' if the map permits it,
+    using the fewest round trips the service supports. 'cached' is a stale
+    account map to revalidate, if there is one. Returns (acct_map,
+    account, transport). acct_map is None if the service did not return it,
+    account is None if the caller must pick one from acct_map and transport is
+    None if the login still needs to happen.
+    """
+    service = SSHService(fqdn, port)
+    policy = Config.load_object(fqdn, Policy)
+
+    if policy is not None and policy.supports("resolve_and_login"):
+        reply, transport = service.resolve_and_login(access_token, local_user)
+        if reply is None or "permitted_accounts" not in reply:
+            if transport is None:
+                raise UnexpectedSSHReply(reply)
+            # Logged in, but SSH did not pass the reply along
+            return None, local_user, transport
+        acct_map = AccountMap(**reply)
+        account = local_user if transport is not None else reply.get("account")
+        return acct_map, account, transport
+
+    # Services older than protocol version 2 only return the account map
+    acct_map, transport = service.get_account_map_and_login(
+        access_token, local_user, cached
+    )
+    account = local_user if transport is not None else None
+    return acct_map, account, transport
+
+
 #####################################
 #
 # Entry point
@@ -109,19 +142,23 @@ def oauth_ssh():
     fqdn = acct_fqdn.split("@")[-1]
 
     # Grab the access token
-    access_token = find_access_token(fqdn)
+    access_token = find_access_token(fqdn, port)
 
     # Explicit account settings : Set on command line
     if len(acct_fqdn.split("@")) > 1:
         account = acct_fqdn.split("@")[0]
 
     # Implicit account settings: Use the account map
+    transport = None
     if account is None:
         acct_map = Config.load_object(fqdn, AccountMap)
-        if acct_map is None:
-            acct_map = SSHService(fqdn, port).get_account_map(access_token)
-            Config.save_object(fqdn, acct_map)
-        if acct_map["permitted_accounts"] is not None:
+        if acct_map is None or acct_map.is_stale():
+            acct_map, account, transport = _resolve_account(
+                fqdn, port, access_token, getpass.getuser(), acct_map
+            )
+            if acct_map is not None:
+                Config.save_object(fqdn, acct_map)
+        if account is None and acct_map["permitted_accounts"] is not None:
             if getpass.getuser() in acct_map["permitted_accounts"]:
                 account = getpass.getuser()
             elif len(acct_map["permitted_accounts"]) == 1:
@@ -131,10 +168,8 @@ def oauth_ssh():
         print("Could not determine remote account to use. Please use -l <account>.")
         sys.exit(1)
 
-    try:
+    if transport is None:
         transport = SSHService(fqdn, port).login(access_token, account)
-    except:
-        raise
 
     channel = transport.open_session()
     channel.setblocking(0)
@@ -37,7 +37,7 @@ def revoke_token(fqdn, token_type):
         Config.save_object(fqdn, token)
 
 
-def find_access_token(fqdn):
+def find_access_token(fqdn, port=22):
     token = Config.load_object(fqdn, Token)
     if token is None:
         raise NeedToAuthorize(fqdn, "No token found.")
@@ -46,6 +46,10 @@ def find_access_token(fqdn):
     if policy is None:
         raise NeedToAuthorize(fqdn, "No policy found.")
 
+    if policy.is_stale():
+        policy = SSHService(fqdn, port).get_security_policy(policy)
+        Config.save_object(fqdn, policy)
+
     if policy["authentication_timeout"] is not None:
         if policy["authentication_timeout"] > 0:
             timedout = True
@@ -219,9 +223,9 @@ oauth_ssh_token.add_command(token_show)
 def show_accounts(fqdn, port):
     acct_map = Config.load_object(fqdn, AccountMap)
 
-    if acct_map is None:
-        access_token = find_access_token(fqdn)
-        acct_map = SSHService(fqdn, port).get_account_map(access_token)
+    if acct_map is None or acct_map.is_stale():
+        access_token = find_access_token(fqdn, port)
+        acct_map = SSHService(fqdn, port).get_account_map(access_token, acct_map)
         Config.save_object(fqdn, acct_map)
 
     for k in acct_map.keys():
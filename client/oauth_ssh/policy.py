@@ -1,8 +1,21 @@
-from .template import Template
+from .template import CachedReply
+from .constants import CAPABILITIES
 
 
-class Policy(Template):
-    KEYS = {"permitted_idps": list, "authentication_timeout": int}
+class Policy(CachedReply):
+    # protocol_version and capabilities come from the service's reply to
+    # get_security_policy rather than its policy. Both are None for policies
+    # cached before the service advertised them.
+    KEYS = {
+        "permitted_idps": list,
+        "authentication_timeout": int,
+        "protocol_version": int,
+        "capabilities": list,
+    }
 
     def __init__(self, **kw):
         super(Policy, self).__init__(Policy.KEYS, kw)
+
+    def supports(self, capability):
+        """True if both this client and the service support 'capability'."""
+        return capability in CAPABILITIES and capability in (self["capabilities"] or [])
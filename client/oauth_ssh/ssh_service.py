@@ -3,9 +3,39 @@ import base64
 
 from .constants import *
 from .account_map import AccountMap
-from .transport import Transport
+from .transport import Transport, UnexpectedSSHReply
 from .policy import Policy
 
+
+def _encode_command(op, access_token=None, **fields):
+    command = {"op": op}
+    if access_token is not None:
+        command["access_token"] = access_token
+    command.update(fields)
+    msg = {"command": command, "version": PROTOCOL_VERSION}
+    return base64.b64encode(json.dumps(msg).encode("utf-8"))
+
+
+def _etag(cached):
+    # Lets the service reply 'not_modified' instead of resending 'cached'
+    if cached is not None and cached["etag"]:
+        return {"etag": cached["etag"]}
+    return {}
+
+
+def _cache_hints(reply):
+    return {k: reply[k] for k in ("etag", "max_age") if k in reply}
+
+
+def _account_map(reply, cached):
+    if cached is not None and reply.get("not_modified"):
+        cached.update(_cache_hints(reply))
+        return cached
+    acct_map = AccountMap(**reply["account_map"])
+    acct_map.update(_cache_hints(reply))
+    return acct_map
+
+
 ####################################################################
 #
 # Public Command Interface
@@ -16,34 +46,99 @@ class SSHService:
         self._fqdn = fqdn
         self._port = port
 
-    def get_security_policy(self):
-        msg = {"command": {"op": "get_security_policy"}, "version": PROTOCOL_VERSION}
-        command = base64.b64encode(json.dumps(msg).encode("utf-8"))
+    def get_security_policy(self, cached=None):
+        """
+        Fetch the security policy. If 'cached' is given, the service may
+        confirm that it is still current, in which case 'cached' is returned
+        with a new expiration.
+        """
+        command = _encode_command("get_security_policy", **_etag(cached))
 
         transport = Transport(self._fqdn, self._port)
         reply = transport.send_command(command, GLOBUS_ACCOUNT)
+        if cached is not None and reply.get("not_modified"):
+            cached.update(_cache_hints(reply))
+            return cached
+
         policy = Policy(**reply["policy"])
+        # Services older than protocol version 2 advertise neither
+        policy["protocol_version"] = reply.get("version", 1)
+        policy["capabilities"] = reply.get("capabilities", [])
+        policy.update(_cache_hints(reply))
         return policy
 
-    def get_account_map(self, access_token):
-        msg = {
-            "command": {"op": "get_account_map", "access_token": access_token},
-            "version": PROTOCOL_VERSION,
-        }
-        command = base64.b64encode(json.dumps(msg).encode("utf-8"))
+    def get_account_map(self, access_token, cached=None):
+        """
+        Fetch the account map. If 'cached' is given, the service may confirm
+        that it is still current, in which case 'cached' is returned with a
+        new expiration.
+        """
+        command = _encode_command("get_account_map", access_token, **_etag(cached))
 
         transport = Transport(self._fqdn, self._port)
         reply = transport.send_command(command, GLOBUS_ACCOUNT)
-        acct_map = AccountMap(**reply["account_map"])
-        return acct_map
+        return _account_map(reply, cached)
 
     def login(self, access_token, account):
-        msg = {
-            "command": {"op": "login", "access_token": access_token},
-            "version": PROTOCOL_VERSION,
-        }
-        command = base64.b64encode(json.dumps(msg).encode("utf-8"))
+        command = _encode_command("login", access_token)
 
         transport = Transport(self._fqdn, self._port)
         reply = transport.send_command(command, account)
         return transport
+
+    def get_account_map_and_login(self, access_token, account, cached=None):
+        """
+        Fetch the account map and, if it permits 'account', log in as 'account'
+        over the same connection. Returns (acct_map, transport) where transport
+        is None if the login was not attempted. SSH fixes the account for the
+        whole connection, so logging in as another account needs login().
+        Services older than protocol version 2 only return the account map.
+        'cached' is revalidated as in get_account_map().
+        """
+        acct_maps = []
+
+        def next_command(reply):
+            if reply is None:
+                return _encode_command("get_account_map", access_token, **_etag(cached))
+            if not acct_maps and ("account_map" in reply or "not_modified" in reply):
+                acct_maps.append(_account_map(reply, cached))
+                if account in (acct_maps[0]["permitted_accounts"] or []):
+                    return _encode_command("login", access_token)
+            return None
+
+        transport = Transport(self._fqdn, self._port)
+        reply = transport.send_commands(next_command, account)
+
+        if transport.is_authenticated():
+            return acct_maps[0], transport
+
+        transport.close()
+        if not acct_maps:
+            acct_maps.append(_account_map(reply, cached))
+        return acct_maps[0], None
+
+    def resolve_and_login(self, access_token, account, preferred_accounts=None):
+        """
+        Fetch the security policy and account map and log in as 'account' with
+        one command, so the service introspects the token once. Returns
+        (reply, transport) where reply holds 'policy', 'permitted_accounts',
+        'account' and 'authorized'. transport is None unless 'account' was
+        authorized, in which case reply may be None if SSH did not pass it
+        along. Otherwise reply["account"] names the account to log in as
+        with login(), chosen from 'preferred_accounts' if there is no single
+        permitted account.
+        """
+        fields = {}
+        if preferred_accounts:
+            fields["preferred_accounts"] = list(preferred_accounts)
+        command = _encode_command("resolve_and_login", access_token, **fields)
+
+        transport = Transport(self._fqdn, self._port)
+        reply = transport.send_command(command, account)
+        if transport.is_authenticated():
+            return (reply or {}).get("resolve_and_login"), transport
+
+        transport.close()
+        if reply is None or "resolve_and_login" not in reply:
+            raise UnexpectedSSHReply(reply)
+        return reply["resolve_and_login"], None
@@ -1,5 +1,6 @@
 import ast
 import sys
+import time
 
 
 class Template(dict):
@@ -68,3 +69,30 @@ class Template(dict):
         if k not in self:
             raise KeyError(self.__class__.__name__ + ": No such key: " + str(k))
         super(Template, self).__setitem__(k, None)
+
+
+def _expires_at(values):
+    if "max_age" in values:
+        values = values.copy()
+        values["expires_at"] = int(values["max_age"]) + int(time.time())
+    return values
+
+
+class CachedReply(Template):
+    """
+    A reply from the SSH service that may be reused until 'expires_at' and then
+    revalidated by sending its 'etag'. Services that do not send 'max_age' leave
+    'expires_at' None and the reply never goes stale.
+    """
+
+    KEYS = {"etag": str, "expires_at": int}
+
+    def __init__(self, template={}, values={}):
+        template = dict(template, **CachedReply.KEYS)
+        super(CachedReply, self).__init__(template, _expires_at(values))
+
+    def update(self, values):
+        super(CachedReply, self).update(_expires_at(values))
+
+    def is_stale(self):
+        return self["expires_at"] is not None and self["expires_at"] <= time.time()
@@ -98,10 +98,13 @@ def _connect_to_host(fqdn, port):
 #
 ####################################################################
 class CmdInjectHandler:
-    def __init__(self, command):
+    def __init__(self, next_command):
+        # next_command(reply) returns the command to send after 'reply', the
+        # decoded reply to the previous command, or None when we are done. It
+        # is called with reply=None for the first command.
         self._state = 0
         self._reply = None
-        self._command = command
+        self._next_command = next_command
 
     def __call__(self, title, instructions, prompt_list):
         if self._state == 0:
@@ -114,7 +117,7 @@ class CmdInjectHandler:
             if len(prompt_list) > 0:
                 if prompt_list[0][0] == PROMPT:
                     self._state = 1
-                    return [self._command]
+                    return [self._next_command(None)]
         elif self._state == 1:
             # On the second call, we are looking for a response to our command.
             if instructions:
@@ -129,8 +132,25 @@ class CmdInjectHandler:
                 # title: ""
                 # instructions: ""
                 # prompt_list: [('<base64-encoded-reply>\nPassword: ', False)]
-                self._reply = prompt_list[0][0].split("\n")[0]
+                #
+                # Services that speak protocol version 2 prompt for another
+                # command instead:
+                #
+                # prompt_list: [('<base64-encoded-reply>\nEnter your OAuth token: ', False)]
+                reply, _, prompt = prompt_list[0][0].partition("\n")
+                self._reply = reply
                 self._state = 0
+                if prompt == PROMPT:
+                    decoded = decode_reply(reply)
+                    command = None
+                    if "error" not in decoded:
+                        command = self._next_command(decoded)
+                    if command is not None:
+                        self._reply = None
+                        self._state = 1
+                        return [command]
+                    # An empty answer ends the exchange
+                    return [""]
             else:
                 # Successful login, instructions and reply are None (or "")
                 # title:  instructions:  prompt_list: []
@@ -196,10 +216,21 @@ class Transport(paramiko.transport.Transport):
                 pass
 
     def send_command(self, command, account):
-        # XXX The logic in send_command() and CmdInjectHandler should be moved from
+        return self.send_commands(
+            lambda reply: command if reply is None else None, account
+        )
+
+    def send_commands(self, next_command, account):
+        """
+        Send each command returned by next_command(reply) in one keyboard-
+        interactive exchange; see CmdInjectHandler. Returns the reply to the
+        last command, or None if the last command was a successful login
+        without a reply.
+        """
+        # XXX The logic in send_commands() and CmdInjectHandler should be moved from
         # this file and into a location closer to the actul command so that empty
         # replies can be interpreted more cleanly.
-        handler = CmdInjectHandler(command)
+        handler = CmdInjectHandler(next_command)
         try:
             self.auth_interactive(account, handler)
         except paramiko.AuthenticationException as e:
@@ -218,3 +249,12 @@ class Transport(paramiko.transport.Transport):
                     raise InvalidToken()
                 raise UnexpectedSSHReply(reply)
             return reply
+
+        # Commands that log in and reply, ie. resolve_and_login, leave the
+        # reply in 'instructions'. Anything else there is not ours.
+        if handler._reply:
+            try:
+                return decode_reply(handler._reply)
+            except UnexpectedSSHReply:
+                pass
+        return None
@@ -0,0 +1,178 @@
+import base64
+import json
+
+import pytest
+
+from oauth_ssh import ssh_service
+from oauth_ssh import oauth_ssh
+from oauth_ssh.account_map import AccountMap
+from oauth_ssh.policy import Policy
+from oauth_ssh.ssh_service import SSHService
+from oauth_ssh.transport import UnexpectedSSHReply
+
+RESOLVED = {
+    "policy": {"permitted_idps": None, "authentication_timeout": 60},
+    "permitted_accounts": ["alice", "bob"],
+    "account": "bob",
+    "authorized": False,
+    "max_age": 3600,
+}
+
+
+class FakeTransport:
+    """
+    Stands in for Transport. The next connection authenticates if
+    'authenticated' is set and its reply to any command is 'reply'.
+    """
+
+    reply = None
+    authenticated = False
+    commands = []
+
+    def __init__(self, fqdn, port):
+        self.closed = False
+
+    def send_command(self, command, account):
+        FakeTransport.commands.append((json.loads(base64.b64decode(command)), account))
+        return FakeTransport.reply
+
+    def is_authenticated(self):
+        return FakeTransport.authenticated
+
+    def close(self):
+        self.closed = True
+
+
+@pytest.fixture
+def transport(monkeypatch):
+    FakeTransport.reply = None
+    FakeTransport.authenticated = False
+    FakeTransport.commands = []
+    monkeypatch.setattr(ssh_service, "Transport", FakeTransport)
+    return FakeTransport
+
+
+#
+# SSHService.resolve_and_login() Tests
+#
+def test_resolve_and_login_command(transport):
+    transport.reply = {"resolve_and_login": RESOLVED}
+    SSHService("host", 22).resolve_and_login("token", "alice", ["bob"])
+
+    command, account = transport.commands[0]
+    assert account == "alice"
+    assert command["command"] == {
+        "op": "resolve_and_login",
+        "access_token": "token",
+        "preferred_accounts": ["bob"],
+    }
+    assert command["version"] >= 2
+
+
+def test_resolve_and_login_without_preferred_accounts(transport):
+    transport.reply = {"resolve_and_login": RESOLVED}
+    SSHService("host", 22).resolve_and_login("token", "alice")
+
+    command, _ = transport.commands[0]
+    assert "preferred_accounts" not in command["command"]
+
+
+def test_resolve_and_login_authorized(transport):
+    transport.authenticated = True
+    transport.reply = {"resolve_and_login": dict(RESOLVED, authorized=True)}
+
+    reply, t = SSHService("host", 22).resolve_and_login("token", "alice")
+    assert reply["authorized"] is True
+    assert isinstance(t, FakeTransport) and not t.closed
+
+
+def test_resolve_and_login_authorized_without_reply(transport):
+    transport.authenticated = True
+
+    reply, t = SSHService("host", 22).resolve_and_login("token", "alice")
+    assert reply is None
+    assert t is not None
+
+
+def test_resolve_and_login_unauthorized(transport):
+    transport.reply = {"resolve_and_login": RESOLVED}
+
+    reply, t = SSHService("host", 22).resolve_and_login("token", "alice")
+    assert reply == RESOLVED
+    assert t is None
+
+
+@pytest.mark.parametrize("reply", [None, {"account_map": {}}])
+def test_resolve_and_login_unexpected_reply(transport, reply):
+    transport.reply = reply
+
+    with pytest.raises(UnexpectedSSHReply):
+        SSHService("host", 22).resolve_and_login("token", "alice")
+
+
+#
+# oauth_ssh._resolve_account() Tests
+#
+class FakeService:
+    """SSHService whose resolve_and_login() returns 'result'."""
+
+    result = None
+
+    def __init__(self, fqdn, port):
+        pass
+
+    def resolve_and_login(self, access_token, account):
+        return FakeService.result
+
+
+@pytest.fixture
+def service(monkeypatch):
+    policy = Policy(capabilities=["resolve_and_login"])
+    monkeypatch.setattr(oauth_ssh.Config, "load_object", lambda fqdn, cls: policy)
+    monkeypatch.setattr(oauth_ssh, "SSHService", FakeService)
+    return FakeService
+
+
+def test_resolve_account_authorized(service):
+    service.result = (dict(RESOLVED, authorized=True), "transport")
+
+    acct_map, account, t = oauth_ssh._resolve_account("host", 22, "token", "alice")
+    assert isinstance(acct_map, AccountMap)
+    assert acct_map["permitted_accounts"] == ["alice", "bob"]
+    assert account == "alice"
+    assert t == "transport"
+
+
+def test_resolve_account_unauthorized(service):
+    service.result = (RESOLVED, None)
+
+    acct_map, account, t = oauth_ssh._resolve_account("host", 22, "token", "carol")
+    assert acct_map["permitted_accounts"] == ["alice", "bob"]
+    assert account == "bob"
+    assert t is None
+
+
+def test_resolve_account_no_account(service):
+    service.result = (dict(RESOLVED, account=None), None)
+
+    _, account, t = oauth_ssh._resolve_account("host", 22, "token", "carol")
+    assert account is None
+    assert t is None
+
+
+@pytest.mark.parametrize("reply", [None, {"error": {"message": "Oops"}}])
+def test_resolve_account_logged_in_without_usable_reply(service, reply):
+    service.result = (reply, "transport")
+
+    acct_map, account, t = oauth_ssh._resolve_account("host", 22, "token", "alice")
+    assert acct_map is None
+    assert account == "alice"
+    assert t == "transport"
+
+
+@pytest.mark.parametrize("reply", [None, {"error": {"message": "Oops"}}])
+def test_resolve_account_error_reply(service, reply):
+    service.result = (reply, None)
+
+    with pytest.raises(UnexpectedSSHReply):
+        oauth_ssh._resolve_account("host", 22, "token", "alice")
@@ -1,6 +1,7 @@
+import time
 import pytest
 
-from oauth_ssh.template import Template
+from oauth_ssh.template import Template, CachedReply
 
 #
 # Initialization Tests
@@ -90,3 +91,20 @@ def test_deletion_list():
     template = Template({'A': list},  {'A': ['1']})
     del template['A']
     assert template['A'] is None
+
+#
+# CachedReply Tests
+#
+
+def test_cached_reply_without_max_age():
+    reply = CachedReply({'A': int}, {'A': 15})
+    assert reply['expires_at'] is None
+    assert not reply.is_stale()
+
+def test_cached_reply_max_age():
+    reply = CachedReply({'A': int}, {'A': 15, 'max_age': 60, 'etag': 'x'})
+    assert reply['etag'] == 'x'
+    assert not reply.is_stale()
+    reply.update({'max_age': 0})
+    assert reply['expires_at'] <= time.time()
+    assert reply.is_stale()
@@ -0,0 +1,226 @@
+import base64
+import json
+
+import paramiko
+import pytest
+
+from oauth_ssh.constants import PROMPT
+from oauth_ssh.transport import (
+    AuthorizationFailure,
+    CmdInjectHandler,
+    InvalidToken,
+    SessionViolation,
+    Transport,
+    UnexpectedSSHReply,
+)
+
+
+def encode(reply):
+    return base64.b64encode(json.dumps(reply).encode("utf-8")).decode("utf-8")
+
+
+def prompt(text):
+    return [(text, False)]
+
+
+class Commands:
+    """
+    Scripted next_command(): returns each of 'commands' in turn, then None,
+    and records the replies it was given.
+    """
+
+    def __init__(self, *commands):
+        self.commands = list(commands)
+        self.replies = []
+
+    def __call__(self, reply):
+        self.replies.append(reply)
+        return self.commands.pop(0) if self.commands else None
+
+
+#
+# CmdInjectHandler Tests
+#
+def test_first_command_answers_our_prompt():
+    commands = Commands("cmd1")
+    handler = CmdInjectHandler(commands)
+
+    assert handler("", "", prompt(PROMPT)) == ["cmd1"]
+    assert commands.replies == [None]
+
+
+def test_ignores_other_prompts():
+    commands = Commands("cmd1")
+    handler = CmdInjectHandler(commands)
+
+    assert handler("", "", prompt("Password: ")) == []
+    assert handler("", "", []) == []
+    assert commands.replies == []
+
+
+def test_reply_in_instructions():
+    handler = CmdInjectHandler(Commands("cmd1"))
+    handler("", "", prompt(PROMPT))
+
+    assert handler("", encode({"A": 1}), []) == []
+    assert handler._reply == encode({"A": 1})
+
+
+def test_successful_login_without_reply():
+    handler = CmdInjectHandler(Commands("cmd1"))
+    handler("", "", prompt(PROMPT))
+
+    assert handler("", "", []) == []
+    assert handler._reply is None
+
+
+def test_version_1_reply_before_password_prompt():
+    commands = Commands("cmd1", "cmd2")
+    handler = CmdInjectHandler(commands)
+    handler("", "", prompt(PROMPT))
+
+    reply = encode({"A": 1})
+    assert handler("", "", prompt(reply + "\nPassword: ")) == []
+    assert handler._reply == reply
+    assert commands.replies == [None]
+
+
+def test_version_2_reply_before_our_prompt():
+    commands = Commands("cmd1", "cmd2")
+    handler = CmdInjectHandler(commands)
+    handler("", "", prompt(PROMPT))
+
+    assert handler("", "", prompt(encode({"A": 1}) + "\n" + PROMPT)) == ["cmd2"]
+    assert handler._reply is None
+    assert commands.replies == [None, {"A": 1}]
+
+    assert handler("", encode({"B": 2}), []) == []
+    assert handler._reply == encode({"B": 2})
+
+
+def test_empty_answer_ends_exchange():
+    commands = Commands("cmd1")
+    handler = CmdInjectHandler(commands)
+    handler("", "", prompt(PROMPT))
+
+    reply = encode({"A": 1})
+    assert handler("", "", prompt(reply + "\n" + PROMPT)) == [""]
+    assert handler._reply == reply
+    assert commands.replies == [None, {"A": 1}]
+
+
+def test_error_reply_ends_exchange():
+    commands = Commands("cmd1", "cmd2")
+    handler = CmdInjectHandler(commands)
+    handler("", "", prompt(PROMPT))
+
+    reply = encode({"error": {"code": "INVALID_TOKEN"}})
+    assert handler("", "", prompt(reply + "\n" + PROMPT)) == [""]
+    assert handler._reply == reply
+    assert commands.replies == [None]
+
+
+def test_undecodable_reply_before_our_prompt():
+    handler = CmdInjectHandler(Commands("cmd1", "cmd2"))
+    handler("", "", prompt(PROMPT))
+
+    with pytest.raises(UnexpectedSSHReply):
+        handler("", "", prompt("not base64\n" + PROMPT))
+
+
+#
+# Transport.send_commands() Tests
+#
+def scripted_transport(prompts, authenticated=True):
+    """
+    A Transport whose keyboard-interactive exchange calls the handler with
+    each of 'prompts', a list of (instructions, prompt_list), then succeeds or
+    fails like paramiko. The handler's answers are kept in 'answers'.
+    """
+    transport = Transport.__new__(Transport)
+    transport._fqdn = "host.example.org"
+    transport.answers = []
+
+    def auth_interactive(account, handler):
+        for instructions, prompt_list in prompts:
+            transport.answers.append(handler("", instructions, prompt_list))
+        if not authenticated:
+            raise paramiko.AuthenticationException()
+
+    transport.auth_interactive = auth_interactive
+    return transport
+
+
+def test_send_commands_in_one_exchange():
+    commands = Commands("cmd1", "cmd2")
+    transport = scripted_transport(
+        [
+            ("", prompt(PROMPT)),
+            ("", prompt(encode({"A": 1}) + "\n" + PROMPT)),
+            (encode({"B": 2}), []),
+        ]
+    )
+
+    assert transport.send_commands(commands, "user") == {"B": 2}
+    assert transport.answers == [["cmd1"], ["cmd2"], []]
+
+
+def test_send_commands_last_reply_on_failure():
+    transport = scripted_transport(
+        [
+            ("", prompt(PROMPT)),
+            ("", prompt(encode({"A": 1}) + "\n" + PROMPT)),
+        ],
+        authenticated=False,
+    )
+
+    assert transport.send_commands(Commands("cmd1"), "user") == {"A": 1}
+    assert transport.answers == [["cmd1"], [""]]
+
+
+def test_send_commands_login_without_reply():
+    transport = scripted_transport([("", prompt(PROMPT)), ("", [])])
+    assert transport.send_commands(Commands("cmd1"), "user") is None
+
+
+def test_send_commands_ignores_banner():
+    transport = scripted_transport([("", prompt(PROMPT)), ("Welcome!", [])])
+    assert transport.send_commands(Commands("cmd1"), "user") is None
+
+
+def test_send_command_version_1():
+    transport = scripted_transport(
+        [("", prompt(PROMPT)), ("", prompt(encode({"A": 1}) + "\nPassword: "))],
+        authenticated=False,
+    )
+
+    assert transport.send_command("cmd1", "user") == {"A": 1}
+    assert transport.answers == [["cmd1"], []]
+
+
+def test_send_commands_misconfigured_service():
+    transport = scripted_transport([("", prompt("Password: "))], authenticated=False)
+
+    with pytest.raises(AuthorizationFailure):
+        transport.send_commands(Commands("cmd1"), "user")
+
+
+@pytest.mark.parametrize(
+    "code,exception",
+    [
+        ("SESSION_VIOLATION", SessionViolation),
+        ("INVALID_TOKEN", InvalidToken),
+        ("UNKNOWN_COMMAND", UnexpectedSSHReply),
+    ],
+)
+def test_send_commands_error_replies(code, exception):
+    transport = scripted_transport(
+        [
+            ("", prompt(PROMPT)),
+            ("", prompt(encode({"error": {"code": code}}) + "\n" + PROMPT)),
+        ],
+        authenticated=False,
+    )
+
+    with pytest.raises(exception):
+        transport.send_commands(Commands("cmd1", "cmd2"), "user")
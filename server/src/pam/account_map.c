@@ -9,6 +9,8 @@
  * Local includes.
  */
 #include "account_map.h"
+#include "arena.h"
+#include "map_index.h"
 #include "strings.h"
 #include "logger.h"
 #include "parser.h"
@@ -18,27 +20,98 @@
  * Internal (Private) Functions
  ******************************************************************************/
 
+static struct account_map *
+_map_init()
+{
+	struct account_map * map = arena_calloc(1, sizeof(*map));
+	map->mappings_tail = &map->mappings;
+	map->accounts_tail = &map->accounts;
+	return map;
+}
+
+// Grow NULL-terminated 'array' of 'count' elements by one
 static void
-_add_acct_mapping(struct account_map    ** map,
-                 const struct identity *  id,
-                 const char            *  acct)
+_append(void *** array, int * count, void * element)
+{
+	*array = arena_realloc(*array,
+	                       (*count+1) * sizeof(**array),
+	                       (*count+2) * sizeof(**array));
+	(*array)[(*count)++] = element;
+	(*array)[*count] = NULL;
+}
+
+static struct account_mapping *
+_find_mapping(const struct account_map * map, const char * id)
+{
+	return hash_entry(hash_find(&map->by_id, id), struct account_mapping, node);
+}
+
+static struct mapped_account *
+_find_account(const struct account_map * map, const char * acct)
+{
+	return hash_entry(hash_find(&map->by_acct, acct), struct mapped_account, node);
+}
+
+static struct account_mapping *
+_add_mapping(struct account_map * map, const struct identity * id)
+{
+	struct account_mapping * mapping = arena_calloc(1, sizeof(*mapping));
+	mapping->username = arena_strdup(id->username);
+	mapping->id = arena_strdup(id->id);
+
+	hash_insert(&map->by_id, &mapping->node, mapping->id);
+	*map->mappings_tail = mapping;
+	map->mappings_tail = &mapping->next;
+	return mapping;
+}
+
+static struct mapped_account *
+_add_account(struct account_map * map, const char * acct)
 {
-	for (struct account_map * ptr = *map; ptr; ptr = ptr->next)
+	struct mapped_account * account = arena_calloc(1, sizeof(*account));
+	account->acct = arena_strdup(acct);
+
+	hash_insert(&map->by_acct, &account->node, account->acct);
+	*map->accounts_tail = account;
+	map->accounts_tail = &account->next;
+	map->count++;
+	return account;
+}
+
+static bool
+_is_mapped(const struct mapped_account  * account,
+           const struct account_mapping * mapping)
+{
+	// Rarely more than one identity per account
+	for (int i = 0; i < account->count; i++)
 	{
-		if (strcmp(ptr->id, id->id) == 0)
-		{
-			if (!key_in_list(CONST(char *, ptr->accounts), acct))
-				insert(&ptr->accounts, acct);
-			return;
-		}
+		if (account->mappings[i] == mapping)
+			return true;
 	}
+	return false;
+}
+
+static void
+_add_acct_mapping(struct account_map    ** map,
+                  const struct identity *  id,
+                  const char            *  acct)
+{
+	if (!*map)
+		*map = _map_init();
 
-	struct account_map * ptr = calloc(1, sizeof(*ptr));
-	ptr->username = strdup(id->username);
-	ptr->id = strdup(id->id);
-	insert(&ptr->accounts, acct);
-	ptr->next = *map;
-	*map = ptr;
+	struct account_mapping * mapping = _find_mapping(*map, id->id);
+	if (!mapping)
+		mapping = _add_mapping(*map, id);
+
+	struct mapped_account * account = _find_account(*map, acct);
+	if (!account)
+		account = _add_account(*map, acct);
+
+	if (_is_mapped(account, mapping))
+		return;
+
+	_append((void ***)&mapping->accounts, &mapping->count, account->acct);
+	_append((void ***)&account->mappings, &account->count, mapping);
 }
 
 static char *
@@ -62,9 +135,66 @@ _id_matches_suffix(const struct identity * id, const char * suffix)
 }
 
 /*
- * For each line in each map_file, add the 'id' => 'acct' mapping if
+ * For each line in map_file 'path', add the 'id' => 'acct' mapping if
  * 'acct' is in 'identities'.
  */
+static void
+_scan_map_file(const char              *  path,
+               const struct identities *  identities,
+               struct account_map      ** map)
+{
+	// We want to continue even if a map file is missing or unreadable
+	// to allow users to continue to log in with the mappings available.
+	FILE * fptr = fopen(path, "r");
+	if (!fptr)
+	{
+		logger(LOG_TYPE_ERROR, "Could not open %s: %m", path);
+		return;
+	}
+
+	char * key = NULL;
+	char ** values = NULL;
+	while (read_next_pair(fptr, &key, &values))
+	{
+		for (int i = 0; identities->identities[i]; i++)
+		{
+			struct identity * id = identities->identities[i];
+			if (strcmp(id->username, key) == 0 || strcmp(id->id, key) == 0)
+			{
+				for (int v = 0; values && values[v]; v++)
+				{
+					_add_acct_mapping(map, id, values[v]);
+				}
+				break;
+			}
+		}
+		free(key);
+		free_array(values);
+	}
+	fclose(fptr);
+}
+
+static void
+_add_index_mappings(const struct map_index *  index,
+                    const struct identity  *  id,
+                    const char             *  key,
+                    struct account_map     ** map)
+{
+	const struct map_index_entry * entry = map_index_find(index, key);
+	if (!entry)
+		return;
+
+	const char * acct;
+	for (int v = 0; (acct = map_index_value(index, entry, v)); v++)
+	{
+		_add_acct_mapping(map, id, acct);
+	}
+}
+
+/*
+ * Look up each identity in each map_file, preferring the compiled index of
+ * the file over reading it line by line.
+ */
 static struct account_map *
 _build_map_file_account_map(const struct config     * config,
                             const struct identities * identities)
@@ -73,37 +203,21 @@ _build_map_file_account_map(const struct config     * config,
 
 	for (int i = 0; config->map_files && config->map_files[i]; i++)
 	{
-		// We want to continue even if a map file is missing or unreadable
-		// to allow users to continue to log in with the mappings available.
-		FILE * fptr = fopen(config->map_files[i], "r");
-		if (!fptr)
+		struct map_index * index = map_index_open(config->map_files[i]);
+		if (!index)
 		{
-			logger(LOG_TYPE_ERROR,
-			       "Could not open %s: %m",
-			       config->map_files[i]);
+			_scan_map_file(config->map_files[i], identities, &map);
 			continue;
 		}
 
-		char * key = NULL;
-		char ** values = NULL;
-		while (read_next_pair(fptr, &key, &values))
+		for (int j = 0; identities->identities[j]; j++)
 		{
-			for (int i = 0; identities->identities[i]; i++)
-			{
-				struct identity * id = identities->identities[i];
-				if (strcmp(id->username, key) == 0 || strcmp(id->id, key) == 0)
-				{
-					for (int v = 0; values && values[v]; v++)
-					{
-						_add_acct_mapping(&map, id, values[v]);
-					}
-					break;
-				}
-			}
-			free(key);
-			free_array(values);
+			struct identity * id = identities->identities[j];
+			_add_index_mappings(index, id, id->id, &map);
+			if (strcmp(id->username, id->id) != 0)
+				_add_index_mappings(index, id, id->username, &map);
 		}
-		fclose(fptr);
+		map_index_close(index);
 	}
 	return map;
 }
@@ -140,36 +254,43 @@ account_map_init(const struct config * config, const struct identities * ids)
 void
 account_map_fini(struct account_map * account_map)
 {
-	struct account_map * tmp;
+	// Released by arena_end()
+	if (!account_map || arena_owns(account_map))
+		return;
+
+	struct account_mapping * mapping;
+	while ((mapping = account_map->mappings))
+	{
+		account_map->mappings = mapping->next;
+		free(mapping->username);
+		free(mapping->id);
+		free(mapping->accounts);
+		free(mapping);
+	}
 
-	while ((tmp = account_map))
+	struct mapped_account * account;
+	while ((account = account_map->accounts))
 	{
-		free(tmp->username);
-		free(tmp->id);
-		free_array(tmp->accounts);
-		account_map = account_map->next;
-		free(tmp);
+		account_map->accounts = account->next;
+		free(account->acct);
+		free(account->mappings);
+		free(account);
 	}
+
+	hash_fini(&account_map->by_id);
+	hash_fini(&account_map->by_acct);
+	free(account_map);
 }
 
 bool
 is_acct_in_map(const struct account_map * map, const char * acct)
 {
-	for (; map; map = map->next)
-	{
-		if (key_in_list(CONST(char *,map->accounts), acct))
-			return true;
-	}
-	return false;
+	return map && _find_account(map, acct);
 }
 
 const char *
 acct_to_username(const struct account_map * map, const char * acct)
 {
-	for (; map; map = map->next)
-	{
-		if (key_in_list(CONST(char *,map->accounts), acct))
-			return map->username;
-	}
-	return NULL;
+	const struct mapped_account * account = map ? _find_account(map, acct) : NULL;
+	return account ? account->mappings[0]->username : NULL;
 }
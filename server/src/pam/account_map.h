@@ -11,15 +11,49 @@
  */
 #include "identities.h"
 #include "config.h"
+#include "hash.h"
 
-struct account_map {
+/*
+ * The local accounts each linked identity may use. The map is indexed both
+ * ways, identity => accounts and account => identities, and both lists keep
+ * the order in which the mappings were found so that replies built from them
+ * are deterministic.
+ */
+
+// A linked identity and the accounts mapped to it
+struct account_mapping {
 	char *  username;
 	char *  id;
-	char ** accounts;
+	char ** accounts; // NULL-terminated; strings belong to 'struct mapped_account'
+	int     count;
+
+	struct hash_node         node; // keyed on 'id'
+	struct account_mapping * next;
+};
+
+// A local account and the identities mapped to it
+struct mapped_account {
+	char                    *  acct;
+	struct account_mapping  ** mappings; // NULL-terminated
+	int                        count;
+
+	struct hash_node        node; // keyed on 'acct'
+	struct mapped_account * next;
+};
+
+struct account_map {
+	struct account_mapping * mappings;
+	struct mapped_account  * accounts; // distinct
+	int                      count;    // of 'accounts'
+
+	struct hash by_id;
+	struct hash by_acct;
 
-	struct account_map * next;
+	struct account_mapping ** mappings_tail;
+	struct mapped_account  ** accounts_tail;
 };
 
+// Returns NULL if no account is mapped.
 struct account_map *
 account_map_init(const struct config *, const struct identities *);
 
@@ -29,6 +63,7 @@ account_map_fini(struct account_map *);
 bool
 is_acct_in_map(const struct account_map * map, const char * acct);
 
+// Username of the first identity mapped to 'acct'.
 const char *
 acct_to_username(const struct account_map * map, const char * acct);
 
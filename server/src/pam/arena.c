@@ -0,0 +1,167 @@
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Local includes.
+ */
+#include "arena.h"
+#include "debug.h" // always last
+
+/*******************************************************************************
+ * Internal (Private) Functions
+ ******************************************************************************/
+
+// A login typically fits in one or two blocks
+#define ARENA_BLOCK_SIZE (16*1024)
+#define ARENA_ALIGN      alignof(max_align_t)
+
+struct arena_block {
+	struct arena_block * next;
+	size_t               size;
+	size_t               used;
+	alignas(max_align_t) char data[];
+};
+
+struct arena {
+	bool                 active;
+	struct arena_block * blocks; // newest first
+};
+
+// oauth-ssh-helperd processes one login per thread
+static __thread struct arena arena;
+
+static void *
+_arena_alloc(size_t size)
+{
+	// Never hand out the end of a block; arena_owns() would not claim it
+	if (size == 0)
+		size = 1;
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	struct arena_block * block = arena.blocks;
+	if (!block || block->size - block->used < size)
+	{
+		// Oversized allocations get a block of their own
+		size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+
+		block = malloc(sizeof(*block) + block_size);
+		if (!block)
+			return NULL;
+
+		block->size = block_size;
+		block->used = 0;
+
+		// Keep filling the current block if the new one is just for this
+		if (arena.blocks && block_size > ARENA_BLOCK_SIZE)
+		{
+			block->next = arena.blocks->next;
+			arena.blocks->next = block;
+		}
+		else
+		{
+			block->next = arena.blocks;
+			arena.blocks = block;
+		}
+	}
+
+	void * ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+/*******************************************************************************
+ * Public Functions
+ ******************************************************************************/
+
+void
+arena_begin()
+{
+	ASSERT(!arena.active);
+	arena.active = true;
+}
+
+void
+arena_end()
+{
+	struct arena_block * block;
+	while ((block = arena.blocks))
+	{
+		arena.blocks = block->next;
+		free(block);
+	}
+	arena.active = false;
+}
+
+void *
+arena_calloc(size_t nmemb, size_t size)
+{
+	if (!arena.active)
+		return calloc(nmemb, size);
+
+	if (size && nmemb > (size_t)-1 / size)
+		return NULL;
+
+	void * ptr = _arena_alloc(nmemb * size);
+	if (ptr)
+		memset(ptr, 0, nmemb * size);
+	return ptr;
+}
+
+char *
+arena_strdup(const char * string)
+{
+	if (!arena.active)
+		return strdup(string);
+
+	size_t length = strlen(string) + 1;
+	char * copy = _arena_alloc(length);
+	if (copy)
+		memcpy(copy, string, length);
+	return copy;
+}
+
+void *
+arena_realloc(void * ptr, size_t old_size, size_t size)
+{
+	if (!arena.active)
+		return realloc(ptr, size);
+
+	void * copy = _arena_alloc(size);
+	if (copy && ptr)
+		memcpy(copy, ptr, old_size < size ? old_size : size);
+	return copy;
+}
+
+bool
+arena_suspend()
+{
+	bool active = arena.active;
+	arena.active = false;
+	return active;
+}
+
+void
+arena_resume(bool active)
+{
+	arena.active = active;
+}
+
+bool
+arena_owns(const void * ptr)
+{
+	for (struct arena_block * block = arena.blocks; block; block = block->next)
+	{
+		if ((const char *)ptr >= block->data &&
+		    (const char *)ptr <  block->data + block->size)
+		{
+			return true;
+		}
+	}
+	return false;
+}
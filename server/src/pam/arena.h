@@ -0,0 +1,58 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Request-scoped allocation. Between arena_begin() and arena_end(), the
+ * records built while processing a login (introspect, client, identities and
+ * the account map) are carved out of large blocks owned by this thread instead
+ * of being allocated one by one, and arena_end() releases all of them at once.
+ * Their _fini() routines see that a record belongs to the arena and leave it
+ * alone, so callers free them exactly as they would outside of a request.
+ *
+ * Outside of arena_begin()/arena_end(), arena_calloc() and arena_strdup()
+ * allocate from the heap like calloc() and strdup().
+ *
+ * The blocks themselves come from malloc(), so debug builds see them through
+ * the _test_malloc() hooks like any other allocation.
+ */
+
+void
+arena_begin();
+
+void
+arena_end();
+
+// Zeroed, aligned for any type.
+void *
+arena_calloc(size_t nmemb, size_t size);
+
+char *
+arena_strdup(const char * string);
+
+// Grow 'ptr' from 'old_size' to 'size' bytes. Within a request the old copy
+// stays in the arena until arena_end().
+void *
+arena_realloc(void * ptr, size_t old_size, size_t size);
+
+/*
+ * Allocate from the heap, as outside of a request, until arena_resume(). Used
+ * for records that outlive the request. Returns the state to hand back to
+ * arena_resume().
+ */
+bool
+arena_suspend();
+
+void
+arena_resume(bool active);
+
+// Is 'ptr' inside this thread's arena?
+bool
+arena_owns(const void * ptr);
+
+#endif /* _ARENA_H_ */
@@ -0,0 +1,106 @@
+/*
+ * Compares the two ways of accumulating a Globus Auth reply from libcurl's
+ * write callback: reformatting the whole reply on every call with sformat(),
+ * as capture_response() used to, and appending to a growable buffer. Each
+ * reply is fed in chunks the size libcurl typically delivers: up to
+ * CURL_MAX_WRITE_SIZE (16 KiB) from a fast connection, or one TLS record's
+ * worth of payload (~1.4 KiB) from a slow one.
+ *
+ * Usage: bench_buffer [iterations]
+ */
+
+/*
+ * System includes.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Local includes.
+ */
+#include "strings.h"
+#include "buffer.h"
+
+static double
+_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+_sformat_capture(const char * reply, size_t length, size_t chunk)
+{
+	char * response = NULL;
+
+	for (size_t offset = 0; offset < length; offset += chunk)
+	{
+		size_t size = length - offset < chunk ? length - offset : chunk;
+		char * previous = response;
+		response = sformat("%s%.*s", previous ? previous : "", (int)size, reply + offset);
+		free(previous);
+	}
+	return response;
+}
+
+static char *
+_buffer_capture(const char * reply, size_t length, size_t chunk)
+{
+	struct buffer buffer = {0};
+
+	for (size_t offset = 0; offset < length; offset += chunk)
+	{
+		size_t size = length - offset < chunk ? length - offset : chunk;
+		buffer_append(&buffer, reply + offset, size);
+	}
+	return buffer_steal(&buffer);
+}
+
+int
+main(int argc, char * argv[])
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 20;
+	if (iterations < 1)
+	{
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 2;
+	}
+
+	const size_t lengths[] = {16*1024, 256*1024, 1024*1024};
+	const size_t chunks[]  = {16*1024, 1400};
+
+	printf("%10s %8s %14s %14s %8s\n", "reply", "chunk", "sformat usec", "buffer usec", "speedup");
+
+	for (int l = 0; l < sizeof(lengths)/sizeof(*lengths); l++)
+	{
+		// Any printable, NUL-free payload will do
+		char * reply = malloc(lengths[l]);
+		for (size_t i = 0; i < lengths[l]; i++)
+			reply[i] = 'a' + i % 26;
+
+		for (int c = 0; c < sizeof(chunks)/sizeof(*chunks); c++)
+		{
+			double start = _now();
+			for (int i = 0; i < iterations; i++)
+				free(_sformat_capture(reply, lengths[l], chunks[c]));
+			double sformat_usec = (_now() - start) / iterations * 1e6;
+
+			start = _now();
+			for (int i = 0; i < iterations; i++)
+				free(_buffer_capture(reply, lengths[l], chunks[c]));
+			double buffer_usec = (_now() - start) / iterations * 1e6;
+
+			printf("%10zu %8zu %14.1f %14.1f %7.1fx\n",
+			       lengths[l],
+			       chunks[c],
+			       sformat_usec,
+			       buffer_usec,
+			       sformat_usec / buffer_usec);
+		}
+		free(reply);
+	}
+	return 0;
+}
@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+"""
+A stand-in for the parts of Globus Auth that pam_oauth_ssh.so talks to during
+a login: token introspection, the client record and the identities API. Every
+token is active and belongs to a single identity. Used by run_bench.sh.
+"""
+
+import argparse
+import json
+import ssl
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+IDP_ID = '41143743-f3c8-4d60-bbdb-eeecaba85bd9'
+
+
+def introspect_reply(args):
+    now = int(time.time())
+    return {
+        'active': True,
+        'scope': 'https://auth.globus.org/scopes/%s/ssh' % args.client_id,
+        'client_id': args.client_id,
+        'sub': args.identity_id,
+        'username': args.username,
+        'email': args.username,
+        'iss': 'https://auth.globus.org',
+        'aud': [args.client_id],
+        'exp': now + 3600,
+        'iat': now - 60,
+        'nbf': now - 60,
+        'identities_set': [args.identity_id],
+        'identity_set_detail': [{
+            'sub': args.identity_id,
+            'username': args.username,
+            'identity_provider': IDP_ID,
+            'identity_provider_display_name': 'Bench IdP',
+            'status': 'used',
+        }],
+        'session_info': {
+            'session_id': 'a8a1d4b9-3a5a-4e3e-8a4c-3c1b7b0f5b11',
+            'authentications': {
+                args.identity_id: {
+                    'idp': IDP_ID,
+                    'auth_time': now - 60,
+                    'amr': ['mfa'],
+                },
+            },
+        },
+    }
+
+
+def client_reply(args):
+    return {
+        'client': {
+            'scopes': [],
+            'redirect_uris': [],
+            'grant_types': [],
+            'fqdns': [],
+            'name': 'oauth-ssh bench',
+            'visibility': 'private',
+            'project': 'bench',
+            'id': args.client_id,
+            'public_client': False,
+        }
+    }
+
+
+def identities_reply(args):
+    return {
+        'identities': [{
+            'id': args.identity_id,
+            'username': args.username,
+            'status': 'used',
+            'identity_provider': IDP_ID,
+        }],
+        'included': {
+            'identity_providers': [{
+                'id': IDP_ID,
+                'short_name': 'bench',
+                'name': 'Bench IdP',
+                'domains': [args.username.split('@')[-1]],
+                'alternative_names': [],
+            }]
+        },
+    }
+
+
+def make_handler(args):
+    class Handler(BaseHTTPRequestHandler):
+        # Let libcurl keep its connections alive
+        protocol_version = 'HTTP/1.1'
+        # Headers and body are written separately; don't let Nagle hold the
+        # body until libcurl's delayed ACK.
+        disable_nagle_algorithm = True
+
+        def _reply(self, body):
+            if args.delay:
+                time.sleep(args.delay / 1000.0)
+
+            if body is None:
+                self.send_response(404)
+                self.send_header('Content-Length', '0')
+                self.end_headers()
+                return
+
+            data = json.dumps(body).encode()
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(data)))
+            self.end_headers()
+            self.wfile.write(data)
+
+        def do_POST(self):
+            length = int(self.headers.get('Content-Length', 0))
+            self.rfile.read(length)
+
+            if self.path == '/v2/oauth2/token/introspect':
+                self._reply(introspect_reply(args))
+            else:
+                self._reply(None)
+
+        def do_GET(self):
+            if self.path.startswith('/v2/api/clients/'):
+                self._reply(client_reply(args))
+            elif self.path.startswith('/v2/api/identities?'):
+                self._reply(identities_reply(args))
+            else:
+                self._reply(None)
+
+        def log_message(self, format, *args):
+            pass
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--port', type=int, default=8443)
+    parser.add_argument('--cert', required=True)
+    parser.add_argument('--key', required=True)
+    parser.add_argument('--client-id', required=True)
+    parser.add_argument('--identity-id', required=True)
+    parser.add_argument('--username', default='bench@bench.example.org')
+    parser.add_argument('--delay', type=float, default=0,
+                        help='milliseconds to wait before each reply')
+    args = parser.parse_args()
+
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(args.cert, args.key)
+
+    server = ThreadingHTTPServer(('127.0.0.1', args.port), make_handler(args))
+    server.daemon_threads = True
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,354 @@
+/*
+ * Drives pam_oauth_ssh.so through libpam the same way sshd does and reports
+ * login throughput and latency at increasing levels of concurrency. It is
+ * normally started by run_bench.sh ('make bench') which supplies a PAM
+ * service, a config file and a mock Globus Auth server.
+ *
+ * By default every login is authenticated in a freshly forked process, like
+ * sshd's per-connection privsep child, so nothing carries over between logins
+ * except what the module keeps on disk or in oauth-ssh-helperd. Use -r to
+ * authenticate repeatedly from one long-lived process instead.
+ */
+
+/*
+ * System includes.
+ */
+#include <security/pam_appl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+
+struct bench {
+	const char * service;
+	const char * confdir;
+	const char * user;
+	const char * token;
+	bool         unique_tokens;
+	bool         reuse_process;
+	bool         account_map;
+	bool         resolve;
+	int          logins;
+};
+
+// What the client answers at each of our prompts, in order
+struct inputs {
+	char * commands[2];
+	int    count;
+	int    next;
+};
+
+static void
+_usage(const char * argv0)
+{
+	fprintf(stderr,
+	        "Usage: %s [options] procs...\n"
+	        "  -s service  PAM service name (default: oauth-ssh-bench)\n"
+	        "  -C confdir  directory holding the PAM service file\n"
+	        "  -u user     account to log in as (default: current user)\n"
+	        "  -t token    access token to present (default: bench-token)\n"
+	        "  -U          present a different token on every login\n"
+	        "  -r          authenticate from one process per worker\n"
+	        "  -m          send get_account_map before login in the same\n"
+	        "              conversation (protocol version 2)\n"
+	        "  -R          log in with resolve_and_login\n"
+	        "  -n logins   logins per worker process (default: 100)\n",
+	        argv0);
+	exit(2);
+}
+
+static double
+_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+_base64_encode(const char * in)
+{
+	static const char table[] =
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	size_t len = strlen(in);
+	char * out = calloc(4 * ((len + 2) / 3) + 1, sizeof(char));
+	char * o = out;
+
+	for (size_t i = 0; i < len; i += 3)
+	{
+		unsigned long n = (unsigned char)in[i] << 16;
+		if (i + 1 < len) n |= (unsigned char)in[i+1] << 8;
+		if (i + 2 < len) n |= (unsigned char)in[i+2];
+
+		*o++ = table[(n >> 18) & 0x3f];
+		*o++ = table[(n >> 12) & 0x3f];
+		*o++ = (i + 1 < len) ? table[(n >> 6) & 0x3f] : '=';
+		*o++ = (i + 2 < len) ? table[n & 0x3f] : '=';
+	}
+	return out;
+}
+
+/*
+ * The client sends base64-encoded commands at the passphrase prompt. With -m,
+ * it first asks for its account map and then logs in without reconnecting.
+ * With -R, it does both with a single resolve_and_login.
+ */
+static void
+_login_commands(const struct bench * bench, int worker, int login, struct inputs * inputs)
+{
+	char token[512];
+	if (bench->unique_tokens)
+		snprintf(token, sizeof(token), "%s-%d-%d-%d",
+		         bench->token, (int)getpid(), worker, login);
+	else
+		snprintf(token, sizeof(token), "%s", bench->token);
+
+	int version = bench->account_map || bench->resolve ? 2 : 1;
+	char command[1024];
+
+	memset(inputs, 0, sizeof(*inputs));
+	if (bench->account_map)
+	{
+		snprintf(command, sizeof(command),
+		         "{\"command\": {\"op\": \"get_account_map\", \"access_token\": \"%s\"}, \"version\": %d}",
+		         token, version);
+		inputs->commands[inputs->count++] = _base64_encode(command);
+	}
+
+	snprintf(command, sizeof(command),
+	         "{\"command\": {\"op\": \"%s\", \"access_token\": \"%s\"}, \"version\": %d}",
+	         bench->resolve ? "resolve_and_login" : "login", token, version);
+	inputs->commands[inputs->count++] = _base64_encode(command);
+}
+
+static int
+_conversation(int                         num_msg,
+              const struct pam_message ** msg,
+              struct pam_response      ** resp,
+              void                      * appdata_ptr)
+{
+	struct pam_response * responses = calloc(num_msg, sizeof(*responses));
+
+	for (int i = 0; i < num_msg; i++)
+	{
+		switch (msg[i]->msg_style)
+		{
+		case PAM_PROMPT_ECHO_OFF:
+		case PAM_PROMPT_ECHO_ON:
+		{
+			// Like a password, the last input answers any further prompts
+			struct inputs * inputs = appdata_ptr;
+			int n = inputs->next < inputs->count ? inputs->next++ : inputs->count - 1;
+			responses[i].resp = strdup(inputs->commands[n]);
+			break;
+		}
+		default:
+			// Replies (PAM_TEXT_INFO) are not needed to measure logins
+			break;
+		}
+	}
+
+	*resp = responses;
+	return PAM_SUCCESS;
+}
+
+static int
+_authenticate(const struct bench * bench, struct inputs * inputs)
+{
+	inputs->next = 0;
+	struct pam_conv conv = {_conversation, inputs};
+	pam_handle_t * pamh = NULL;
+	int rc;
+
+	if (bench->confdir)
+	{
+#ifdef HAVE_PAM_START_CONFDIR
+		rc = pam_start_confdir(bench->service, bench->user, &conv, bench->confdir, &pamh);
+#else
+		fprintf(stderr, "This libpam lacks pam_start_confdir(); install the "
+		                "service file into /etc/pam.d and omit -C\n");
+		exit(1);
+#endif
+	} else
+	{
+		rc = pam_start(bench->service, bench->user, &conv, &pamh);
+	}
+
+	if (rc != PAM_SUCCESS)
+		return rc;
+
+	rc = pam_authenticate(pamh, 0);
+	pam_end(pamh, rc);
+	return rc;
+}
+
+/*
+ * Performs one login and returns how long it took in seconds.
+ */
+static double
+_login(const struct bench * bench, int worker, int login, bool * succeeded)
+{
+	struct inputs inputs;
+	_login_commands(bench, worker, login, &inputs);
+	double start = _now();
+
+	if (bench->reuse_process)
+	{
+		*succeeded = (_authenticate(bench, &inputs) == PAM_SUCCESS);
+	} else
+	{
+		int status = 0;
+		pid_t pid = fork();
+		if (pid == 0)
+			_exit(_authenticate(bench, &inputs) == PAM_SUCCESS ? 0 : 1);
+
+		*succeeded = (pid != -1 &&
+		              waitpid(pid, &status, 0) == pid &&
+		              WIFEXITED(status) &&
+		              WEXITSTATUS(status) == 0);
+	}
+
+	double elapsed = _now() - start;
+	for (int i = 0; i < inputs.count; i++)
+		free(inputs.commands[i]);
+	return elapsed;
+}
+
+static int
+_compare_doubles(const void * a, const void * b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static double
+_percentile(const double * sorted, int count, double p)
+{
+	return sorted[(int)(p * (count - 1))];
+}
+
+/*
+ * Runs 'procs' workers of bench->logins each and prints one line of results.
+ */
+static void
+_run(const struct bench * bench, int procs)
+{
+	int count = procs * bench->logins;
+
+	// Workers record into memory shared with this process
+	double * latencies = mmap(NULL, count * sizeof(double), PROT_READ|PROT_WRITE,
+	                          MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	int * failures = mmap(NULL, procs * sizeof(int), PROT_READ|PROT_WRITE,
+	                      MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+
+	if (latencies == MAP_FAILED || failures == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+
+	double start = _now();
+
+	for (int w = 0; w < procs; w++)
+	{
+		pid_t pid = fork();
+		if (pid == -1)
+		{
+			perror("fork");
+			exit(1);
+		}
+
+		if (pid == 0)
+		{
+			for (int i = 0; i < bench->logins; i++)
+			{
+				bool succeeded = false;
+				latencies[w * bench->logins + i] = _login(bench, w, i, &succeeded);
+				if (!succeeded)
+					failures[w]++;
+			}
+			_exit(0);
+		}
+	}
+
+	while (wait(NULL) > 0);
+
+	double elapsed = _now() - start;
+
+	int failed = 0;
+	for (int w = 0; w < procs; w++)
+		failed += failures[w];
+
+	qsort(latencies, count, sizeof(double), _compare_doubles);
+
+	printf("%5d %8d %8d %10.1f %10.2f %10.2f %10.2f\n",
+	       procs,
+	       count,
+	       failed,
+	       count / elapsed,
+	       _percentile(latencies, count, 0.50) * 1000,
+	       _percentile(latencies, count, 0.99) * 1000,
+	       _percentile(latencies, count, 0.999) * 1000);
+	fflush(stdout);
+
+	munmap(latencies, count * sizeof(double));
+	munmap(failures, procs * sizeof(int));
+}
+
+int
+main(int argc, char * argv[])
+{
+	struct bench bench = {
+		.service = "oauth-ssh-bench",
+		.token   = "bench-token",
+		.logins  = 100,
+	};
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:C:u:t:UrmRn:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 's': bench.service = optarg; break;
+		case 'C': bench.confdir = optarg; break;
+		case 'u': bench.user    = optarg; break;
+		case 't': bench.token   = optarg; break;
+		case 'U': bench.unique_tokens = true; break;
+		case 'r': bench.reuse_process = true; break;
+		case 'm': bench.account_map   = true; break;
+		case 'R': bench.resolve       = true; break;
+		case 'n': bench.logins  = atoi(optarg); break;
+		default:  _usage(argv[0]);
+		}
+	}
+
+	if (optind == argc || bench.logins <= 0)
+		_usage(argv[0]);
+
+	if (!bench.user)
+		bench.user = getlogin();
+	if (!bench.user)
+		bench.user = getenv("USER");
+	if (!bench.user)
+		_usage(argv[0]);
+
+	printf("%5s %8s %8s %10s %10s %10s %10s\n",
+	       "procs", "logins", "failed", "logins/s", "p50 ms", "p99 ms", "p999 ms");
+
+	for (int i = optind; i < argc; i++)
+	{
+		int procs = atoi(argv[i]);
+		if (procs <= 0)
+			_usage(argv[0]);
+		_run(&bench, procs);
+	}
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# Measures logins through pam_oauth_ssh.so against a local mock of Globus Auth.
+#
+#   run_bench.sh <path to pam_oauth_ssh.so> <path to pam_bench> [pam_bench args]
+#
+# Environment:
+#   BENCH_PORT    port for the mock Globus Auth server (default: 8443)
+#   BENCH_USER    local account to log in as (default: current user)
+#   BENCH_DELAY   milliseconds the mock waits before each reply (default: 0)
+#   BENCH_CONFIG  extra lines appended to the generated oauth-ssh.conf,
+#                 ie. "introspect_cache_ttl 30"
+#
+# Run as root so the module can use /var/cache/oauth_ssh like it does under
+# sshd; otherwise the numbers exclude the on-disk caches.
+#
+set -e
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 <pam_oauth_ssh.so> <pam_bench> [pam_bench args]" >&2
+	exit 2
+fi
+
+module=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+bench=$2
+shift 2
+
+srcdir=$(cd "$(dirname "$0")" && pwd)
+port=${BENCH_PORT:-8443}
+user=${BENCH_USER:-$(id -un)}
+client_id=d3b3ee4c-0d1a-4b7e-9b0c-5b4f1c6a0e21
+identity_id=6c1a3b0e-5b7a-4a8e-9d63-1f6b0f2f0c11
+
+work=$(mktemp -d)
+mock=
+trap '[ -n "$mock" ] && kill $mock 2>/dev/null; rm -rf "$work"' EXIT
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 \
+        -subj /CN=localhost -addext subjectAltName=IP:127.0.0.1 \
+        -keyout "$work/key.pem" -out "$work/cert.pem" 2>/dev/null
+
+cat > "$work/oauth-ssh.conf" <<EOF
+auth_method globus_auth
+client_id $client_id
+client_secret bench
+map_file $work/globus-acct-map
+${BENCH_CONFIG:-}
+EOF
+
+echo "$identity_id $user" > "$work/globus-acct-map"
+
+mkdir "$work/pam.d"
+echo "auth required $module config_file=$work/oauth-ssh.conf" \
+     "auth_host=127.0.0.1:$port cafile=$work/cert.pem" > "$work/pam.d/oauth-ssh-bench"
+
+python3 "$srcdir/mock_auth.py" --port "$port" \
+                               --cert "$work/cert.pem" \
+                               --key "$work/key.pem" \
+                               --client-id "$client_id" \
+                               --identity-id "$identity_id" \
+                               --delay "${BENCH_DELAY:-0}" &
+mock=$!
+
+# Wait for the mock to start listening
+for i in $(seq 50); do
+	python3 -c "import socket; socket.create_connection(('127.0.0.1', $port))" \
+	        2>/dev/null && break
+	sleep 0.1
+done
+
+"$bench" -C "$work/pam.d" -s oauth-ssh-bench -u "$user" "$@"
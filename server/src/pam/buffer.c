@@ -0,0 +1,64 @@
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Local includes.
+ */
+#include "buffer.h"
+#include "debug.h" // always last
+
+// Large enough for most Globus Auth replies in one allocation
+#define BUFFER_INITIAL_CAPACITY 4096
+
+bool
+buffer_append(struct buffer * buffer, const char * data, size_t length)
+{
+	if (buffer->max && length > buffer->max - buffer->length)
+		return false;
+
+	// Always leave room for buffer_steal()'s NUL
+	size_t needed = buffer->length + length + 1;
+	if (needed > buffer->capacity)
+	{
+		size_t capacity = buffer->capacity ? buffer->capacity : BUFFER_INITIAL_CAPACITY;
+		while (capacity < needed)
+			capacity *= 2;
+
+		if (buffer->max && capacity > buffer->max + 1)
+			capacity = buffer->max + 1;
+
+		char * grown = realloc(buffer->data, capacity);
+		if (!grown)
+			return false;
+
+		buffer->data     = grown;
+		buffer->capacity = capacity;
+	}
+
+	memcpy(buffer->data + buffer->length, data, length);
+	buffer->length += length;
+	return true;
+}
+
+char *
+buffer_steal(struct buffer * buffer)
+{
+	char * data = buffer->data;
+	if (data)
+		data[buffer->length] = '\0';
+
+	buffer->data     = NULL;
+	buffer->length   = 0;
+	buffer->capacity = 0;
+	return data;
+}
+
+void
+buffer_fini(struct buffer * buffer)
+{
+	free(buffer_steal(buffer));
+}
@@ -0,0 +1,35 @@
+#ifndef _BUFFER_H_
+#define _BUFFER_H_
+
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Growable byte buffer for replies that arrive in pieces. Capacity doubles as
+ * needed so appending n bytes in any number of pieces costs O(n) copies.
+ * Zero-initialize before use.
+ */
+struct buffer {
+	char   * data;
+	size_t   length;
+	size_t   capacity;
+	size_t   max;      // refuse to grow past this many bytes; 0 for no limit
+};
+
+// Append 'length' bytes of 'data'. Returns false, leaving the buffer
+// unchanged, if the result would be longer than 'max'.
+bool
+buffer_append(struct buffer *, const char * data, size_t length);
+
+// Return the contents as a newly-allocated NUL-terminated string, or NULL if
+// nothing was appended, and reset the buffer.
+char *
+buffer_steal(struct buffer *);
+
+void
+buffer_fini(struct buffer *);
+
+#endif /* _BUFFER_H_ */
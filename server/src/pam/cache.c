@@ -0,0 +1,557 @@
+/*
+ * System includes.
+ */
+#include <openssl/evp.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ * Local includes.
+ */
+#include "strings.h"
+#include "logger.h"
+#include "cache.h"
+#include "debug.h" // always last
+
+/*******************************************************************************
+ * Internal (Private) Functions
+ ******************************************************************************/
+
+#define CACHE_MAGIC    0x4f534843 // 'OSHC'
+#define CACHE_VERSION  2
+#define CACHE_SLOTS    256
+#define CACHE_WAYS     4
+#define CACHE_DATA_LEN (16*1024)
+#define DIGEST_LEN     32
+
+typedef enum {
+	CACHE_SLOT_EMPTY,
+	CACHE_SLOT_PENDING, // 'owner' is fetching the value; see cache_get_or_claim()
+	CACHE_SLOT_VALID,
+} slot_state_t;
+
+struct cache_slot {
+	unsigned char digest[DIGEST_LEN];
+	time_t        expires;
+	uint32_t      state;
+	uint32_t      generation; // futex word; bumped whenever the slot changes
+	pid_t         owner;
+	uint32_t      length;
+	char          data[CACHE_DATA_LEN];
+};
+
+struct cache_segment {
+	uint32_t          magic;
+	uint32_t          version;
+	struct cache_slot slots[CACHE_SLOTS];
+};
+
+static pthread_once_t         cache_once    = PTHREAD_ONCE_INIT;
+static pthread_mutex_t        cache_mutex   = PTHREAD_MUTEX_INITIALIZER;
+static struct cache_segment * cache_segment = NULL;
+static int                    cache_fd      = -1;
+
+/*
+ * Map CACHE_DEFAULT_FILE into our address space, creating it if necessary. The
+ * segment holds introspection results so it must be private to our user.
+ */
+static void
+_cache_open()
+{
+	int fd = open(CACHE_DEFAULT_FILE,
+	              O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC,
+	              S_IRUSR|S_IWUSR);
+	if (fd == -1)
+	{
+		logger(LOG_TYPE_DEBUG, "Could not open %s: %m", CACHE_DEFAULT_FILE);
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 ||
+	    !S_ISREG(st.st_mode) ||
+	    st.st_uid != geteuid() ||
+	    (st.st_mode & (S_IRWXG|S_IRWXO)))
+	{
+		logger(LOG_TYPE_ERROR,
+		       "Ignoring %s: not a private regular file",
+		       CACHE_DEFAULT_FILE);
+		close(fd);
+		return;
+	}
+
+	flock(fd, LOCK_EX);
+
+	// Only ever grow the file; shrinking it would fault other mappings.
+	if (st.st_size < sizeof(struct cache_segment) &&
+	    ftruncate(fd, sizeof(struct cache_segment)) == -1)
+	{
+		logger(LOG_TYPE_ERROR, "Could not size %s: %m", CACHE_DEFAULT_FILE);
+		flock(fd, LOCK_UN);
+		close(fd);
+		return;
+	}
+
+	struct cache_segment * segment = mmap(NULL,
+	                                      sizeof(struct cache_segment),
+	                                      PROT_READ|PROT_WRITE,
+	                                      MAP_SHARED,
+	                                      fd,
+	                                      0);
+	if (segment == MAP_FAILED)
+	{
+		logger(LOG_TYPE_ERROR, "Could not map %s: %m", CACHE_DEFAULT_FILE);
+		flock(fd, LOCK_UN);
+		close(fd);
+		return;
+	}
+
+	if (segment->magic != CACHE_MAGIC || segment->version != CACHE_VERSION)
+	{
+		memset(segment, 0, sizeof(*segment));
+		segment->magic   = CACHE_MAGIC;
+		segment->version = CACHE_VERSION;
+	}
+
+	flock(fd, LOCK_UN);
+
+	cache_fd = fd;
+	cache_segment = segment;
+}
+
+static bool
+_cache_lock(int operation)
+{
+	pthread_once(&cache_once, _cache_open);
+	if (!cache_segment)
+		return false;
+
+	// flock() does not exclude threads sharing our descriptor
+	pthread_mutex_lock(&cache_mutex);
+	flock(cache_fd, operation);
+	return true;
+}
+
+static void
+_cache_unlock()
+{
+	flock(cache_fd, LOCK_UN);
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+static bool
+_cache_digest(const char * ns, const char * key, unsigned char digest[DIGEST_LEN])
+{
+	unsigned int length = 0;
+	bool success = false;
+
+	EVP_MD_CTX * ctx = EVP_MD_CTX_new();
+	if (!ctx)
+		return false;
+
+	// Include the terminator so that ('ab', 'c') differs from ('a', 'bc')
+	if (EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) &&
+	    EVP_DigestUpdate(ctx, ns, strlen(ns)+1) &&
+	    EVP_DigestUpdate(ctx, key, strlen(key)) &&
+	    EVP_DigestFinal_ex(ctx, digest, &length))
+	{
+		success = (length == DIGEST_LEN);
+	}
+	EVP_MD_CTX_free(ctx);
+	return success;
+}
+
+/*
+ * Entries live in one of CACHE_WAYS consecutive slots chosen by the digest.
+ */
+static struct cache_slot *
+_cache_set(const unsigned char digest[DIGEST_LEN])
+{
+	uint32_t hash;
+	memcpy(&hash, digest, sizeof(hash));
+	return &cache_segment->slots[(hash % (CACHE_SLOTS/CACHE_WAYS)) * CACHE_WAYS];
+}
+
+static struct cache_slot *
+_cache_find(const unsigned char digest[DIGEST_LEN])
+{
+	struct cache_slot * set = _cache_set(digest);
+	for (int i = 0; i < CACHE_WAYS; i++)
+	{
+		if (set[i].state != CACHE_SLOT_EMPTY &&
+		    memcmp(set[i].digest, digest, DIGEST_LEN) == 0)
+		{
+			return &set[i];
+		}
+	}
+	return NULL;
+}
+
+static bool
+_cache_is_claimed(const struct cache_slot * slot, time_t now)
+{
+	if (slot->state != CACHE_SLOT_PENDING || slot->expires <= now)
+		return false;
+
+	// Don't wait on a process that died mid-fetch
+	return (kill(slot->owner, 0) == 0 || errno == EPERM);
+}
+
+/*
+ * Prefer our own slot, then the entry closest to expiring. Live claims are
+ * only evicted if every slot in the set holds one.
+ */
+static struct cache_slot *
+_cache_victim(const unsigned char digest[DIGEST_LEN], time_t now)
+{
+	struct cache_slot * slot = _cache_find(digest);
+	if (slot)
+		return slot;
+
+	struct cache_slot * set = _cache_set(digest);
+	for (int i = 0; i < CACHE_WAYS; i++)
+	{
+		if (_cache_is_claimed(&set[i], now))
+			continue;
+		if (!slot || set[i].expires < slot->expires)
+			slot = &set[i];
+	}
+	return slot ? slot : &set[0];
+}
+
+static void
+_cache_futex(uint32_t * word, int op, uint32_t value, const struct timespec * timeout)
+{
+	// Not FUTEX_PRIVATE_FLAG; waiters live in other processes
+	syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+// Caller holds the lock. Waiters are woken once it is released.
+static void
+_cache_changed(struct cache_slot * slot)
+{
+	__atomic_add_fetch(&slot->generation, 1, __ATOMIC_RELEASE);
+}
+
+static void
+_cache_wake(struct cache_slot * slot)
+{
+	_cache_futex(&slot->generation, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+/*******************************************************************************
+ * Public Functions
+ ******************************************************************************/
+
+char *
+cache_get(const char * ns, const char * key)
+{
+	unsigned char digest[DIGEST_LEN];
+	if (!_cache_digest(ns, key, digest))
+		return NULL;
+
+	if (!_cache_lock(LOCK_SH))
+		return NULL;
+
+	char * value = NULL;
+	struct cache_slot * slot = _cache_find(digest);
+	if (slot &&
+	    slot->state == CACHE_SLOT_VALID &&
+	    slot->expires > time(NULL) &&
+	    slot->length < CACHE_DATA_LEN)
+	{
+		value = strndup(slot->data, slot->length);
+	}
+
+	_cache_unlock();
+	return value;
+}
+
+char *
+cache_get_or_claim(const char * ns, const char * key, bool reuse, bool * claimed)
+{
+	*claimed = false;
+
+	unsigned char digest[DIGEST_LEN];
+	if (!_cache_digest(ns, key, digest))
+		return NULL;
+
+	time_t   deadline = time(NULL) + CACHE_CLAIM_TIMEOUT;
+	bool     waited   = false;
+	uint32_t seen     = 0;
+
+	for (;;)
+	{
+		if (!_cache_lock(LOCK_EX))
+			return NULL;
+
+		time_t now = time(NULL);
+		struct cache_slot * slot = _cache_find(digest);
+
+		// The value published for us may already be past its expiration
+		// if the owner did not want it reused by later callers.
+		if (slot &&
+		    slot->state == CACHE_SLOT_VALID &&
+		    slot->length < CACHE_DATA_LEN &&
+		    ((reuse && slot->expires > now) || (waited && slot->generation != seen)))
+		{
+			char * value = strndup(slot->data, slot->length);
+			_cache_unlock();
+			return value;
+		}
+
+		if (slot && _cache_is_claimed(slot, now))
+		{
+			if (now >= deadline)
+			{
+				// Give up on the owner and fetch it ourselves
+				_cache_unlock();
+				logger(LOG_TYPE_DEBUG, "Timed out waiting on a %s request", ns);
+				return NULL;
+			}
+
+			uint32_t * word = &slot->generation;
+			seen   = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+			waited = true;
+			_cache_unlock();
+
+			// Wake periodically in case the owner dies without releasing
+			struct timespec timeout = {.tv_nsec = 100*1000*1000};
+			_cache_futex(word, FUTEX_WAIT, seen, &timeout);
+			continue;
+		}
+
+		// The owner failed; rather than take turns failing, fetch it ourselves
+		if (waited)
+		{
+			_cache_unlock();
+			return NULL;
+		}
+
+		slot = _cache_victim(digest, now);
+		memcpy(slot->digest, digest, DIGEST_LEN);
+		slot->state   = CACHE_SLOT_PENDING;
+		slot->owner   = getpid();
+		slot->expires = now + CACHE_CLAIM_TIMEOUT;
+		slot->length  = 0;
+		_cache_changed(slot);
+
+		_cache_unlock();
+		_cache_wake(slot);
+
+		*claimed = true;
+		return NULL;
+	}
+}
+
+void
+cache_put(const char * ns, const char * key, const char * value, time_t expires)
+{
+	size_t length = strlen(value);
+	if (length >= CACHE_DATA_LEN)
+	{
+		logger(LOG_TYPE_DEBUG, "Value too large to cache (%zu bytes)", length);
+		cache_unclaim(ns, key);
+		return;
+	}
+
+	unsigned char digest[DIGEST_LEN];
+	if (!_cache_digest(ns, key, digest))
+		return;
+
+	if (!_cache_lock(LOCK_EX))
+		return;
+
+	struct cache_slot * slot = _cache_victim(digest, time(NULL));
+
+	memcpy(slot->digest, digest, DIGEST_LEN);
+	memcpy(slot->data, value, length);
+	slot->data[length] = '\0';
+	slot->length  = length;
+	slot->expires = expires;
+	slot->state   = CACHE_SLOT_VALID;
+	slot->owner   = 0;
+	_cache_changed(slot);
+
+	_cache_unlock();
+	_cache_wake(slot);
+}
+
+void
+cache_unclaim(const char * ns, const char * key)
+{
+	unsigned char digest[DIGEST_LEN];
+	if (!_cache_digest(ns, key, digest))
+		return;
+
+	if (!_cache_lock(LOCK_EX))
+		return;
+
+	struct cache_slot * slot = _cache_find(digest);
+	if (!slot || slot->state != CACHE_SLOT_PENDING)
+	{
+		_cache_unlock();
+		return;
+	}
+
+	memset(slot->digest, 0, DIGEST_LEN);
+	slot->state   = CACHE_SLOT_EMPTY;
+	slot->expires = 0;
+	slot->owner   = 0;
+	_cache_changed(slot);
+
+	_cache_unlock();
+	_cache_wake(slot);
+}
+
+/*
+ * On-disk cache.
+ */
+
+static char *
+_cache_file_path(const char * name, const char * suffix)
+{
+	// Names come from our configuration; don't let them leave our directory
+	if (strchr(name, '/'))
+		return NULL;
+	return sformat("%s/%s%s", CACHE_DEFAULT_DIR, name, suffix);
+}
+
+int
+cache_file_open(const char * name, struct stat * st)
+{
+	char * path = _cache_file_path(name, "");
+	if (!path)
+		return -1;
+
+	int fd = open(path, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+	if (fd == -1)
+		goto cleanup;
+
+	if (fstat(fd, st) == -1 ||
+	    !S_ISREG(st->st_mode) ||
+	    st->st_uid != geteuid() ||
+	    (st->st_mode & (S_IWGRP|S_IWOTH)))
+	{
+		logger(LOG_TYPE_ERROR, "Ignoring %s: not a private regular file", path);
+		close(fd);
+		fd = -1;
+	}
+
+cleanup:
+	free(path);
+	return fd;
+}
+
+char *
+cache_file_read(const char * name, struct stat * st)
+{
+	int fd = cache_file_open(name, st);
+	if (fd == -1)
+		return NULL;
+
+	char * contents = calloc(st->st_size+1, sizeof(char));
+
+	ssize_t length = 0;
+	while (length < st->st_size)
+	{
+		ssize_t cnt = read(fd, contents+length, st->st_size-length);
+		if (cnt == -1 && errno == EINTR)
+			continue;
+		if (cnt <= 0)
+			break;
+		length += cnt;
+	}
+	close(fd);
+
+	if (length != st->st_size)
+	{
+		free(contents);
+		return NULL;
+	}
+	return contents;
+}
+
+void
+cache_file_write(const char * name, const char * contents)
+{
+	cache_file_store(name, contents, strlen(contents));
+}
+
+void
+cache_file_store(const char * name, const void * data, size_t length)
+{
+	char * path = _cache_file_path(name, "");
+	char * tmp_path = _cache_file_path(name, ".XXXXXX");
+	if (!path || !tmp_path)
+		goto cleanup;
+
+	if (mkdir(CACHE_DEFAULT_DIR, S_IRWXU) == -1 && errno != EEXIST)
+	{
+		logger(LOG_TYPE_ERROR, "Could not create %s: %m", CACHE_DEFAULT_DIR);
+		goto cleanup;
+	}
+
+	int fd = mkstemp(tmp_path);
+	if (fd == -1)
+	{
+		logger(LOG_TYPE_ERROR, "Could not create %s: %m", tmp_path);
+		goto cleanup;
+	}
+
+	size_t offset = 0;
+	while (offset < length)
+	{
+		ssize_t cnt = write(fd, (const char *)data+offset, length-offset);
+		if (cnt == -1 && errno == EINTR)
+			continue;
+		if (cnt <= 0)
+			break;
+		offset += cnt;
+	}
+	close(fd);
+
+	if (offset != length || rename(tmp_path, path) == -1)
+	{
+		logger(LOG_TYPE_ERROR, "Could not write %s: %m", path);
+		unlink(tmp_path);
+	}
+
+cleanup:
+	free(path);
+	free(tmp_path);
+}
+
+int
+cache_file_trylock(const char * name)
+{
+	char * path = _cache_file_path(name, ".lock");
+	if (!path)
+		return -1;
+
+	int fd = open(path, O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC, S_IRUSR|S_IWUSR);
+	free(path);
+	if (fd == -1)
+		return -1;
+
+	if (flock(fd, LOCK_EX|LOCK_NB) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
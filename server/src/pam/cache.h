@@ -0,0 +1,84 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+/*
+ * System includes.
+ */
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * Shared-memory cache of Globus Auth replies. Every sshd child maps the same
+ * file so that a reply fetched by one process can be reused by the others.
+ * Entries are stored under the SHA-256 of ('namespace', 'key') so secrets
+ * such as access tokens never land in the segment.
+ *
+ * The cache is purely an optimization; all failures are silently treated as
+ * cache misses.
+ */
+#define CACHE_DEFAULT_FILE "/dev/shm/oauth_ssh_cache"
+
+// Return a newly-allocated copy of the value stored under (ns, key) or NULL
+// if it is missing or has expired.
+char *
+cache_get(const char * ns, const char * key);
+
+// Store 'value' under (ns, key) until 'expires'. Values that do not fit in a
+// cache slot are not stored.
+void
+cache_put(const char * ns, const char * key, const char * value, time_t expires);
+
+/*
+ * Request coalescing. Returns the cached value for (ns, key) if there is one
+ * and 'reuse' is set; callers whose caching has since been disabled pass
+ * false so that values stored earlier are ignored. Otherwise, if another
+ * caller is already fetching it, waits up to CACHE_CLAIM_TIMEOUT seconds for
+ * that caller's cache_put(). If nobody is, returns NULL and sets '*claimed';
+ * the caller must then either cache_put() its result or cache_unclaim() so
+ * that waiters stop waiting.
+ *
+ * Waiters accept the value published for them even if its 'expires' has
+ * already passed, so a caller can share a result with concurrent requests
+ * without caching it for later ones by passing 'expires' = time(NULL).
+ */
+#define CACHE_CLAIM_TIMEOUT 10 // seconds
+
+char *
+cache_get_or_claim(const char * ns, const char * key, bool reuse, bool * claimed);
+
+void
+cache_unclaim(const char * ns, const char * key);
+
+/*
+ * On-disk cache for records that rarely change. Files are private to our user
+ * and are replaced atomically so readers never see a partial write.
+ */
+#define CACHE_DEFAULT_DIR "/var/cache/oauth_ssh"
+
+// Return a read-only descriptor for 'name' within CACHE_DEFAULT_DIR or -1 if
+// it does not exist or is not a private regular file. 'st' is filled in.
+int
+cache_file_open(const char * name, struct stat * st);
+
+// Return the newly-allocated contents of 'name' within CACHE_DEFAULT_DIR or
+// NULL if it does not exist. 'st' is filled in, ie. st_mtime is when it was
+// written.
+char *
+cache_file_read(const char * name, struct stat * st);
+
+// Atomically replace 'name' within CACHE_DEFAULT_DIR with 'contents'.
+void
+cache_file_write(const char * name, const char * contents);
+
+// Same as cache_file_write() for binary data.
+void
+cache_file_store(const char * name, const void * data, size_t length);
+
+// Return a descriptor holding an exclusive lock associated with 'name', or -1
+// if another process holds it. Closing the descriptor releases the lock.
+int
+cache_file_trylock(const char * name);
+
+#endif /* _CACHE_H_ */
@@ -9,170 +9,127 @@
  * Local includes.
  */
 #include "client.h"
+#include "decoder.h"
+#include "hash.h"
+#include "arena.h"
 #include "logger.h"
 #include "strings.h"
 #include "json.h"
 #include "debug.h" // always last
 
+/*
+ * Field tables are sorted by key.
+ */
 
-typedef enum { success, failure } status_t;
-
-static status_t
-check_key(jobj_t * jobj, const char * key, json_type expected_type)
-{
-	if (!jobj_key_exists(jobj, key))
-	{
-		logger(LOG_TYPE_ERROR,
-		       "Client record is missing required key '%s'", key);
-		return failure;
-	}
-
-	if (jobj_get_type(jobj, key) != expected_type)
-	{
-		logger(LOG_TYPE_ERROR,
-		       "Client record has wrong type for required key '%s'", key);
-		return failure;
-	}
-	return success;
-}
-
-typedef status_t (*func_t)(jobj_t * jobj, void * value);
-
-#define GET_CONTAINER(j, i, key, type) \
-     get_value(j, #key, json_type_##type, &i->key, get_##key)
-
-#define GET_VALUE(j, i, key, type) \
-     get_value(j, #key, json_type_##type, &i->key, NULL)
-
-
-static status_t
-get_value(jobj_t     * jobj,
-          const char * key,
-          json_type    jtype,
-          void       * value,
-          func_t       func)
-{
-	if (check_key(jobj, key, jtype) == failure)
-		return failure;
-	const char * tmp;
-
-	switch (jtype)
-	{
-	case json_type_int:
-		*(int *)value = jobj_get_int(jobj, key);
-		break;
-	case json_type_string:
-		tmp = jobj_get_string(jobj, key);
-		if (tmp) *(char **)value = strdup(tmp);
-		break;
-	case json_type_boolean:
-		*(bool *)value = jobj_get_bool(jobj, key);
-		break;
-	case json_type_array:
-	case json_type_object:
-		return func(jobj_get_value(jobj, key), value);
-
-	case json_type_double:
-	case json_type_null:
-		ASSERT(0);
-		return failure;
-	}
-	return success;
-}
+#define WHAT "Client record"
 
-status_t
-get_string_array(jarr_t * jarr, const char * key, void * value)
+// XXX Skip optional fields for now
+//static const struct decode_field links_fields[] = {
+//	DECODE_VALUE(struct links, privacy_policy,       string, DECODE_REQUIRED),
+//	DECODE_VALUE(struct links, terms_and_conditions, string, DECODE_REQUIRED),
+//};
+//
+//static const struct decoder links_decoder =
+//	DECODER(struct links, WHAT, links_fields);
+
+static const struct decode_field client_fields[] = {
+	DECODE_CONTAINER(struct client, fqdns,       array, DECODE_REQUIRED, decode_strings, NULL),
+	DECODE_CONTAINER(struct client, grant_types, array, DECODE_REQUIRED, decode_strings, NULL),
+	DECODE_VALUE(struct client, id, string, DECODE_REQUIRED),
+//	DECODE_CONTAINER(struct client, links, object, DECODE_OPTIONAL, decode_record, &links_decoder),
+	DECODE_VALUE(struct client, name, string, DECODE_REQUIRED),
+//	DECODE_VALUE(struct client, parent_client, string, DECODE_OPTIONAL),
+//	DECODE_VALUE(struct client, preselect_idp, string, DECODE_OPTIONAL),
+	DECODE_VALUE(struct client, project,       string,  DECODE_REQUIRED),
+	DECODE_VALUE(struct client, public_client, boolean, DECODE_REQUIRED),
+	DECODE_CONTAINER(struct client, redirect_uris, array, DECODE_REQUIRED, decode_strings, NULL),
+//	DECODE_VALUE(struct client, required_idp, string, DECODE_OPTIONAL),
+	DECODE_CONTAINER(struct client, scopes, array, DECODE_REQUIRED, decode_strings, NULL),
+	DECODE_VALUE(struct client, visibility, string, DECODE_REQUIRED),
+};
+
+static const struct decoder client_decoder =
+	DECODER(struct client, WHAT, client_fields);
+
+// client info is in the 'client' envelope
+static const struct decode_field envelope_fields[] = {
+	{"client", json_type_object, DECODE_REQUIRED, 0, sizeof(struct client), decode_record, &client_decoder},
+};
+
+static const struct decoder envelope_decoder =
+	DECODER(struct client, WHAT, envelope_fields);
+
+#define SSH_SCOPE_PREFIX "https://auth.globus.org/scopes/"
+#define SSH_SCOPE_SUFFIX "/ssh"
+
+static void
+_add_ssh_scope(struct ssh_scopes * set, const char * fqdn_or_id)
 {
-	char ** list = calloc(jarr_get_length(jarr)+1, sizeof(char *));
-	*(char ***)value = list;
+	char * scope = sformat("%s%s%s", SSH_SCOPE_PREFIX, fqdn_or_id, SSH_SCOPE_SUFFIX);
 
-	for (int k = 0; k < jarr_get_length(jarr); k++)
+	if (hash_find(&set->index, scope))
 	{
-		if (jarr_get_type(jarr, k) != json_type_string)
-		{
-			logger(LOG_TYPE_ERROR, "'%s' is malformed", key);
-			return failure;
-		}
-		list[k] = strdup(jarr_get_string(jarr, k));
+		free(scope);
+		return;
 	}
-	return success;
-}
 
-status_t
-get_scopes(jarr_t * jarr, void * value)
-{
-	return get_string_array(jarr, "scopes", value);
+	struct ssh_scope * s = &set->scopes[set->count++];
+	s->scope = scope;
+	hash_insert(&set->index, &s->node, s->scope);
 }
 
-status_t
-get_redirect_uris(jarr_t * jarr, void * value)
+// Build the set of scopes accepted for SSH so that checking a token's scopes
+// is one lookup per scope. It outlives the request that decoded the record.
+static struct ssh_scopes *
+_build_ssh_scopes(const struct client * c)
 {
-	return get_string_array(jarr, "redirect_uris", value);
-}
+	bool active = arena_suspend();
 
-status_t
-get_grant_types(jarr_t * jarr, void * value)
-{
-	return get_string_array(jarr, "grant_types", value);
-}
+	int count = 1; // id
+	while (c->fqdns[count-1])
+		count++;
 
-status_t
-get_fqdns(jarr_t * jarr, void * value)
-{
-	return get_string_array(jarr, "fqdns", value);
-}
+	struct ssh_scopes * set = calloc(1, sizeof(*set));
+	set->scopes = calloc(count, sizeof(*set->scopes));
+	set->refcount = 1;
 
-status_t
-get_links(jobj_t * jobj, void * value)
-{
-    struct links * l = value;
+	for (int i = 0; c->fqdns[i]; i++)
+		_add_ssh_scope(set, c->fqdns[i]);
+	_add_ssh_scope(set, c->id);
 
-	if (GET_VALUE(jobj, l, privacy_policy,       string) == failure ||
-        GET_VALUE(jobj, l, terms_and_conditions, string) == failure)
-	{
-		return failure;
-	}
-	return success;
+	arena_resume(active);
+	return set;
 }
 
-
 struct client *
-client_init(jobj_t * jobj)
+client_init(jobj_t * jobj, struct ssh_scopes * ssh_scopes)
 {
-	// client info is in the 'client' envelope
+	struct client * c = arena_calloc(1, sizeof(*c));
 
-	const char * key = "client";
-	if (check_key(jobj, key, json_type_object))
-		return NULL;
-	jobj = jobj_get_value(jobj, key);
-
-	struct client * c = calloc(1, sizeof(*c));
-
-	if (GET_CONTAINER(jobj, c, scopes,        array)  == failure ||
-	    GET_CONTAINER(jobj, c, redirect_uris, array)  == failure ||
-	    GET_CONTAINER(jobj, c, grant_types,   array)  == failure ||
-	    GET_CONTAINER(jobj, c, fqdns,         array)  == failure ||
-// XXX Skip optional fields for now
-//	    GET_CONTAINER(jobj, c, links,         object) == failure ||
-	    GET_VALUE(jobj, c, name,          string)  == failure ||
-	    GET_VALUE(jobj, c, visibility,    string)  == failure ||
-	    GET_VALUE(jobj, c, project,       string)  == failure ||
-//	    GET_VALUE(jobj, c, required_idp,  string)  == failure ||
-//	    GET_VALUE(jobj, c, preselect_idp, string)  == failure ||
-//	    GET_VALUE(jobj, c, parent_client, string)  == failure ||
-	    GET_VALUE(jobj, c, id,            string)  == failure ||
-	    GET_VALUE(jobj, c, public_client, boolean) == failure)
+	if (!decode_object(jobj, &envelope_decoder, c))
 	{
 		client_fini(c);
 		return NULL;
 	}
 
+	if (ssh_scopes)
+		c->ssh_scopes = ssh_scopes_hold(ssh_scopes);
+	else
+		c->ssh_scopes = _build_ssh_scopes(c);
 	return c;
 }
 
 void
 client_fini(struct client * c)
 {
+	// Shared with other clients and never in the arena
+	if (c)
+		ssh_scopes_release(c->ssh_scopes);
+
+	// Released by arena_end()
+	if (c && arena_owns(c))
+		return;
+
 	if (c)
 	{
 		free_array(c->scopes);
@@ -192,3 +149,40 @@ client_fini(struct client * c)
 	free(c);
 }
 
+struct ssh_scopes *
+ssh_scopes_hold(struct ssh_scopes * set)
+{
+	if (set)
+		__atomic_add_fetch(&set->refcount, 1, __ATOMIC_RELAXED);
+	return set;
+}
+
+void
+ssh_scopes_release(struct ssh_scopes * set)
+{
+	if (!set || __atomic_sub_fetch(&set->refcount, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	for (int i = 0; i < set->count; i++)
+		free(set->scopes[i].scope);
+	free(set->scopes);
+	hash_fini(&set->index);
+	free(set);
+}
+
+bool
+client_has_ssh_scope(const struct client * c, const char * scopes)
+{
+	// One pass over the token's scopes without copying them
+	while (scopes && *scopes)
+	{
+		size_t length = strcspn(scopes, " ");
+		if (length && hash_find_n(&c->ssh_scopes->index, scopes, length))
+			return true;
+
+		scopes += length;
+		scopes += strspn(scopes, " ");
+	}
+	return false;
+}
+
@@ -10,6 +10,26 @@
  * Local includes.
  */
 #include "json.h"
+#include "hash.h"
+
+// A scope that grants SSH access, ie.
+// https://auth.globus.org/scopes/<fqdn|client id>/ssh
+struct ssh_scope {
+	char *           scope;
+	struct hash_node node;
+};
+
+/*
+ * The ssh scopes of a client record, built once per record. It is read-only
+ * and lives on the heap, so every client decoded from the same record, in any
+ * thread, may share it.
+ */
+struct ssh_scopes {
+	struct ssh_scope * scopes;
+	int                count;
+	struct hash        index;
+	int                refcount;
+};
 
 struct client {
 	char ** scopes;
@@ -30,9 +50,21 @@ struct client {
 	char *  id;
 	bool    public_client;
 	char *  parent_client;
+
+	// Built from 'fqdns' and 'id' or shared with an earlier decode
+	struct ssh_scopes * ssh_scopes;
 };
 
-struct client * client_init(json_t *);
+// 'ssh_scopes', if not NULL, was built from an earlier decode of the same
+// record and is shared rather than built again.
+struct client * client_init(json_t *, struct ssh_scopes * ssh_scopes);
 void client_fini(struct client *);
 
+struct ssh_scopes * ssh_scopes_hold(struct ssh_scopes *);
+void ssh_scopes_release(struct ssh_scopes *);
+
+// Does the space-delimited (RFC 7662) 'scopes' include one of the client's
+// ssh scopes?
+bool client_has_ssh_scope(const struct client *, const char * scopes);
+
 #endif /* _CLIENT_H_ */
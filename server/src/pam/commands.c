@@ -0,0 +1,734 @@
+/*
+ * System includes.
+ */
+#include <security/pam_appl.h>
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Local includes.
+ */
+#include "account_map.h"
+#include "globus_auth.h"
+#include "identities.h"
+#include "introspect.h"
+#include "commands.h"
+#include "strings.h"
+#include "client.h"
+#include "metrics.h"
+#include "config.h"
+#include "passwd.h"
+#include "policy.h"
+#include "logger.h"
+#include "base64.h"
+#include "probes.h"
+#include "timing.h"
+#include "json.h"
+#include "debug.h" // always last
+
+#ifdef WITH_SCITOKENS
+#include "scitokens_verify.h"
+#endif // WITH_SCITOKENS
+
+typedef int pam_status_t;
+
+/*******************************************************************************
+ * Internal (Private) Functions
+ ******************************************************************************/
+
+// The accounts in 'account_map' that exist locally, in the order they were
+// mapped
+static char **
+_build_account_array(const struct config      * config,
+                     const struct account_map * account_map)
+{
+	if (!account_map)
+		return NULL;
+
+	const char ** accts  = calloc(account_map->count, sizeof(char *));
+	bool        * exists = calloc(account_map->count, sizeof(bool));
+
+	int cnt = 0;
+	for (const struct mapped_account * a = account_map->accounts; a; a = a->next)
+		accts[cnt++] = a->acct;
+
+	passwd_lookup(config, accts, cnt, exists);
+
+	char ** account_array = calloc(cnt + 1, sizeof(char *));
+	for (int i = 0, j = 0; i < cnt; i++)
+	{
+		if (exists[i])
+			account_array[j++] = strdup(accts[i]);
+	}
+
+	free(accts);
+	free(exists);
+	return account_array;
+}
+
+static char *
+_build_json_list(const char * const * array)
+{
+	char * jlist = NULL;
+	for (int i = 0; array && array[i]; i++)
+	{
+		if (jlist)
+			append(&jlist, ", ");
+		append(&jlist, "\"");
+		append(&jlist, array[i]);
+		append(&jlist, "\"");
+	}
+	return jlist;
+}
+
+static char *
+_build_error_reply(const char * code, const char * description)
+{
+	return sformat("{"
+	                   "\"error\": {"
+	                       "\"code\": \"%s\","
+	                       "\"description\": \"%s\""
+	                   "}"
+	               "}",
+	               code,
+	               description);
+}
+
+bool
+_is_token_valid(const struct introspect * introspect,
+                const struct client     * client)
+{
+	if (introspect->active == false)
+		return false;
+
+	if (introspect->exp < time(NULL))
+		return false;
+
+	// This would indicate time skew on the local system
+	if (introspect->iat > time(NULL))
+		return false;
+
+	if (introspect->nbf > time(NULL))
+		return false;
+
+	if (!client_has_ssh_scope(client, introspect->scope))
+		return false;
+
+	return true;
+}
+
+static const struct identity_provider *
+_lookup_idp(const struct identities * identities, const char * idp_uuid)
+{
+	// Should never happen
+	if (!identities->included.identity_providers)
+		return NULL;
+
+	for (int i = 0; identities->included.identity_providers[i]; i++)
+	{
+		// Shortcut
+		const struct identity_provider * identity_provider = NULL;
+		identity_provider = identities->included.identity_providers[i];
+
+		// config specified an IdP UUID
+		if (strcmp(identity_provider->id, idp_uuid) == 0)
+			return identity_provider;
+	}
+
+	// Should never happen
+	return NULL;
+}
+
+static bool
+_check_session_policy(const struct config     * config,
+                      const struct introspect * introspect,
+                      const struct identities * identities)
+{
+	/*
+	 * Security Policy Enforcement
+	 */
+
+	if (!config->permitted_idps && !config->authentication_timeout && !config->mfa)
+		return true;
+
+	if (!introspect->session_info || !introspect->session_info->authentications)
+		return false;
+
+	for (int k = 0; introspect->session_info->authentications[k]; k++)
+	{
+		// Shortcut to the authentication structure
+		const struct authentication * authentication = NULL;
+		authentication = introspect->session_info->authentications[k];
+
+		if (config->authentication_timeout)
+		{
+			time_t seconds_since_auth = time(NULL) - authentication->auth_time;
+			if (seconds_since_auth > (60*config->authentication_timeout))
+				continue;
+		}
+
+		if (config->mfa)
+		{
+			if (!authentication->amr.mfa)
+			    continue;
+		}
+
+		// Recent authentication with no IdP requirement
+		if (!config->permitted_idps)
+			return true;
+
+		// Short cut to the idp used in this authentication
+		const struct identity_provider * authed_idp = NULL;
+		authed_idp = _lookup_idp(identities, authentication->idp);
+
+		// This should not happen
+		ASSERT(authed_idp);
+
+		if (authed_idp)
+		{
+			for (int i = 0; config->permitted_idps[i]; i++)
+			{
+				// Match by IdP UUID
+				if (strcmp(config->permitted_idps[i], authed_idp->id) == 0)
+					return true;
+
+				// Match by IdP domain
+				if (key_in_list(CONST(char *, authed_idp->domains),
+				                config->permitted_idps[i]))
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+static bool
+_is_session_valid(const struct config     * config,
+                  const struct introspect * introspect,
+                  const struct identities * identities)
+{
+	bool permitted = _check_session_policy(config, introspect, identities);
+	PROBE1(session__policy, permitted);
+	return permitted;
+}
+
+/*
+ * The introspect reply usually describes every linked identity, which saves
+ * us a round trip to the identities API. The IdP domains needed to match
+ * permitted_idps are only available from the identities API.
+ */
+static struct identities *
+_get_identities(const struct config * config, const struct introspect * introspect)
+{
+	struct identities * identities = NULL;
+
+	timing_start(TIMING_IDENTITIES);
+	if (!config->permitted_idps)
+		identities = identities_from_introspect(introspect);
+	if (!identities)
+		identities = get_identities_resource(config, introspect);
+	timing_stop(TIMING_IDENTITIES);
+
+	return identities;
+}
+
+/*
+ * The checks shared by every command that takes a Globus Auth token. Returns
+ * PAM_SUCCESS and sets '*account_map' if the token is valid; the map is NULL if
+ * no local account is mapped. Otherwise '*reply' holds the error, if any.
+ */
+static pam_status_t
+_validate_token(struct config       * config,
+                const char          * access_token,
+                struct account_map ** account_map,
+                char               ** reply)
+{
+	struct client     * client     = NULL;
+	struct introspect * introspect = NULL;
+	struct identities * identities = NULL;
+	pam_status_t        pam_status = PAM_AUTHINFO_UNAVAIL;
+
+	*account_map = NULL;
+
+	// Handle the case where the module is not configured for Globus authorization.
+	if (!config_auth_method(config, GLOBUS_AUTH))
+	{
+		logger(LOG_TYPE_INFO,
+		       "Globus Auth token received but this module is not configured for Globus authorization.");
+		goto cleanup;
+	}
+
+	timing_start(TIMING_RESOURCES);
+	get_login_resources(config, access_token, &introspect, &client);
+	timing_stop(TIMING_RESOURCES);
+	if (!introspect || !client)
+	{
+		*reply = _build_error_reply("UNEXPECTED_ERROR", "An unexpected error occurred.");
+		goto cleanup;
+	}
+
+	if (!_is_token_valid(introspect, client))
+	{
+		*reply = _build_error_reply("INVALID_TOKEN", "Invalid token.");
+		pam_status = PAM_AUTH_ERR;
+		goto cleanup;
+	}
+
+	identities = _get_identities(config, introspect);
+	if (!identities)
+	{
+		*reply = _build_error_reply("UNEXPECTED_ERROR", "An unexpected error occurred.");
+		goto cleanup;
+	}
+
+	if (!_is_session_valid(config, introspect, identities))
+	{
+		*reply = _build_error_reply("SESSION_VIOLATION", "The access token does not meet session requirements.");
+		pam_status = PAM_AUTH_ERR;
+		goto cleanup;
+	}
+
+	timing_start(TIMING_ACCOUNT_MAP);
+	*account_map = account_map_init(config, identities);
+	timing_stop(TIMING_ACCOUNT_MAP);
+
+	pam_status = PAM_SUCCESS;
+
+cleanup:
+	client_fini(client);
+	introspect_fini(introspect);
+	identities_fini(identities);
+	return pam_status;
+}
+
+// The reply was built and base64-encoded when the config was loaded
+static pam_status_t
+_cmd_get_security_policy(struct config * config,
+                         const char    * etag,
+                         char         ** reply)
+{
+	*reply = strdup(policy_reply(config->policy, etag));
+	return PAM_MAXTRIES;
+}
+
+static pam_status_t
+_cmd_get_account_map(struct config  * config,
+                     const char     * access_token,
+                     const char     * etag,
+                     char          ** reply)
+{
+	struct account_map * account_map = NULL;
+
+	*reply = NULL;
+
+	pam_status_t pam_status = _validate_token(config, access_token, &account_map, reply);
+	if (pam_status != PAM_SUCCESS)
+		goto cleanup;
+
+	char ** acct_array = _build_account_array(config, account_map);
+	char *  acct_list  = _build_json_list(CONST(char *,acct_array));
+	char * format = "\"account_map\": {"
+	                    "\"permitted_accounts\": [%s]"
+	                "}";
+
+	char * members = sformat(format, acct_list?acct_list:"");
+	*reply = policy_cacheable_reply(members, config->account_map_max_age, etag);
+
+	free_array(acct_array);
+	free(acct_list);
+	free(members);
+
+	pam_status = PAM_MAXTRIES;
+
+cleanup:
+	account_map_fini(account_map);
+	return pam_status;
+}
+
+/*
+ * Given an access token, determine if the string is _most_ _likely_ a SciToken
+ * as opposed to a Globus Auth token. Returns:
+ *   true - token is _probably_ a SciToken
+ *   false - token is not a SciToken
+ *
+ * This is a quick and dirty check; we could attempt to decode the JWT token as
+ * a JWT and return true on success, but this should be sufficient for telling
+ * Globus Auth tokens from SciTokens.
+ */
+static bool
+_is_likely_a_scitoken(const char * token)
+{
+	/*
+	 * SciTokens are JWTs, so they are base64 url encoded with '.' as
+	 * delmiters for each part. Globus Auth tokens use the base64 character
+	 * set (but not really base64-encoded because they are opaque). So here
+	 * we look for any character in the JWT character set that is outside of
+	 * the base64 url encode character set.
+	 */
+	return (strchr(token, '.') != NULL);
+}
+
+static pam_status_t
+_cmd_login_scitokens(struct config  * config,
+                     const char     * requested_user,
+                     const char     * access_token)
+{
+	pam_status_t   pam_status     = PAM_AUTHINFO_UNAVAIL;
+
+	// Handle the case where the module is not configured for SciTokens
+	if (!config_auth_method(config, SCITOKENS))
+	{
+		logger(LOG_TYPE_INFO,
+		       "SciToken received but this module is not configured for SciToken authorization.");
+		pam_status = PAM_AUTHINFO_UNAVAIL;
+		goto cleanup;
+	}
+
+#ifdef WITH_SCITOKENS
+	if(scitoken_verify(access_token, config, requested_user))
+	{
+		logger(LOG_TYPE_INFO,
+		       "Scitoken Identity %s authorizing as a local user",
+		       requested_user);
+		pam_status = PAM_SUCCESS;
+		goto cleanup;
+	}
+#endif //SCITOKENS
+
+	// SciTokens authorization has failed
+	pam_status = PAM_AUTH_ERR;
+
+cleanup:
+	return pam_status;
+}
+
+static pam_status_t
+_cmd_login_globus(struct config  * config,
+                  const char     * requested_user,
+                  const char     * access_token,
+                  char          ** reply)
+{
+	struct account_map * account_map = NULL;
+
+	*reply = NULL;
+
+	pam_status_t pam_status = _validate_token(config, access_token, &account_map, reply);
+	if (pam_status != PAM_SUCCESS)
+		goto cleanup;
+
+	bool permitted = is_acct_in_map(account_map, requested_user);
+	PROBE2(account__map, requested_user, permitted);
+
+	if (!permitted)
+	{
+		pam_status = PAM_AUTH_ERR;
+		*reply = _build_error_reply("INVALID_ACCOUNT", "You cannot use that local account.");
+		goto cleanup;
+	}
+
+	logger(LOG_TYPE_INFO,
+	       "Identity %s authorized as local user %s",
+	       acct_to_username(account_map, requested_user),
+	       requested_user);
+
+	pam_status = PAM_SUCCESS;
+
+cleanup:
+	account_map_fini(account_map);
+
+	return pam_status;
+}
+
+
+static pam_status_t
+_cmd_login(struct config  * config,
+           const char     * requested_user,
+           const char     * access_token,
+           char          ** reply)
+{
+	*reply = NULL;
+
+	/*
+	 * Try to route the access token to the correct auth mechanism. We do
+	 * not try all enabled auth methods for each token because the mechanism
+	 * response to an invalid token vs the mechanisms response to an unknown
+	 * token may not be differentiable. Also, that would be slower and make
+	 * logging and error reporting more complicated.
+	 */
+	if (_is_likely_a_scitoken(access_token))
+		return _cmd_login_scitokens(config, requested_user, access_token);
+	return _cmd_login_globus(config, requested_user, access_token, reply);
+}
+
+
+/*
+ * Pick the account the client should log in as: 'requested_user' if it is
+ * permitted, otherwise the first permitted account the client prefers,
+ * otherwise the only permitted account. Returns NULL if there is no clear
+ * choice.
+ */
+static const char *
+_resolve_account(const char * const * permitted,
+                 const char * const * preferred,
+                 const char         * requested_user)
+{
+	if (requested_user && key_in_list(permitted, requested_user))
+		return requested_user;
+
+	for (int i = 0; preferred && preferred[i]; i++)
+	{
+		if (key_in_list(permitted, preferred[i]))
+			return preferred[i];
+	}
+
+	if (permitted && permitted[0] && !permitted[1])
+		return permitted[0];
+	return NULL;
+}
+
+/*
+ * get_security_policy, get_account_map and login in one command so that the
+ * token is introspected once. Logs in as 'requested_user' if it is permitted.
+ * Otherwise the reply names the account to reconnect as, if there is one.
+ */
+static pam_status_t
+_cmd_resolve_and_login(struct config  * config,
+                       const char     * requested_user,
+                       const char     * access_token,
+                       char * const   * preferred_accounts,
+                       char          ** reply)
+{
+	struct account_map * account_map = NULL;
+	char              ** acct_array  = NULL;
+
+	*reply = NULL;
+
+	// SciTokens carry no account map; treat it as a plain login
+	if (_is_likely_a_scitoken(access_token))
+		return _cmd_login_scitokens(config, requested_user, access_token);
+
+	pam_status_t pam_status = _validate_token(config, access_token, &account_map, reply);
+	if (pam_status != PAM_SUCCESS)
+		goto cleanup;
+
+	acct_array = _build_account_array(config, account_map);
+
+	bool permitted = is_acct_in_map(account_map, requested_user);
+	PROBE2(account__map, requested_user, permitted);
+
+	const char * account = _resolve_account(CONST(char *, acct_array),
+	                                        CONST(char *, preferred_accounts),
+	                                        requested_user);
+
+	char * acct_list = _build_json_list(CONST(char *, acct_array));
+	char * format = "{"
+	                    "\"resolve_and_login\": {"
+	                        "\"policy\": %s,"
+	                        "\"permitted_accounts\": [%s],"
+	                        "\"account\": %s%s%s,"
+	                        "\"authorized\": %s,"
+	                        "\"max_age\": %d"
+	                    "}"
+	                "}";
+
+	*reply = sformat(format,
+	                 config->policy->json,
+	                 acct_list ? acct_list : "",
+	                 account ? "\"" : "",
+	                 account ? account : "null",
+	                 account ? "\"" : "",
+	                 permitted ? "true" : "false",
+	                 config->account_map_max_age);
+
+	free(acct_list);
+
+	if (!permitted)
+	{
+		pam_status = PAM_AUTH_ERR;
+		goto cleanup;
+	}
+
+	logger(LOG_TYPE_INFO,
+	       "Identity %s authorized as local user %s",
+	       acct_to_username(account_map, requested_user),
+	       requested_user);
+
+	pam_status = PAM_SUCCESS;
+
+cleanup:
+	free_array(acct_array);
+	account_map_fini(account_map);
+	return pam_status;
+}
+
+/*
+ * This is the 'cut-n-paste your access token' method
+ */
+static pam_status_t
+_cmd_login_fallback(struct config * config,
+                    const char    * requested_user,
+                    const char    * access_token)
+{
+	char * reply = NULL;
+	pam_status_t pam_status = _cmd_login(config, requested_user, access_token, &reply);
+	free(reply);
+	return pam_status;
+}
+
+// A decoded command, ie. {"command": {"op": "login", ...}, "version": 2}
+struct command {
+	char *  op;
+	char *  access_token;
+	char ** preferred_accounts; // resolve_and_login
+	char *  etag;               // get_security_policy, get_account_map
+	int     version;            // 0 if not a command
+};
+
+/*
+ * Breakdown the values given at our passphrase prompt.
+ */
+static void
+_decode_input(const char * user_input, struct command * command)
+{
+	char * decoded_input = NULL;
+	jobj_t * jobj = NULL;
+
+	memset(command, 0, sizeof(*command));
+
+	decoded_input = base64_decode(user_input);
+	if (!decoded_input)
+		goto cleanup;
+
+	jobj = jobj_init(decoded_input, NULL);
+	if (!jobj)
+		goto cleanup;
+
+	jobj_t * j_cmd = jobj_get_value(jobj, "command");
+	if (!j_cmd)
+		goto cleanup;
+
+	const char * tmp = jobj_get_string(j_cmd, "op");
+	if (tmp) command->op = strdup(tmp);
+
+	tmp = jobj_get_string(j_cmd, "access_token");
+	if (tmp) command->access_token = strdup(tmp);
+
+	if (jobj_key_exists(j_cmd, "preferred_accounts") &&
+	    jobj_get_type(j_cmd, "preferred_accounts") == json_type_array)
+	{
+		jarr_t * jarr = jobj_get_value(j_cmd, "preferred_accounts");
+		for (int i = 0; i < jarr_get_length(jarr); i++)
+		{
+			if (jarr_get_type(jarr, i) == json_type_string)
+				insert(&command->preferred_accounts, jarr_get_string(jarr, i));
+		}
+	}
+
+	if (jobj_key_exists(j_cmd, "etag") &&
+	    jobj_get_type(j_cmd, "etag") == json_type_string)
+		command->etag = strdup(jobj_get_string(j_cmd, "etag"));
+
+	// Clients that predate protocol version 2 may not send one
+	command->version = 1;
+	if (jobj_key_exists(jobj, "version") &&
+	    jobj_get_type(jobj, "version") == json_type_int)
+		command->version = jobj_get_int(jobj, "version");
+
+cleanup:
+	free(decoded_input);
+	jobj_fini(jobj);
+}
+
+static void
+_command_fini(struct command * command)
+{
+	free(command->op);
+	free(command->access_token);
+	free_array(command->preferred_accounts);
+	free(command->etag);
+}
+
+/*******************************************************************************
+ * Public Functions
+ ******************************************************************************/
+
+int
+process_command(struct config * config,
+                const char    * requested_user,
+                const char    * user_input,
+                char         ** reply,
+                int           * version)
+{
+	pam_status_t pam_status = PAM_AUTHINFO_UNAVAIL;
+
+	struct command command;
+	bool   encoded = false;
+	double start = timing_elapsed();
+
+	_decode_input(user_input, &command);
+	*version = command.version;
+	const char * op = command.op;
+	const char * access_token = command.access_token;
+
+	if (op)
+	{
+		logger(LOG_TYPE_DEBUG, "OP: %s", op);
+		timing_op(op);
+		PROBE1(command, op);
+
+		if (strcmp(op, "get_security_policy") == 0)
+		{
+			metrics_count(METRIC_OP_GET_SECURITY_POLICY);
+			pam_status = _cmd_get_security_policy(config, command.etag, reply);
+			encoded = true;
+		}
+		else if (strcmp(op, "get_account_map") == 0 && access_token)
+		{
+			metrics_count(METRIC_OP_GET_ACCOUNT_MAP);
+			pam_status = _cmd_get_account_map(config, access_token, command.etag, reply);
+		}
+		else if (strcmp(op, "login") == 0 && access_token)
+		{
+			metrics_count(METRIC_OP_LOGIN);
+			pam_status = _cmd_login(config, requested_user, access_token, reply);
+		}
+		else if (strcmp(op, "resolve_and_login") == 0 && access_token &&
+		         policy_is_capable(op, command.version))
+		{
+			metrics_count(METRIC_OP_RESOLVE_AND_LOGIN);
+			pam_status = _cmd_resolve_and_login(config,
+			                                    requested_user,
+			                                    access_token,
+			                                    command.preferred_accounts,
+			                                    reply);
+		} else
+		{
+			metrics_count(METRIC_OP_UNKNOWN);
+			*reply = _build_error_reply("UNKNOWN_COMMAND", "Unknown command.");
+		}
+
+		logger(LOG_TYPE_DEBUG, "REPLY: %s", *reply ? *reply : "NONE");
+
+		if (*reply && !encoded)
+		{
+			char * encoded_reply = base64_encode(*reply);
+			free(*reply);
+			*reply = encoded_reply;
+		}
+	}
+	else
+	{
+		timing_op("pasted_token");
+		PROBE1(command, "pasted_token");
+		metrics_count(METRIC_OP_PASTED_TOKEN);
+		pam_status = _cmd_login_fallback(config, requested_user, user_input);
+	}
+
+	metrics_observe(METRIC_COMMAND_SECONDS, timing_elapsed() - start);
+
+	_command_fini(&command);
+	return pam_status;
+}
@@ -0,0 +1,36 @@
+#ifndef _COMMANDS_H_
+#define _COMMANDS_H_
+
+/*
+ * Local includes.
+ */
+#include "config.h"
+
+/*
+ * The newest protocol version we speak. Clients send theirs with each command
+ * and learn ours, and the capabilities it brings, from get_security_policy.
+ */
+#define PROTOCOL_VERSION 2
+
+/*
+ * Carry out the request that the client entered at our prompt on behalf of
+ * local account 'requested_user'. Returns a PAM status and sets '*reply' to
+ * the base64-encoded reply for the client, if there is one.
+ *
+ * '*version' is set to the protocol version that the client sent with the
+ * command, 1 if it did not send one or 0 if 'user_input' is not a command (ie.
+ * a pasted token). From version 2 on, clients may send another command at our
+ * prompt after a reply to any command other than 'login'; see
+ * pam_sm_authenticate().
+ *
+ * Used by both the PAM module and oauth-ssh-helperd, so this must not depend
+ * on the PAM handle.
+ */
+int
+process_command(struct config * config,
+                const char    * requested_user,
+                const char    * user_input,
+                char         ** reply,
+                int           * version);
+
+#endif /* _COMMANDS_H_ */
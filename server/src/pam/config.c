@@ -1,9 +1,14 @@
 /*
  * System includes.
  */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <errno.h>
 #include <stdio.h>
 
 /*
@@ -12,20 +17,21 @@
 #include "strings.h"
 #include "config.h"
 #include "parser.h"
+#include "policy.h"
 #include "logger.h"
 #include "debug.h" // always last
 
 typedef enum { success, failure } status_t;
 
 status_t
-validate_single(const char * key, char ** values, bool already_set)
+validate_single(const char * path, const char * key, char ** values, bool already_set)
 {
     if (already_set == true)
     {
         logger(LOG_TYPE_ERROR,
                "Multiple occurrences of '%s' in %s",
                key,
-               CONFIG_DEFAULT_FILE);
+               path);
         return failure;
     }
 
@@ -34,7 +40,7 @@ validate_single(const char * key, char ** values, bool already_set)
         logger(LOG_TYPE_ERROR,
                "Missing value for '%s' in %s",
                key,
-               CONFIG_DEFAULT_FILE);
+               path);
         return failure;
     }
 
@@ -43,7 +49,7 @@ validate_single(const char * key, char ** values, bool already_set)
         logger(LOG_TYPE_ERROR,
                "Too many values for '%s' in %s",
                key,
-               CONFIG_DEFAULT_FILE);
+               path);
         return failure;
     }
 
@@ -77,14 +83,14 @@ merge_values(char ** current_values, char ** new_values)
 }
 
 static status_t
-check_is_set(const char * key, bool is_set)
+check_is_set(const char * path, const char * key, bool is_set)
 {
     if (!is_set)
     {
         logger(LOG_TYPE_ERROR,
                "Directive '%s' is missing from %s",
                key,
-               CONFIG_DEFAULT_FILE);
+               path);
         return failure;
     }
     return success;
@@ -100,25 +106,63 @@ convert_bool(const char * value)
     return -1;
 }
 
+/*
+ * Convert 'value' to an integer within [min, max]. Unlike atol(), garbage and
+ * out-of-range values are rejected rather than silently becoming 0.
+ */
+static status_t
+convert_number(const char * path,
+               const char * key,
+               const char * value,
+               long         min,
+               long         max,
+               long       * number)
+{
+    char * end = NULL;
+
+    errno = 0;
+    *number = strtol(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || *number < min || *number > max)
+    {
+        logger(LOG_TYPE_ERROR,
+               "Illegal value '%s' for %s configuration option in %s",
+               value,
+               key,
+               path);
+        return failure;
+    }
+    return success;
+}
+
 static status_t
 parse_file(struct config * config)
 {
-    FILE * fptr = fopen(CONFIG_DEFAULT_FILE, "r");
+    const char * path = config->config_file;
+
+    FILE * fptr = fopen(path, "r");
     if (!fptr)
     {
-        logger(LOG_TYPE_ERROR, "Could not open %s: %m", CONFIG_DEFAULT_FILE);
+        logger(LOG_TYPE_ERROR, "Could not open %s: %m", path);
         return failure;
     }
 
-    char * key;
-    char ** values;
+    char * key = NULL;
+    char ** values = NULL;
 
     bool client_secret_set = false;
     bool idp_suffix_set = false;
     bool client_id_set = false;
     bool timeout_set = false;
     bool mfa_set = false;
-
+    bool introspect_cache_ttl_set = false;
+    bool client_cache_ttl_set = false;
+    bool max_response_size_set = false;
+    bool passwd_cache_ttl_set = false;
+    bool passwd_lookup_threads_set = false;
+    bool policy_max_age_set = false;
+    bool account_map_max_age_set = false;
+
+    long number = 0;
     status_t status = failure;
     while (read_next_pair(fptr, &key, &values))
     {
@@ -135,7 +179,7 @@ parse_file(struct config * config)
         //////
         if (strcmp(key, "client_id") == 0)
         {
-            status = validate_single(key, values, client_id_set);
+            status = validate_single(path, key, values, client_id_set);
             if (status != success)
                 goto cleanup;
 
@@ -145,7 +189,7 @@ parse_file(struct config * config)
         else
         if (strcmp(key, "client_secret") == 0)
         {
-            status = validate_single(key, values, client_secret_set);
+            status = validate_single(path, key, values, client_secret_set);
             if (status != success)
                 goto cleanup;
 
@@ -155,7 +199,7 @@ parse_file(struct config * config)
         else
         if (strcmp(key, "idp_suffix") == 0)
         {
-            status = validate_single(key, values, idp_suffix_set);
+            status = validate_single(path, key, values, idp_suffix_set);
             if (status != success)
                 goto cleanup;
 
@@ -180,7 +224,7 @@ parse_file(struct config * config)
         else
         if (strcmp(key, "authentication_timeout") == 0)
         {
-            status = validate_single(key, values, timeout_set);
+            status = validate_single(path, key, values, timeout_set);
             if (status != success)
                 goto cleanup;
 
@@ -190,7 +234,7 @@ parse_file(struct config * config)
         else
         if (strcmp(key, "mfa") == 0)
         {
-            status = validate_single(key, values, mfa_set);
+            status = validate_single(path, key, values, mfa_set);
             if (status != success)
                 goto cleanup;
 
@@ -200,13 +244,111 @@ parse_file(struct config * config)
                 logger(LOG_TYPE_ERROR,
                        "Illegal value '%s' for mfa configuration option",
                        values[0],
-                       CONFIG_DEFAULT_FILE);
+                       path);
                 goto cleanup;
             }
 
             mfa_set = true;
         }
         else
+        if (strcmp(key, "introspect_cache_ttl") == 0)
+        {
+            status = validate_single(path, key, values, introspect_cache_ttl_set);
+            if (status != success)
+                goto cleanup;
+
+            status = convert_number(path, key, values[0], 0, INT_MAX, &number);
+            if (status != success)
+                goto cleanup;
+
+            config->introspect_cache_ttl = number;
+            introspect_cache_ttl_set = true;
+        }
+        else
+        if (strcmp(key, "client_cache_ttl") == 0)
+        {
+            status = validate_single(path, key, values, client_cache_ttl_set);
+            if (status != success)
+                goto cleanup;
+
+            status = convert_number(path, key, values[0], 0, INT_MAX, &number);
+            if (status != success)
+                goto cleanup;
+
+            config->client_cache_ttl = number;
+            client_cache_ttl_set = true;
+        }
+        else
+        if (strcmp(key, "max_response_size") == 0)
+        {
+            status = validate_single(path, key, values, max_response_size_set);
+            if (status != success)
+                goto cleanup;
+
+            status = convert_number(path, key, values[0], 0, LONG_MAX, &number);
+            if (status != success)
+                goto cleanup;
+
+            config->max_response_size = number;
+            max_response_size_set = true;
+        }
+        else
+        if (strcmp(key, "passwd_cache_ttl") == 0)
+        {
+            status = validate_single(path, key, values, passwd_cache_ttl_set);
+            if (status != success)
+                goto cleanup;
+
+            status = convert_number(path, key, values[0], 0, INT_MAX, &number);
+            if (status != success)
+                goto cleanup;
+
+            config->passwd_cache_ttl = number;
+            passwd_cache_ttl_set = true;
+        }
+        else
+        if (strcmp(key, "passwd_lookup_threads") == 0)
+        {
+            status = validate_single(path, key, values, passwd_lookup_threads_set);
+            if (status != success)
+                goto cleanup;
+
+            status = convert_number(path, key, values[0], 1, INT_MAX, &number);
+            if (status != success)
+                goto cleanup;
+
+            config->passwd_lookup_threads = number;
+            passwd_lookup_threads_set = true;
+        }
+        else
+        if (strcmp(key, "policy_max_age") == 0)
+        {
+            status = validate_single(path, key, values, policy_max_age_set);
+            if (status != success)
+                goto cleanup;
+
+            status = convert_number(path, key, values[0], 0, INT_MAX, &number);
+            if (status != success)
+                goto cleanup;
+
+            config->policy_max_age = number;
+            policy_max_age_set = true;
+        }
+        else
+        if (strcmp(key, "account_map_max_age") == 0)
+        {
+            status = validate_single(path, key, values, account_map_max_age_set);
+            if (status != success)
+                goto cleanup;
+
+            status = convert_number(path, key, values[0], 0, INT_MAX, &number);
+            if (status != success)
+                goto cleanup;
+
+            config->account_map_max_age = number;
+            account_map_max_age_set = true;
+        }
+        else
         //////
         // SciTokens Section
         //////
@@ -221,16 +363,33 @@ parse_file(struct config * config)
             logger(LOG_TYPE_ERROR,
                    "Unknown directive '%s' in %s",
                    key,
-                   CONFIG_DEFAULT_FILE);
+                   path);
             status = failure;
             goto cleanup;
 
         }
+
+        free(key);
+        free_array(values);
+        key = NULL;
+        values = NULL;
     }
 
+    if (!max_response_size_set)
+        config->max_response_size = CONFIG_DEFAULT_MAX_RESPONSE_SIZE;
+
+    if (!passwd_lookup_threads_set)
+        config->passwd_lookup_threads = CONFIG_DEFAULT_PASSWD_LOOKUP_THREADS;
+
+    if (!policy_max_age_set)
+        config->policy_max_age = CONFIG_DEFAULT_POLICY_MAX_AGE;
+
+    if (!account_map_max_age_set)
+        config->account_map_max_age = CONFIG_DEFAULT_ACCOUNT_MAP_MAX_AGE;
+
     if (!config->auth_method)
     {
-        logger(LOG_TYPE_ERROR, "Missing value for auth_method in %s", CONFIG_DEFAULT_FILE);
+        logger(LOG_TYPE_ERROR, "Missing value for auth_method in %s", path);
         status = failure;
         goto cleanup;
     }
@@ -254,23 +413,23 @@ parse_file(struct config * config)
         logger(LOG_TYPE_ERROR,
                "Invalid value '%s' for auth_method in %s",
                config->auth_method[i],
-               CONFIG_DEFAULT_FILE);
+               path);
         status = failure;
         goto cleanup;
     }
 
     if (config_auth_method(config, GLOBUS_AUTH))
     {
-        if ((status = check_is_set("client_id", client_id_set)) == failure)
+        if ((status = check_is_set(path, "client_id", client_id_set)) == failure)
             goto cleanup;
-        if ((status = check_is_set("client_secret", client_secret_set)) == failure)
+        if ((status = check_is_set(path, "client_secret", client_secret_set)) == failure)
             goto cleanup;
 
         if (!config->idp_suffix && !config->map_files)
         {
             logger(LOG_TYPE_ERROR,
                 "At least one of 'idp_suffix' or 'map_file' must be defined in %s",
-                 CONFIG_DEFAULT_FILE);
+                 path);
             status = failure;
             goto cleanup;
         }
@@ -278,6 +437,8 @@ parse_file(struct config * config)
 
     status = success;
 cleanup:
+    free(key);
+    free_array(values);
     fclose(fptr);
     return status;
 }
@@ -294,30 +455,79 @@ parse_args(struct config * c, int flags, int argc, const char ** argv)
             if (!c->environment) // skip duplicates
                 c->environment = strdup(argv[i]+12);
         }
+        else if (strncmp("config_file=", argv[i], 12) == 0)
+        {
+            if (!c->config_file) // skip duplicates
+                c->config_file = strdup(argv[i]+12);
+        }
+        else if (strncmp("auth_host=", argv[i], 10) == 0)
+        {
+            if (!c->auth_host) // skip duplicates
+                c->auth_host = strdup(argv[i]+10);
+        }
+        else if (strncmp("cafile=", argv[i], 7) == 0)
+        {
+            if (!c->cafile) // skip duplicates
+                c->cafile = strdup(argv[i]+7);
+        }
     }
+
+    if (!c->config_file)
+        c->config_file = strdup(CONFIG_DEFAULT_FILE);
     return success;
 }
 
-struct config *
-config_init(int flags, int argc, const char ** argv)
-{
-    struct config * config = calloc(1, sizeof(*config));
+/*
+ * The parsed config is shared by every config_init() caller in this process
+ * so that long-lived PAM hosts do not reparse the file on each authentication.
+ * A stat() of the file on each call detects edits; a changed file is parsed
+ * into a new config and older configs are freed once their last user calls
+ * config_fini().
+ */
+static pthread_mutex_t config_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct config * config_cache = NULL;
+static struct stat     config_cache_st;
 
-    if (parse_file(config) == failure)
-        goto cleanup;
+static bool
+file_changed(const struct stat * old_st, const struct stat * new_st)
+{
+    return old_st->st_dev          != new_st->st_dev ||
+           old_st->st_ino          != new_st->st_ino ||
+           old_st->st_size         != new_st->st_size ||
+           old_st->st_mtim.tv_sec  != new_st->st_mtim.tv_sec ||
+           old_st->st_mtim.tv_nsec != new_st->st_mtim.tv_nsec;
+}
 
-    if (parse_args(config, flags, argc, argv) == failure)
-        goto cleanup;
+static bool
+string_match(const char * a, const char * b)
+{
+    if (!a || !b)
+        return a == b;
+    return strcmp(a, b) == 0;
+}
 
-    return config;
+// PAM arguments may differ between services loading the module
+static bool
+args_match(const struct config * config, const struct config * args)
+{
+    return config->debug == args->debug &&
+           string_match(config->config_file, args->config_file) &&
+           string_match(config->environment, args->environment) &&
+           string_match(config->auth_host, args->auth_host) &&
+           string_match(config->cafile, args->cafile);
+}
 
-cleanup:
-    config_fini(config);
-    return NULL;
+static void
+free_args(struct config * args)
+{
+    free(args->config_file);
+    free(args->environment);
+    free(args->auth_host);
+    free(args->cafile);
 }
 
-void
-config_fini(struct config * config)
+static void
+free_config(struct config * config)
 {
     if (config)
     {
@@ -326,13 +536,94 @@ config_fini(struct config * config)
         free(config->idp_suffix);
         free_array(config->map_files);
         free_array(config->permitted_idps);
-        free(config->environment);
+        free_args(config);
         free_array(config->issuers);
         free_array(config->auth_method);
+        policy_fini(config->policy);
     }
     free(config);
 }
 
+// Caller must hold config_mutex
+static void
+release_config(struct config * config)
+{
+    if (config && --config->refcount == 0)
+        free_config(config);
+}
+
+struct config *
+config_init(int flags, int argc, const char ** argv)
+{
+    struct config args = {0};
+    struct config * config = NULL;
+    struct stat st;
+
+    if (parse_args(&args, flags, argc, argv) == failure)
+        goto cleanup;
+
+    // If we can't stat the file, let parse_file() report why
+    bool have_st = (stat(args.config_file, &st) == 0);
+
+    pthread_mutex_lock(&config_mutex);
+    if (have_st &&
+        config_cache &&
+        !file_changed(&config_cache_st, &st) &&
+        args_match(config_cache, &args))
+    {
+        config = config_cache;
+        config->refcount++;
+    }
+    pthread_mutex_unlock(&config_mutex);
+
+    if (config)
+        goto cleanup;
+
+    // The config takes ownership of the arguments
+    config = calloc(1, sizeof(*config));
+    *config = args;
+    memset(&args, 0, sizeof(args));
+    config->refcount = 1;
+
+    if (parse_file(config) == failure)
+    {
+        free_config(config);
+        config = NULL;
+        goto cleanup;
+    }
+
+    config->policy = policy_init(config);
+    if (!config->policy)
+    {
+        logger(LOG_TYPE_ERROR, "Could not build the security policy reply");
+        free_config(config);
+        config = NULL;
+        goto cleanup;
+    }
+
+    if (have_st)
+    {
+        pthread_mutex_lock(&config_mutex);
+        release_config(config_cache);
+        config_cache = config;
+        config_cache_st = st;
+        config->refcount++;
+        pthread_mutex_unlock(&config_mutex);
+    }
+
+cleanup:
+    free_args(&args);
+    return config;
+}
+
+void
+config_fini(struct config * config)
+{
+    pthread_mutex_lock(&config_mutex);
+    release_config(config);
+    pthread_mutex_unlock(&config_mutex);
+}
+
 // return true if the module is configured for the auth method,
 // false otherwise
 bool
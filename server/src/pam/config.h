@@ -5,8 +5,15 @@
  * System includes.
  */
 #include <stdbool.h>
+#include <stddef.h>
 
 #define CONFIG_DEFAULT_FILE "/etc/oauth_ssh/oauth-ssh.conf"
+#define CONFIG_DEFAULT_MAX_RESPONSE_SIZE (1024*1024)
+#define CONFIG_DEFAULT_PASSWD_LOOKUP_THREADS 1
+#define CONFIG_DEFAULT_POLICY_MAX_AGE (60*60)
+#define CONFIG_DEFAULT_ACCOUNT_MAP_MAX_AGE (5*60)
+
+struct policy;
 
 typedef enum {
 	GLOBUS_AUTH,
@@ -23,10 +30,15 @@ struct config {
 	// Hidden option in PAM config file. Increases logging output.
 	bool    debug;
 
+	// Hidden option in PAM config file. Defaults to CONFIG_DEFAULT_FILE.
+	char *  config_file;
+
 	//////
 	// Globus Auth Section
 	//////
 	char *  environment; // Hidden option in PAM config file
+	char *  auth_host;   // Hidden option in PAM config file, overrides environment
+	char *  cafile;      // Hidden option in PAM config file
 	char *  client_id;
 	char *  client_secret;
 	char *  idp_suffix;
@@ -37,12 +49,30 @@ struct config {
 	int     authentication_timeout;
 	bool    mfa;
 
+	// Performance tuning
+	int     introspect_cache_ttl; // seconds, 0 disables
+	int     client_cache_ttl;     // seconds, 0 disables
+	size_t  max_response_size;    // bytes, 0 disables
+	int     passwd_cache_ttl;     // seconds, 0 disables
+	int     passwd_lookup_threads;
+	int     policy_max_age;      // seconds clients may reuse the policy
+	int     account_map_max_age; // seconds clients may reuse their account map
+
 	//////
 	// SciTokens Section
 	//////
 	char ** issuers;
+
+	// The reply to get_security_policy, built once per load. See policy.h.
+	struct policy * policy;
+
+	// Number of config_init() callers sharing this config. See config.c.
+	int     refcount;
 };
 
+// Returns a config that may be shared with other callers in this process; it
+// must be treated as read-only and released with config_fini(). The config
+// file is only reparsed once it has changed on disk.
 struct config * config_init(int flags, int argc, const char ** argv);
 void config_fini(struct config *);
 
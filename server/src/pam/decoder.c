@@ -0,0 +1,212 @@
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Local includes.
+ */
+#include "decoder.h"
+#include "arena.h"
+#include "logger.h"
+#include "json.h"
+#include "debug.h" // always last
+
+/*******************************************************************************
+ * Internal (Private) Functions
+ ******************************************************************************/
+
+static int
+_compare_key(const void * key, const void * field)
+{
+	return strcmp(key, ((const struct decode_field *)field)->key);
+}
+
+#ifdef DEBUG
+// decode_object() uses bsearch()
+static bool
+_is_sorted(const struct decoder * decoder)
+{
+	for (int i = 1; i < decoder->count; i++)
+	{
+		if (strcmp(decoder->fields[i-1].key, decoder->fields[i].key) >= 0)
+			return false;
+	}
+	return true;
+}
+#endif /* DEBUG */
+
+static bool
+_decode_value(const struct decoder      * decoder,
+              const struct decode_field * field,
+              json_t                    * value,
+              void                      * record)
+{
+	void * member = (char *)record + field->offset;
+
+	if (json_object_get_type(value) != field->type)
+	{
+		// Special case were optional keys have value 'null'
+		if (field->presence == DECODE_OPTIONAL && !value)
+			return true;
+
+		logger(LOG_TYPE_ERROR,
+		       "%s has wrong type for required key '%s'",
+		       decoder->what,
+		       field->key);
+		return false;
+	}
+
+	switch (field->type)
+	{
+	case json_type_int:
+		// ie. time_t
+		if (field->size == sizeof(int64_t))
+			*(int64_t *)member = json_object_get_int64(value);
+		else
+			*(int *)member = json_object_get_int(value);
+		break;
+	case json_type_string:
+		*(char **)member = arena_strdup(json_object_get_string(value));
+		break;
+	case json_type_boolean:
+		*(bool *)member = json_object_get_boolean(value);
+		break;
+
+	case json_type_array:
+	case json_type_object:
+		return field->func(value, field, member);
+
+	case json_type_double:
+	case json_type_null:
+		ASSERT(0);
+		return false;
+	}
+	return true;
+}
+
+static bool
+_check_required(const struct decoder * decoder,
+                uint64_t               seen,
+                const void           * record)
+{
+	bool gated = false;
+
+	for (int i = 0; i < decoder->count; i++)
+	{
+		const struct decode_field * field = &decoder->fields[i];
+		if (field->presence != DECODE_GATE)
+			continue;
+
+		if (!(seen & (1ull << i)))
+		{
+			logger(LOG_TYPE_ERROR,
+			       "%s is missing required key '%s'",
+			       decoder->what,
+			       field->key);
+			return false;
+		}
+
+		if (!*(const bool *)((const char *)record + field->offset))
+			gated = true;
+	}
+
+	if (gated)
+		return true;
+
+	for (int i = 0; i < decoder->count; i++)
+	{
+		const struct decode_field * field = &decoder->fields[i];
+		if (field->presence != DECODE_REQUIRED || (seen & (1ull << i)))
+			continue;
+
+		logger(LOG_TYPE_ERROR,
+		       "%s is missing required key '%s'",
+		       decoder->what,
+		       field->key);
+		return false;
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Public Functions
+ ******************************************************************************/
+
+bool
+decode_object(jobj_t * jobj, const struct decoder * decoder, void * record)
+{
+	ASSERT(json_object_get_type(jobj) == json_type_object);
+	ASSERT(decoder->count <= 64);
+	ASSERT(_is_sorted(decoder));
+
+	uint64_t seen = 0;
+
+	json_object_object_foreach(jobj, key, value)
+	{
+		const struct decode_field * field = bsearch(key,
+		                                            decoder->fields,
+		                                            decoder->count,
+		                                            sizeof(*decoder->fields),
+		                                            _compare_key);
+		if (!field)
+			continue;
+
+		if (!_decode_value(decoder, field, value, record))
+			return false;
+
+		seen |= 1ull << (field - decoder->fields);
+	}
+
+	return _check_required(decoder, seen, record);
+}
+
+bool
+decode_strings(json_t * jarr, const struct decode_field * field, void * member)
+{
+	int length = jarr_get_length(jarr);
+	char ** strings = arena_calloc(length+1, sizeof(char *));
+	*(char ***)member = strings;
+
+	for (int k = 0; k < length; k++)
+	{
+		if (jarr_get_type(jarr, k) != json_type_string)
+		{
+			logger(LOG_TYPE_ERROR, "'%s' is malformed", field->key);
+			return false;
+		}
+		strings[k] = arena_strdup(jarr_get_string(jarr, k));
+	}
+	return true;
+}
+
+bool
+decode_record(json_t * jobj, const struct decode_field * field, void * member)
+{
+	return decode_object(jobj, field->decoder, member);
+}
+
+bool
+decode_records(json_t * jarr, const struct decode_field * field, void * member)
+{
+	int length = jarr_get_length(jarr);
+	void ** records = arena_calloc(length+1, sizeof(void *));
+	*(void ***)member = records;
+
+	for (int k = 0; k < length; k++)
+	{
+		if (jarr_get_type(jarr, k) != json_type_object)
+		{
+			logger(LOG_TYPE_ERROR, "'%s' is malformed", field->key);
+			return false;
+		}
+
+		records[k] = arena_calloc(1, field->decoder->size);
+		if (!decode_object(jarr_get_index(jarr, k), field->decoder, records[k]))
+			return false;
+	}
+	return true;
+}
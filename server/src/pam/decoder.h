@@ -0,0 +1,101 @@
+#ifndef _DECODER_H_
+#define _DECODER_H_
+
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Local includes.
+ */
+#include "json.h"
+
+/*
+ * Table-driven conversion of Globus Auth records into structs. Each struct
+ * declares its fields once in a 'struct decoder' and decode_object() fills
+ * it in a single pass over the JSON object's keys. Keys without a matching
+ * field are ignored.
+ *
+ * Optional fields may be missing or 'null'; both leave the member 0/NULL.
+ * Required fields must be present with the declared type. The first problem
+ * found is logged and decoding stops; whatever was decoded up to that point
+ * remains in the struct for its _fini() routine to release.
+ */
+
+typedef enum {
+	DECODE_OPTIONAL,
+	DECODE_REQUIRED,
+	// A required boolean. When false, no other field is required; ie.
+	// an inactive token carries no other fields.
+	DECODE_GATE,
+} decode_presence_t;
+
+struct decode_field;
+
+// Converts arrays and objects. 'member' points into the struct being filled.
+typedef bool (*decode_func_t)(json_t                    * value,
+                              const struct decode_field * field,
+                              void                      * member);
+
+struct decoder {
+	const char                * what;   // ie. "Introspect record", for logging
+	size_t                      size;   // of the struct, for decode_records()
+	const struct decode_field * fields; // sorted by key
+	int                         count;
+};
+
+struct decode_field {
+	const char           * key;
+	json_type              type;
+	decode_presence_t      presence;
+	size_t                 offset; // of the member within the struct
+	size_t                 size;   // of the member
+	decode_func_t          func;   // arrays and objects only
+	const struct decoder * decoder; // for decode_record(s)
+};
+
+/*
+ * Field declarations, ie.
+ *
+ *   static const struct decode_field fields[] = {
+ *       DECODE_VALUE(struct identity, id, string, DECODE_REQUIRED),
+ *       DECODE_CONTAINER(struct identity, domains, array, DECODE_REQUIRED, decode_strings, NULL),
+ *   };
+ *
+ * 'type' is the json_type without its prefix.
+ */
+#define DECODE_VALUE(record, member, type, presence) \
+	{#member, json_type_##type, presence, offsetof(record, member), \
+	 sizeof(((record *)0)->member), NULL, NULL}
+
+#define DECODE_CONTAINER(record, member, type, presence, func, decoder) \
+	{#member, json_type_##type, presence, offsetof(record, member), \
+	 sizeof(((record *)0)->member), func, decoder}
+
+#define DECODER(record, what, fields) \
+	{what, sizeof(record), fields, sizeof(fields)/sizeof(*fields)}
+
+// Returns true if 'jobj' satisfies 'decoder'.
+bool
+decode_object(jobj_t * jobj, const struct decoder * decoder, void * record);
+
+/*
+ * Container conversions for use as a field's 'func'.
+ */
+
+// Array of strings into a NULL-terminated char **.
+bool
+decode_strings(json_t * jarr, const struct decode_field * field, void * member);
+
+// Object into an embedded struct described by field->decoder.
+bool
+decode_record(json_t * jobj, const struct decode_field * field, void * member);
+
+// Array of objects into a NULL-terminated array of pointers to structs
+// described by field->decoder.
+bool
+decode_records(json_t * jarr, const struct decode_field * field, void * member);
+
+#endif /* _DECODER_H_ */
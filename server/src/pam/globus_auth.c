@@ -1,13 +1,21 @@
 /*
  * System includes.
  */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
 
 /*
  * Local includes.
  */
 #include "globus_auth.h"
+#include "metrics.h"
 #include "strings.h"
+#include "cache.h"
 #include "logger.h"
 #include "http.h"
 #include "json.h"
@@ -17,6 +25,9 @@
 const char *
 globus_auth_host(const struct config * config)
 {
+	if (config->auth_host)
+		return config->auth_host;
+
 	if (config->environment)
 	{
 		if (strcasecmp(config->environment, "preview") == 0)
@@ -37,26 +48,69 @@ globus_auth_host(const struct config * config)
 	return "auth.globus.org";
 }
 
-struct introspect *
-get_introspect_resource(const struct config * config, const char * token)
+static char *
+_introspect_url(const struct config * config)
 {
-	char * reply_body = NULL;
-	char * error_msg  = NULL;
-	json_t * json = NULL;
-	struct introspect * introspect = NULL;
+	return sformat("https://%s/v2/oauth2/token/introspect",
+	               globus_auth_host(config));
+}
 
-	// construct request url
-	const char * host = globus_auth_host(config);
-	char * request_url = sformat("https://%s/v2/oauth2/token/introspect", host);
+/*
+ * identity_set_detail replaces the identities API call unless permitted_idps
+ * is set (see _get_identities() in commands.c); otherwise it only makes the
+ * reply, and its copy in the cache, larger.
+ */
+static char *
+_introspect_body(const struct config * config, const char * token)
+{
+	return sformat("token=%s&include=identities_set,session_info%s",
+	               token,
+	               config->permitted_idps ? "" : ",identity_set_detail");
+}
 
-	// construct request body
-	const char * body_format = "token=%s&include=identities_set,session_info";
-	char * request_body = sformat(body_format, token);
+/*
+ * Concurrent logins often present the same token. Only one of them fetches
+ * each resource from Globus Auth; the others wait for its reply in the cache
+ * (see cache_get_or_claim()). The fetching login must always finish with
+ * _share_reply() so that the waiters are released.
+ */
+static void
+_share_reply(const char * ns,
+             const char * key,
+             const char * reply_body,
+             bool         valid,
+             time_t       expires)
+{
+	if (valid)
+		cache_put(ns, key, reply_body, expires);
+	else
+		cache_unclaim(ns, key);
+}
 
-	if (http_post_request(config, request_url, request_body, &reply_body))
-		goto cleanup;
+/*
+ * Replies fetched from Globus Auth were parsed by 'parser' as they arrived.
+ * Replies from the cache have no parser and are parsed here. Releases
+ * 'parser'.
+ */
+static json_t *
+_reply_json(const char * reply_body, struct jparser * parser, char ** error_msg)
+{
+	if (parser || !reply_body)
+		return jparser_fini(parser, reply_body, error_msg);
+	return jobj_init(reply_body, error_msg);
+}
+
+/*
+ * Convert an introspect reply into a struct introspect.
+ */
+static struct introspect *
+_parse_introspect_reply(const char * reply_body, struct jparser * parser)
+{
+	char * error_msg  = NULL;
+	json_t * json = NULL;
+	struct introspect * introspect = NULL;
 
-	if ((json = jobj_init(reply_body, &error_msg)))
+	if ((json = _reply_json(reply_body, parser, &error_msg)))
 	{
 		if (!jobj_key_exists(json, "errors"))
 			introspect = introspect_init(json);
@@ -91,11 +145,78 @@ get_introspect_resource(const struct config * config, const char * token)
 	}
 
 cleanup:
+	free(error_msg);
+	jobj_fini(json);
+	return introspect;
+}
+
+// Another sshd child may have recently introspected this token, or may be
+// doing so now. Replies cached before introspect_cache_ttl was set to 0 are
+// ignored; only a reply fetched for us by a concurrent login is used.
+static char *
+_cached_introspect_reply(const struct config * config,
+                         const char          * token,
+                         bool                * claimed)
+{
+	char * reply_body = cache_get_or_claim("introspect",
+	                                       token,
+	                                       config->introspect_cache_ttl > 0,
+	                                       claimed);
+	metrics_count(reply_body ? METRIC_CACHE_INTROSPECT_HIT : METRIC_CACHE_INTROSPECT_MISS);
+	return reply_body;
+}
+
+// Waiters always receive our reply. Later logins reuse it until the token
+// expires or the configured TTL passes, whichever comes first.
+static void
+_share_introspect_reply(const struct config     * config,
+                        const char              * token,
+                        const char              * reply_body,
+                        const struct introspect * introspect)
+{
+	time_t expires = time(NULL);
+	if (introspect && introspect->active && config->introspect_cache_ttl > 0)
+	{
+		expires += config->introspect_cache_ttl;
+		if (introspect->exp < expires)
+			expires = introspect->exp;
+	}
+	_share_reply("introspect", token, reply_body, introspect != NULL, expires);
+}
+
+struct introspect *
+get_introspect_resource(const struct config * config, const char * token)
+{
+	struct introspect * introspect = NULL;
+	char * request_url  = NULL;
+	char * request_body = NULL;
+	bool   claimed      = false;
+
+	struct jparser * parser = NULL;
+	char * reply_body = _cached_introspect_reply(config, token, &claimed);
+
+	if (!reply_body)
+	{
+		request_url  = _introspect_url(config);
+		request_body = _introspect_body(config, token);
+		parser       = jparser_init();
+
+		if (http_post_request(config, request_url, request_body, &reply_body, parser))
+		{
+			jobj_fini(jparser_fini(parser, NULL, NULL));
+			goto cleanup;
+		}
+	}
+
+	introspect = _parse_introspect_reply(reply_body, parser);
+
+cleanup:
+	if (claimed)
+		_share_introspect_reply(config, token, reply_body, introspect);
+
 	free(request_body);
 	free(request_url);
 	free(reply_body);
-	free(error_msg);
-	jobj_fini(json);
 	return introspect;
 }
 
@@ -113,28 +234,27 @@ build_id_list(const struct introspect * introspect)
 	return list;
 }
 
-struct client *
-get_client_resource(const struct config * config)
+static char *
+_client_url(const struct config * config)
+{
+	return sformat("https://%s/v2/api/clients/%s",
+	               globus_auth_host(config),
+	               config->client_id);
+}
+
+static struct client *
+_parse_client_reply(const char        * reply_body,
+                    struct jparser    * parser,
+                    struct ssh_scopes * ssh_scopes)
 {
-	char * reply_body = NULL;
 	char * error_msg  = NULL;
 	json_t * json = NULL;
 	struct client * client = NULL;
 
-	// construct request url
-	const char * host = globus_auth_host(config);
-	char * request_url = sformat(
-	           "https://%s/v2/api/clients/%s",
-	           host,
-	           config->client_id);
-
-	if (http_get_request(config, request_url, &reply_body))
-		goto cleanup;
-
-	if ((json = jobj_init(reply_body, &error_msg)))
+	if ((json = _reply_json(reply_body, parser, &error_msg)))
 	{
 		if (!jobj_key_exists(json, "errors"))
-			client = client_init(json);
+			client = client_init(json, ssh_scopes);
 	}
 
 	if (!client)
@@ -142,17 +262,260 @@ get_client_resource(const struct config * config)
 		logger(LOG_TYPE_ERROR,
 		       "An error occurred while talking with Globus Auth%s",
 		       reply_body);
+	}
+
+	free(error_msg);
+	jobj_fini(json);
+	return client;
+}
+
+/*
+ * Client records change rarely, so they may be kept on disk for
+ * client_cache_ttl seconds. Past that point, logins continue to use the stale
+ * record while one login at a time, holding the record's lock, fetches a new
+ * one in-process.
+ */
+static char *
+_client_cache_name(const struct config * config)
+{
+	return sformat("client-%s.json", config->client_id);
+}
+
+static void
+_save_client_reply(const struct config * config, const char * reply_body)
+{
+	if (config->client_cache_ttl <= 0)
+		return;
+
+	char * name = _client_cache_name(config);
+	cache_file_write(name, reply_body);
+	free(name);
+}
+
+static struct client *
+_fetch_client(const struct config * config)
+{
+	char * reply_body = NULL;
+	struct client * client = NULL;
+	struct jparser * parser = jparser_init();
+
+	char * request_url = _client_url(config);
+
+	if (http_get_request(config, request_url, &reply_body, parser))
+	{
+		jobj_fini(jparser_fini(parser, NULL, NULL));
 		goto cleanup;
 	}
 
+	client = _parse_client_reply(reply_body, parser, NULL);
+	if (client)
+		_save_client_reply(config, reply_body);
+
 cleanup:
 	free(request_url);
 	free(reply_body);
-	free(error_msg);
-	jobj_fini(json);
 	return client;
 }
 
+// '*refresh_lock' is set if the record is stale and it is our turn to refresh
+// it; the caller closes it once the new record is saved or the fetch fails.
+/*
+ * The scope set built from the cached client record is kept for as long as
+ * the file is unchanged so that helperd and multi-command sessions don't
+ * rebuild it for every login.
+ */
+static pthread_mutex_t     client_scopes_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct ssh_scopes * client_scopes       = NULL;
+static struct stat         client_scopes_st;
+
+static bool
+_same_file(const struct stat * a, const struct stat * b)
+{
+	return a->st_dev          == b->st_dev &&
+	       a->st_ino          == b->st_ino &&
+	       a->st_size         == b->st_size &&
+	       a->st_mtim.tv_sec  == b->st_mtim.tv_sec &&
+	       a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// A held reference to the scope set built from the file 'st', or NULL
+static struct ssh_scopes *
+_cached_ssh_scopes(const struct stat * st)
+{
+	struct ssh_scopes * ssh_scopes = NULL;
+
+	pthread_mutex_lock(&client_scopes_mutex);
+	if (client_scopes && _same_file(&client_scopes_st, st))
+		ssh_scopes = ssh_scopes_hold(client_scopes);
+	pthread_mutex_unlock(&client_scopes_mutex);
+	return ssh_scopes;
+}
+
+static void
+_remember_ssh_scopes(const struct stat * st, struct ssh_scopes * ssh_scopes)
+{
+	pthread_mutex_lock(&client_scopes_mutex);
+	ssh_scopes_release(client_scopes);
+	client_scopes    = ssh_scopes_hold(ssh_scopes);
+	client_scopes_st = *st;
+	pthread_mutex_unlock(&client_scopes_mutex);
+}
+
+static struct client *
+_cached_client(const struct config * config, int * refresh_lock)
+{
+	*refresh_lock = -1;
+	if (config->client_cache_ttl <= 0)
+		return NULL;
+
+	struct stat st;
+	struct client * client = NULL;
+	char * name = _client_cache_name(config);
+	char * reply_body = cache_file_read(name, &st);
+
+	if (reply_body)
+	{
+		struct ssh_scopes * ssh_scopes = _cached_ssh_scopes(&st);
+		client = _parse_client_reply(reply_body, NULL, ssh_scopes);
+		if (client && !ssh_scopes)
+			_remember_ssh_scopes(&st, client->ssh_scopes);
+		ssh_scopes_release(ssh_scopes);
+	}
+
+	if (client && time(NULL) - st.st_mtime > config->client_cache_ttl)
+		*refresh_lock = cache_file_trylock(name);
+
+	free(name);
+	free(reply_body);
+	return client;
+}
+
+// The new record if it could be fetched, otherwise the stale one
+static struct client *
+_refreshed_client(struct client * stale, struct client * fetched)
+{
+	if (!fetched)
+		return stale;
+
+	client_fini(stale);
+	return fetched;
+}
+
+struct client *
+get_client_resource(const struct config * config)
+{
+	int refresh_lock = -1;
+	struct client * client = _cached_client(config, &refresh_lock);
+	metrics_count(client ? METRIC_CACHE_CLIENT_HIT : METRIC_CACHE_CLIENT_MISS);
+	if (client && refresh_lock == -1)
+		return client;
+
+	client = _refreshed_client(client, _fetch_client(config));
+	if (refresh_lock != -1)
+		close(refresh_lock);
+	return client;
+}
+
+void
+get_login_resources(const struct config *  config,
+                    const char          *  token,
+                    struct introspect   ** introspect,
+                    struct client       ** client)
+{
+	char * introspect_url    = NULL;
+	char * introspect_body   = NULL;
+	char * introspect_reply  = NULL;
+	int    introspect_status = 0;
+	bool   introspect_claimed = false;
+	struct jparser * introspect_parser = NULL;
+
+	char * client_url    = NULL;
+	char * client_reply  = NULL;
+	int    client_status = 0;
+	bool   client_claimed = false;
+	int    refresh_lock  = -1;
+	struct jparser * client_parser = NULL;
+
+	*introspect = NULL;
+	*client     = _cached_client(config, &refresh_lock);
+
+	introspect_reply = _cached_introspect_reply(config, token, &introspect_claimed);
+
+	// Only one login at a time fetches the client record if it isn't on disk
+	if (!*client)
+		client_reply = cache_get_or_claim("client", config->client_id, true, &client_claimed);
+
+	metrics_count(*client || client_reply ? METRIC_CACHE_CLIENT_HIT : METRIC_CACHE_CLIENT_MISS);
+
+	// Neither request depends on the other, so wait on them together
+	struct http_batch * batch = http_batch_init();
+
+	if (!introspect_reply)
+	{
+		introspect_url    = _introspect_url(config);
+		introspect_body   = _introspect_body(config, token);
+		introspect_parser = jparser_init();
+		http_batch_post(batch,
+		                config,
+		                introspect_url,
+		                introspect_body,
+		                &introspect_reply,
+		                introspect_parser,
+		                &introspect_status);
+	}
+	// A stale record is refreshed alongside the introspection, so this login
+	// does not wait any longer than it would have anyway
+	if ((!*client && !client_reply) || refresh_lock != -1)
+	{
+		client_url    = _client_url(config);
+		client_parser = jparser_init();
+		http_batch_get(batch,
+		               config,
+		               client_url,
+		               &client_reply,
+		               client_parser,
+		               &client_status);
+	}
+
+	http_batch_perform(batch);
+	http_batch_fini(batch);
+
+	if (introspect_reply && introspect_status == 0)
+	{
+		*introspect = _parse_introspect_reply(introspect_reply, introspect_parser);
+		introspect_parser = NULL;
+	}
+
+	if (introspect_claimed)
+		_share_introspect_reply(config, token, introspect_reply, *introspect);
+
+	if (client_reply && client_status == 0)
+	{
+		struct client * fetched = _parse_client_reply(client_reply, client_parser, NULL);
+		client_parser = NULL;
+		if (fetched && client_url)
+			_save_client_reply(config, client_reply);
+		*client = _refreshed_client(*client, fetched);
+	}
+
+	if (refresh_lock != -1)
+		close(refresh_lock);
+
+	// The on-disk cache serves later logins
+	if (client_claimed)
+		_share_reply("client", config->client_id, client_reply, *client != NULL, time(NULL));
+
+	// Parsers of failed requests
+	jobj_fini(jparser_fini(introspect_parser, NULL, NULL));
+	jobj_fini(jparser_fini(client_parser, NULL, NULL));
+
+	free(introspect_url);
+	free(introspect_body);
+	free(introspect_reply);
+	free(client_url);
+	free(client_reply);
+}
+
 struct identities *
 get_identities_resource(const struct config * config,
                         const struct introspect * introspect)
@@ -160,6 +523,7 @@ get_identities_resource(const struct config * config,
 	char * reply_body = NULL;
 	char * error_msg  = NULL;
 	json_t * json = NULL;
+	struct jparser * parser = NULL;
 	struct identities * identities = NULL;
 
 	// construct request url
@@ -170,10 +534,21 @@ get_identities_resource(const struct config * config,
 	           host,
 	           id_list);
 
-	if (http_get_request(config, request_url, &reply_body))
-		goto cleanup;
+	bool claimed = false;
+	reply_body = cache_get_or_claim("identities", id_list, true, &claimed);
+	metrics_count(reply_body ? METRIC_CACHE_IDENTITIES_HIT : METRIC_CACHE_IDENTITIES_MISS);
 
-	if ((json = jobj_init(reply_body, &error_msg)))
+	if (!reply_body)
+	{
+		parser = jparser_init();
+		if (http_get_request(config, request_url, &reply_body, parser))
+		{
+			jobj_fini(jparser_fini(parser, NULL, NULL));
+			goto cleanup;
+		}
+	}
+
+	if ((json = _reply_json(reply_body, parser, &error_msg)))
 	{
 		if (!jobj_key_exists(json, "errors"))
 			identities = identities_init(json);
@@ -187,6 +562,10 @@ get_identities_resource(const struct config * config,
 		goto cleanup;
 	}
 cleanup:
+	// Identities are only shared with concurrent logins, not cached
+	if (claimed)
+		_share_reply("identities", id_list, reply_body, identities != NULL, time(NULL));
+
 	free(id_list);
 	free(request_url);
 	free(reply_body);
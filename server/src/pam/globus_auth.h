@@ -15,6 +15,14 @@ get_client_resource(const struct config *);
 struct introspect *
 get_introspect_resource(const struct config *, const char * token);
 
+// Fetch the introspect and client resources concurrently. On failure, the
+// corresponding output is set to NULL.
+void
+get_login_resources(const struct config *  config,
+                    const char          *  token,
+                    struct introspect   ** introspect,
+                    struct client       ** client);
+
 struct identities *
 get_identities_resource(const struct config *, const struct introspect *);
 
@@ -0,0 +1,124 @@
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Local includes.
+ */
+#include "hash.h"
+#include "arena.h"
+#include "debug.h" // always last
+
+/*******************************************************************************
+ * Internal (Private) Functions
+ ******************************************************************************/
+
+#define HASH_MIN_SIZE 16
+
+static void
+_free_buckets(struct hash_node ** buckets)
+{
+	// Released by arena_end()
+	if (buckets && !arena_owns(buckets))
+		free(buckets);
+}
+
+// Keep chains short by doubling once there is a node per bucket
+static bool
+_grow(struct hash * hash)
+{
+	uint32_t size = hash->size ? hash->size * 2 : HASH_MIN_SIZE;
+	struct hash_node ** buckets = arena_calloc(size, sizeof(*buckets));
+	if (!buckets)
+		return false;
+
+	for (uint32_t b = 0; b < hash->size; b++)
+	{
+		struct hash_node * node;
+		while ((node = hash->buckets[b]))
+		{
+			hash->buckets[b] = node->next;
+			node->next = buckets[node->hash & (size - 1)];
+			buckets[node->hash & (size - 1)] = node;
+		}
+	}
+
+	_free_buckets(hash->buckets);
+	hash->buckets = buckets;
+	hash->size = size;
+	return true;
+}
+
+static uint32_t
+_hash(const char * key, size_t length)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= (unsigned char)key[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*******************************************************************************
+ * Public Functions
+ ******************************************************************************/
+
+uint32_t
+hash_string(const char * key)
+{
+	return _hash(key, strlen(key));
+}
+
+bool
+hash_insert(struct hash * hash, struct hash_node * node, const char * key)
+{
+	ASSERT(!hash_find(hash, key));
+
+	if (hash->count >= hash->size && !_grow(hash))
+		return false;
+
+	node->key  = key;
+	node->hash = hash_string(key);
+	node->next = hash->buckets[node->hash & (hash->size - 1)];
+	hash->buckets[node->hash & (hash->size - 1)] = node;
+	hash->count++;
+	return true;
+}
+
+struct hash_node *
+hash_find(const struct hash * hash, const char * key)
+{
+	return hash_find_n(hash, key, strlen(key));
+}
+
+struct hash_node *
+hash_find_n(const struct hash * hash, const char * key, size_t length)
+{
+	if (!hash->count)
+		return NULL;
+
+	uint32_t h = _hash(key, length);
+	for (struct hash_node * node = hash->buckets[h & (hash->size - 1)]; node; node = node->next)
+	{
+		if (node->hash == h &&
+		    strncmp(node->key, key, length) == 0 &&
+		    node->key[length] == '\0')
+		{
+			return node;
+		}
+	}
+	return NULL;
+}
+
+void
+hash_fini(struct hash * hash)
+{
+	_free_buckets(hash->buckets);
+	memset(hash, 0, sizeof(*hash));
+}
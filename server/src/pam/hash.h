@@ -0,0 +1,51 @@
+#ifndef _HASH_H_
+#define _HASH_H_
+
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Chained hash table keyed on strings. Nodes are embedded in the caller's
+ * records, so the table only ever allocates its buckets; those come from the
+ * request arena when one is active. A zeroed 'struct hash' is an empty table.
+ */
+struct hash_node {
+	const char       * key;
+	uint32_t           hash;
+	struct hash_node * next;
+};
+
+struct hash {
+	struct hash_node ** buckets;
+	uint32_t            size; // power of 2
+	uint32_t            count;
+};
+
+// The record containing 'node', or NULL if 'node' is NULL.
+#define hash_entry(node, type, member) \
+	((node) ? (type *)((char *)(node) - offsetof(type, member)) : NULL)
+
+// FNV-1a
+uint32_t
+hash_string(const char * key);
+
+// 'key' must not already be in 'hash' and must outlive 'node'.
+bool
+hash_insert(struct hash * hash, struct hash_node * node, const char * key);
+
+struct hash_node *
+hash_find(const struct hash * hash, const char * key);
+
+// Same as hash_find() for the first 'length' characters of 'key'.
+struct hash_node *
+hash_find_n(const struct hash * hash, const char * key, size_t length);
+
+// Releases the buckets. The nodes belong to the caller.
+void
+hash_fini(struct hash * hash);
+
+#endif /* _HASH_H_ */
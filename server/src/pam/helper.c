@@ -0,0 +1,213 @@
+#define _GNU_SOURCE // struct ucred
+/*
+ * System includes.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * Local includes.
+ */
+#include "helper.h"
+#include "logger.h"
+#include "debug.h" // always last
+
+/*******************************************************************************
+ * Internal (Private) Functions
+ ******************************************************************************/
+
+static bool
+_read_all(int fd, void * buffer, size_t length)
+{
+	size_t offset = 0;
+	while (offset < length)
+	{
+		ssize_t cnt = read(fd, (char *)buffer+offset, length-offset);
+		if (cnt == -1 && errno == EINTR)
+			continue;
+		if (cnt <= 0)
+			return false;
+		offset += cnt;
+	}
+	return true;
+}
+
+static bool
+_write_all(int fd, const void * buffer, size_t length)
+{
+	size_t offset = 0;
+	while (offset < length)
+	{
+		// Don't let a vanished peer SIGPIPE sshd
+		ssize_t cnt = send(fd, (const char *)buffer+offset, length-offset, MSG_NOSIGNAL);
+		if (cnt == -1 && errno == EINTR)
+			continue;
+		if (cnt <= 0)
+			return false;
+		offset += cnt;
+	}
+	return true;
+}
+
+static int
+_helper_connect()
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	strncpy(addr.sun_path, HELPER_DEFAULT_SOCKET, sizeof(addr.sun_path)-1);
+
+	// Also bounds connect() when the daemon's backlog is full
+	helper_set_timeout(fd, HELPER_ACCEPT_TIMEOUT);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+	{
+		// The daemon is optional, so not finding it is not an error
+		logger(LOG_TYPE_DEBUG, "Could not connect to %s: %m", HELPER_DEFAULT_SOCKET);
+		close(fd);
+		return -1;
+	}
+
+	// Only trust answers from a daemon running as root
+	struct ucred cred = {0};
+	socklen_t length = sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == -1 || cred.uid != 0)
+	{
+		logger(LOG_TYPE_ERROR,
+		       "Ignoring %s: the daemon is not running as root",
+		       HELPER_DEFAULT_SOCKET);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*******************************************************************************
+ * Public Functions
+ ******************************************************************************/
+
+bool
+helper_process_command(int           argc,
+                       const char ** argv,
+                       const char *  requested_user,
+                       const char *  user_input,
+                       int        *  pam_status,
+                       char       ** reply,
+                       int        *  version)
+{
+	if (argc > HELPER_MAX_ARGS)
+		return false;
+
+	int fd = _helper_connect();
+	if (fd == -1)
+		return false;
+
+	bool ok = helper_write_uint32(fd, HELPER_PROTOCOL_VERSION) &&
+	          helper_write_uint32(fd, argc);
+
+	for (int i = 0; ok && i < argc; i++)
+	{
+		ok = helper_write_string(fd, argv[i]);
+	}
+
+	ok = ok && helper_write_string(fd, requested_user) &&
+	           helper_write_string(fd, user_input);
+
+	uint32_t helper_version  = 0;
+	uint32_t status          = 0;
+	uint32_t command_version = 0;
+	char   * tmp             = NULL;
+
+	// The daemon is alive and has our request; give the command its time
+	ok = ok && helper_read_uint32(fd, &helper_version) &&
+	           helper_version == HELPER_PROTOCOL_VERSION;
+	if (ok)
+		helper_set_timeout(fd, HELPER_TIMEOUT);
+
+	ok = ok && helper_read_uint32(fd, &status) &&
+	           helper_read_uint32(fd, &command_version) &&
+	           helper_read_string(fd, &tmp);
+	close(fd);
+
+	if (!ok)
+	{
+		logger(LOG_TYPE_ERROR,
+		       "No answer from oauth-ssh-helperd, processing the command locally");
+		free(tmp);
+		return false;
+	}
+
+	*pam_status = (int32_t)status;
+	*version    = (int32_t)command_version;
+	*reply      = tmp;
+	return true;
+}
+
+bool
+helper_read_uint32(int fd, uint32_t * value)
+{
+	return _read_all(fd, value, sizeof(*value));
+}
+
+bool
+helper_write_uint32(int fd, uint32_t value)
+{
+	return _write_all(fd, &value, sizeof(value));
+}
+
+bool
+helper_read_string(int fd, char ** string)
+{
+	uint32_t length = 0;
+
+	*string = NULL;
+	if (!helper_read_uint32(fd, &length))
+		return false;
+
+	if (length == HELPER_NULL_STRING)
+		return true;
+
+	if (length > HELPER_MAX_STRING)
+		return false;
+
+	*string = calloc(length+1, sizeof(char));
+	if (!_read_all(fd, *string, length))
+	{
+		free(*string);
+		*string = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool
+helper_write_string(int fd, const char * string)
+{
+	if (!string)
+		return helper_write_uint32(fd, HELPER_NULL_STRING);
+
+	size_t length = strlen(string);
+	if (length > HELPER_MAX_STRING)
+		return false;
+
+	return helper_write_uint32(fd, length) && _write_all(fd, string, length);
+}
+
+void
+helper_set_timeout(int fd, int seconds)
+{
+	struct timeval tv = {.tv_sec = seconds};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
@@ -0,0 +1,71 @@
+#ifndef _HELPER_H_
+#define _HELPER_H_
+
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * oauth-ssh-helperd is an optional, long-lived process that runs
+ * process_command() on behalf of the PAM module. Unlike a freshly started sshd
+ * child, it keeps its HTTP connections, parsed config and caches warm between
+ * logins.
+ *
+ * The protocol is a single request / reply per connection. Integers are in
+ * host byte order; strings are a uint32_t length followed by that many bytes,
+ * with HELPER_NULL_STRING standing in for NULL.
+ *
+ *   request: version, argc, argv[0..argc-1], requested_user, user_input
+ *   reply:   version, pam_status, command_version, reply
+ *
+ * The daemon sends the reply's version as soon as it has read the request.
+ * Until then the module only waits HELPER_ACCEPT_TIMEOUT, so a wedged daemon
+ * costs a login a moment rather than HELPER_TIMEOUT; the command itself, which
+ * may wait on Globus Auth, gets the full HELPER_TIMEOUT.
+ */
+#define HELPER_DEFAULT_SOCKET   "/run/oauth_ssh/helperd.sock"
+#define HELPER_PROTOCOL_VERSION 2
+#define HELPER_NULL_STRING      UINT32_MAX
+#define HELPER_MAX_STRING       (1024*1024)
+#define HELPER_MAX_ARGS         64
+#define HELPER_ACCEPT_TIMEOUT   2  // seconds
+#define HELPER_TIMEOUT          60 // seconds
+
+// Ask oauth-ssh-helperd to process the command. 'argc' and 'argv' are the
+// module arguments from the PAM stack. '*version' is the client's protocol
+// version as with process_command(). Returns false if the daemon is not
+// running or did not answer, in which case the caller should process the
+// command itself.
+bool
+helper_process_command(int           argc,
+                       const char ** argv,
+                       const char *  requested_user,
+                       const char *  user_input,
+                       int        *  pam_status,
+                       char       ** reply,
+                       int        *  version);
+
+/*
+ * Framing shared with oauth-ssh-helperd. These return false on a short read
+ * or write.
+ */
+bool
+helper_read_uint32(int fd, uint32_t * value);
+
+bool
+helper_write_uint32(int fd, uint32_t value);
+
+// '*string' is newly allocated, or NULL if the peer sent NULL.
+bool
+helper_read_string(int fd, char ** string);
+
+bool
+helper_write_string(int fd, const char * string);
+
+// Set send and receive timeouts on 'fd'.
+void
+helper_set_timeout(int fd, int seconds);
+
+#endif /* _HELPER_H_ */
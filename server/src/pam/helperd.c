@@ -0,0 +1,205 @@
+#define _GNU_SOURCE // struct ucred, accept4()
+/*
+ * System includes.
+ */
+#include <security/pam_appl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+
+/*
+ * Local includes.
+ */
+#include "commands.h"
+#include "arena.h"
+#include "strings.h"
+#include "helper.h"
+#include "config.h"
+#include "logger.h"
+#include "probes.h"
+#include "timing.h"
+#include "debug.h" // always last
+
+/*
+ * oauth-ssh-helperd: serves process_command() to the PAM module over
+ * HELPER_DEFAULT_SOCKET, one thread per connection. See helper.h.
+ *
+ * Usage: oauth-ssh-helperd [debug]
+ */
+
+static void
+_serve(int fd)
+{
+	uint32_t        version         = 0;
+	uint32_t        argc            = 0;
+	char         ** argv            = NULL;
+	char          * requested_user  = NULL;
+	char          * user_input      = NULL;
+	char          * reply           = NULL;
+	struct config * config          = NULL;
+	int             pam_status      = PAM_AUTHINFO_UNAVAIL;
+	int             command_version = 0;
+
+	// Only sshd, as root, may ask us to authorize logins
+	struct ucred cred = {0};
+	socklen_t length = sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == -1)
+	{
+		logger(LOG_TYPE_ERROR, "Could not identify the connecting process: %m");
+		goto cleanup;
+	}
+
+	if (cred.uid != 0)
+	{
+		logger(LOG_TYPE_ERROR, "Rejecting connection from uid %d", (int)cred.uid);
+		goto cleanup;
+	}
+
+	if (!helper_read_uint32(fd, &version) || version != HELPER_PROTOCOL_VERSION)
+		goto cleanup;
+
+	if (!helper_read_uint32(fd, &argc) || argc > HELPER_MAX_ARGS)
+		goto cleanup;
+
+	argv = calloc(argc+1, sizeof(char *));
+	for (int i = 0; i < argc; i++)
+	{
+		if (!helper_read_string(fd, &argv[i]) || !argv[i])
+			goto cleanup;
+	}
+
+	if (!helper_read_string(fd, &requested_user))
+		goto cleanup;
+
+	if (!helper_read_string(fd, &user_input) || !user_input)
+		goto cleanup;
+
+	// Let the module know we are working on it; see HELPER_ACCEPT_TIMEOUT
+	if (!helper_write_uint32(fd, HELPER_PROTOCOL_VERSION))
+		goto cleanup;
+
+	timing_begin();
+
+	// Configured with the module's own PAM arguments
+	timing_start(TIMING_CONFIG);
+	config = config_init(0, argc, (const char **)argv);
+	timing_stop(TIMING_CONFIG);
+
+	if (config)
+	{
+		arena_begin();
+		pam_status = process_command(config,
+		                             requested_user,
+		                             user_input,
+		                             &reply,
+		                             &command_version);
+		arena_end();
+	}
+
+	PROBE2(status, pam_status, (long)(timing_elapsed() * 1000000));
+	timing_end(pam_status);
+
+	if (!helper_write_uint32(fd, pam_status) ||
+	    !helper_write_uint32(fd, command_version) ||
+	    !helper_write_string(fd, reply))
+	{
+		logger(LOG_TYPE_ERROR, "Failed to send our reply to the PAM module");
+	}
+
+cleanup:
+	config_fini(config);
+	free_array(argv);
+	free(requested_user);
+	free(user_input);
+	free(reply);
+	close(fd);
+}
+
+static void *
+_serve_thread(void * arg)
+{
+	_serve((int)(intptr_t)arg);
+	return NULL;
+}
+
+static int
+_listen(const char * path)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (fd == -1)
+	{
+		logger(LOG_TYPE_ERROR, "Could not create socket: %m");
+		return -1;
+	}
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+
+	// Remove the socket left behind by a previous instance
+	unlink(path);
+
+	// Only root may connect
+	mode_t mask = umask(S_IRWXG|S_IRWXO);
+	int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+
+	if (rc == -1 || listen(fd, SOMAXCONN) == -1)
+	{
+		logger(LOG_TYPE_ERROR, "Could not listen on %s: %m", path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int
+main(int argc, const char ** argv)
+{
+	logger_init(0, argc-1, argv+1);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	int fd = _listen(HELPER_DEFAULT_SOCKET);
+	if (fd == -1)
+		return 1;
+
+	logger(LOG_TYPE_INFO, "Listening on %s", HELPER_DEFAULT_SOCKET);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (;;)
+	{
+		int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+		if (client == -1)
+		{
+			if (errno != EINTR && errno != ECONNABORTED)
+			{
+				logger(LOG_TYPE_ERROR, "Failed to accept a connection: %m");
+				// Give descriptors (EMFILE) a chance to free up
+				sleep(1);
+			}
+			continue;
+		}
+
+		helper_set_timeout(client, HELPER_TIMEOUT);
+
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, _serve_thread, (void *)(intptr_t)client) != 0)
+		{
+			// The PAM module processes the command itself
+			logger(LOG_TYPE_ERROR, "Failed to start a thread for a connection");
+			close(client);
+		}
+	}
+}
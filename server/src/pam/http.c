@@ -2,6 +2,7 @@
  * System includes.
  */
 #include <curl/curl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -9,42 +10,169 @@
  * Local includes.
  */
 #include "strings.h"
+#include "buffer.h"
+#include "metrics.h"
 #include "logger.h"
+#include "probes.h"
+#include "timing.h"
 #include "http.h"
 #include "debug.h" // always last
 
 typedef enum {HTTP_GET, HTTP_POST} request_type_t;
 
+/*
+ * Every request made by this process shares DNS results, TLS sessions and
+ * (where libcurl supports it) open connections so that the introspect, client
+ * and identities requests of a login only pay for one handshake.
+ */
+static pthread_once_t  http_initialized = PTHREAD_ONCE_INIT;
+static CURLSH *        http_share       = NULL;
+static pthread_mutex_t http_share_locks[CURL_LOCK_DATA_LAST];
+
+static void
+_http_share_lock(CURL * curl, curl_lock_data data, curl_lock_access access, void * userptr)
+{
+	pthread_mutex_lock(&http_share_locks[data]);
+}
+
+static void
+_http_share_unlock(CURL * curl, curl_lock_data data, void * userptr)
+{
+	pthread_mutex_unlock(&http_share_locks[data]);
+}
+
+/*
+ * Another thread may have held a share lock when we forked. The child starts
+ * over with its own locks and without the parent's share.
+ */
+static void
+_http_atfork_child()
+{
+	for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&http_share_locks[i], NULL);
+	http_share = NULL;
+}
+
+static void
+_http_initialize()
+{
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	pthread_atfork(NULL, NULL, _http_atfork_child);
+
+	for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&http_share_locks[i], NULL);
+
+	http_share = curl_share_init();
+	if (!http_share)
+		return;
+
+	curl_share_setopt(http_share, CURLSHOPT_LOCKFUNC,   _http_share_lock);
+	curl_share_setopt(http_share, CURLSHOPT_UNLOCKFUNC, _http_share_unlock);
+	curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900 // 7.57.0
+	curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+/*
+ * PAM unloads us with dlclose() after pam_end(); release the cached
+ * connections and our reference on libcurl's global state.
+ */
+__attribute__((destructor))
+static void
+_http_finalize()
+{
+	if (http_share)
+		curl_share_cleanup(http_share);
+	http_share = NULL;
+	curl_global_cleanup();
+}
+
+/*
+ * A single request. Requests are heap allocated because libcurl writes into
+ * err_buf for as long as the easy handle exists.
+ */
+struct http_request {
+	CURL          *  curl;
+	CURLcode         code;
+	struct buffer    response;
+	bool             too_large;
+	struct jparser * parser;
+	char          ** reply_body;
+	int           *  status;
+	const char    *  kind;
+	long             usec;
+	char             err_buf[CURL_ERROR_SIZE];
+};
+
 static size_t
 capture_response(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
-	char * response = *(char **)userdata;
+	struct http_request * request = userdata;
+
+	// Returning anything other than size*nmemb aborts the transfer
+	if (!buffer_append(&request->response, ptr, size * nmemb))
+	{
+		request->too_large = true;
+		return 0;
+	}
 
-	*(char **)userdata = sformat("%s%.*s",
-	                             response?response:"",
-	                             size*nmemb,
-	                             ptr);
-	free(response);
+	if (request->parser)
+		jparser_feed(request->parser, ptr, size * nmemb);
 	return size * nmemb;
 }
 
-static int
-http_request(const char  *  client_id,
-             const char  *  client_secret,
-             request_type_t request_type,
-             const char  *  request_url,
-             const char  *  request_body,
-             char        ** reply_body)
-{
-//	curl_global_init(CURL_GLOBAL_NOTHING); // prevent memory leaks
-	CURL * curl = curl_easy_init();
+// Which Globus Auth API a request is for, as reported by our probes
+static const char *
+_http_url_kind(const char * url)
+{
+	if (strstr(url, "/oauth2/token/introspect"))
+		return "introspect";
+	if (strstr(url, "/api/clients/"))
+		return "clients";
+	if (strstr(url, "/api/identities"))
+		return "identities";
+	return "other";
+}
+
+static struct http_request *
+_http_request_init(const struct config * config,
+                   request_type_t        request_type,
+                   const char          * request_url,
+                   const char          * request_body,
+                   char               ** reply_body,
+                   struct jparser      * parser)
+{
+	pthread_once(&http_initialized, _http_initialize);
+
+	struct http_request * request = calloc(1, sizeof(*request));
+	request->code = CURLE_FAILED_INIT;
+	request->reply_body = reply_body;
+	request->parser = parser;
+	request->response.max = config->max_response_size;
+	request->kind = _http_url_kind(request_url);
+
+	PROBE1(request__start, request->kind);
+
+	CURL * curl = request->curl = curl_easy_init();
+	if (http_share)
+		curl_easy_setopt(curl, CURLOPT_SHARE, http_share);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE,       request);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, capture_response);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA,     reply_body);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA,     request);
 	curl_easy_setopt(curl, CURLOPT_URL,           request_url);
 
+	// Refuse before reading the body when Content-Length is already too large
+	curl_easy_setopt(curl, CURLOPT_MAXFILESIZE_LARGE,
+	                 (curl_off_t)config->max_response_size);
+
 //curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	curl_easy_setopt(curl, CURLOPT_USERNAME, client_id);
-	curl_easy_setopt(curl, CURLOPT_PASSWORD, client_secret);
+	curl_easy_setopt(curl, CURLOPT_USERNAME, config->client_id);
+	curl_easy_setopt(curl, CURLOPT_PASSWORD, config->client_secret);
+
+	if (config->cafile)
+		curl_easy_setopt(curl, CURLOPT_CAINFO, config->cafile);
 
 	switch (request_type)
 	{
@@ -58,46 +186,240 @@ http_request(const char  *  client_id,
 	}
 
 	/* Capture curl error descriptions. */
-	char err_buf[CURL_ERROR_SIZE];
-	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, err_buf);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, request->err_buf);
 
-	CURLcode code = curl_easy_perform(curl);
+	return request;
+}
+
+// Where the time went: DNS, TCP, TLS and waiting on Globus Auth
+static void
+_http_request_timing(struct http_request * request)
+{
+	char * url     = NULL;
+	double dns     = 0;
+	double connect = 0;
+	double tls     = 0;
+	double ttfb    = 0;
+	double total   = 0;
+
+	curl_easy_getinfo(request->curl, CURLINFO_EFFECTIVE_URL,      &url);
+	curl_easy_getinfo(request->curl, CURLINFO_NAMELOOKUP_TIME,    &dns);
+	curl_easy_getinfo(request->curl, CURLINFO_CONNECT_TIME,       &connect);
+	curl_easy_getinfo(request->curl, CURLINFO_APPCONNECT_TIME,    &tls);
+	curl_easy_getinfo(request->curl, CURLINFO_STARTTRANSFER_TIME, &ttfb);
+	curl_easy_getinfo(request->curl, CURLINFO_TOTAL_TIME,         &total);
+
+	timing_request(url, dns, connect, tls, ttfb, total);
+	metrics_observe(METRIC_UPSTREAM_SECONDS, total);
+	request->usec = total * 1000000;
+}
+
+/*
+ * Log the outcome of 'request' and release it. Returns 0 on success.
+ */
+static int
+_http_request_fini(struct http_request * request)
+{
+	char ** reply_body = request->reply_body;
+	CURLcode code = request->code;
+
+	_http_request_timing(request);
+	PROBE3(request__done, request->kind, request->usec, (int)code);
+
+	metrics_count(METRIC_UPSTREAM_REQUESTS);
+	if (code != CURLE_OK)
+		metrics_count(METRIC_UPSTREAM_ERRORS);
 	switch (code)
 	{
-	case 0:
+	case CURLE_OK:
+		*reply_body = buffer_steal(&request->response);
 		logger(LOG_TYPE_DEBUG, "%s", *reply_body ? *reply_body : "EMPTY");
 		break;
 	default:
-		logger(LOG_TYPE_ERROR, "Globus Auth HTTP request failed: %s", err_buf);
+		if (request->too_large || code == CURLE_FILESIZE_EXCEEDED)
+			logger(LOG_TYPE_ERROR,
+			       "Globus Auth reply exceeds max_response_size (%zu bytes)",
+			       request->response.max);
+		else
+			logger(LOG_TYPE_ERROR,
+			       "Globus Auth HTTP request failed: %s",
+			       request->err_buf[0] ? request->err_buf : curl_easy_strerror(code));
 		break;
 	}
-	curl_easy_cleanup(curl);
-	return !(code == 0);
+	buffer_fini(&request->response);
+	curl_easy_cleanup(request->curl);
+	free(request);
+	return !(code == CURLE_OK);
+}
+
+static int
+http_request(const struct config * config,
+             request_type_t        request_type,
+             const char          * request_url,
+             const char          * request_body,
+             char               ** reply_body,
+             struct jparser      * parser)
+{
+	struct http_request * request = _http_request_init(config,
+	                                                   request_type,
+	                                                   request_url,
+	                                                   request_body,
+	                                                   reply_body,
+	                                                   parser);
+
+	request->code = curl_easy_perform(request->curl);
+	return _http_request_fini(request);
 }
 
 int
 http_post_request(const struct config * config,
                   const char * request_url,
                   const char * request_body,
-                  char ** reply_body)
+                  char ** reply_body,
+                  struct jparser * parser)
 {
-	return http_request(config->client_id,
-	                    config->client_secret,
+	return http_request(config,
 	                    HTTP_POST,
 	                    request_url,
 	                    request_body,
-	                    reply_body);
+	                    reply_body,
+	                    parser);
 }
 
 int
 http_get_request(const struct config * config,
                  const char * request_url,
-                 char ** reply_body)
+                 char ** reply_body,
+                 struct jparser * parser)
 {
-	return http_request(config->client_id,
-	                    config->client_secret,
+	return http_request(config,
 	                    HTTP_GET,
 	                    request_url,
 	                    NULL,
-	                    reply_body);
+	                    reply_body,
+	                    parser);
+}
+
+/*
+ * Concurrent requests.
+ */
+struct http_batch {
+	CURLM                *  multi;
+	int                     count;
+	struct http_request  ** requests;
+};
+
+struct http_batch *
+http_batch_init()
+{
+	pthread_once(&http_initialized, _http_initialize);
+
+	struct http_batch * batch = calloc(1, sizeof(*batch));
+	batch->multi = curl_multi_init();
+	return batch;
+}
+
+static void
+_http_batch_add(struct http_batch   *  batch,
+                struct http_request *  request,
+                int                 *  status)
+{
+	batch->requests = realloc(batch->requests,
+	                          (batch->count+1) * sizeof(*batch->requests));
+
+	request->status = status;
+	*status = 1;
+
+	batch->requests[batch->count] = request;
+	batch->count++;
+
+	curl_multi_add_handle(batch->multi, request->curl);
+}
+
+void
+http_batch_post(struct http_batch   *  batch,
+                const struct config *  config,
+                const char          *  request_url,
+                const char          *  request_body,
+                char                ** reply_body,
+                struct jparser      *  parser,
+                int                 *  status)
+{
+	struct http_request * request = _http_request_init(config,
+	                                                   HTTP_POST,
+	                                                   request_url,
+	                                                   request_body,
+	                                                   reply_body,
+	                                                   parser);
+	_http_batch_add(batch, request, status);
+}
+
+void
+http_batch_get(struct http_batch   *  batch,
+               const struct config *  config,
+               const char          *  request_url,
+               char                ** reply_body,
+               struct jparser      *  parser,
+               int                 *  status)
+{
+	struct http_request * request = _http_request_init(config,
+	                                                   HTTP_GET,
+	                                                   request_url,
+	                                                   NULL,
+	                                                   reply_body,
+	                                                   parser);
+	_http_batch_add(batch, request, status);
+}
+
+void
+http_batch_perform(struct http_batch * batch)
+{
+	int running = 0;
+	do {
+		if (curl_multi_perform(batch->multi, &running) != CURLM_OK)
+			break;
+		if (running)
+			curl_multi_wait(batch->multi, NULL, 0, 1000, NULL);
+	} while (running);
+
+	int       remaining = 0;
+	CURLMsg * msg       = NULL;
+	while ((msg = curl_multi_info_read(batch->multi, &remaining)))
+	{
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		struct http_request * request = NULL;
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&request);
+		request->code = msg->data.result;
+	}
+
+	for (int i = 0; i < batch->count; i++)
+	{
+		struct http_request * request = batch->requests[i];
+		curl_multi_remove_handle(batch->multi, request->curl);
+		*request->status = _http_request_fini(request);
+	}
+	free(batch->requests);
+	batch->requests = NULL;
+	batch->count = 0;
+}
+
+void
+http_batch_fini(struct http_batch * batch)
+{
+	if (batch)
+	{
+		// Requests that were never performed
+		for (int i = 0; i < batch->count; i++)
+		{
+			curl_multi_remove_handle(batch->multi, batch->requests[i]->curl);
+			curl_easy_cleanup(batch->requests[i]->curl);
+			buffer_fini(&batch->requests[i]->response);
+			free(batch->requests[i]);
+		}
+		free(batch->requests);
+		curl_multi_cleanup(batch->multi);
+	}
+	free(batch);
 }
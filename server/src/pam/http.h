@@ -5,16 +5,60 @@
  * Local includes.
  */
 #include "config.h"
+#include "json.h"
 
+/*
+ * 'parser' is optional. When given, each piece of the reply is fed to it as
+ * it arrives so that the reply is parsed by the time the request completes;
+ * the caller collects the result with jparser_fini() whether or not the
+ * request succeeded. 'reply_body' is filled in either way.
+ */
 int
 http_post_request(const struct config * config,
                   const char * request_url,
                   const char * request_body,
-                  char ** reply_body);
+                  char ** reply_body,
+                  struct jparser * parser);
 
 int
 http_get_request(const struct config * config,
                  const char * request_url,
-                 char ** reply_body);
+                 char ** reply_body,
+                 struct jparser * parser);
+
+/*
+ * Concurrent requests. Queue any number of requests on a batch, then wait for
+ * all of them with http_batch_perform(). Once it returns, each request's
+ * 'status' is 0 on success and its 'reply_body' has been filled in, exactly
+ * as with the synchronous calls above. 'request_url' and 'request_body' must
+ * remain valid until http_batch_perform() returns.
+ */
+struct http_batch;
+
+struct http_batch *
+http_batch_init();
+
+void
+http_batch_post(struct http_batch   *  batch,
+                const struct config *  config,
+                const char          *  request_url,
+                const char          *  request_body,
+                char                ** reply_body,
+                struct jparser      *  parser,
+                int                 *  status);
+
+void
+http_batch_get(struct http_batch   *  batch,
+               const struct config *  config,
+               const char          *  request_url,
+               char                ** reply_body,
+               struct jparser      *  parser,
+               int                 *  status);
+
+void
+http_batch_perform(struct http_batch *);
+
+void
+http_batch_fini(struct http_batch *);
 
 #endif /* _HTTP_H_ */
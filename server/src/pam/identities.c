@@ -9,207 +9,149 @@
  * Local includes.
  */
 #include "identities.h"
+#include "decoder.h"
+#include "arena.h"
+#include "strings.h"
 #include "logger.h"
 #include "json.h"
 #include "debug.h" // always last
 
-typedef enum { success, failure } status_t;
+/*
+ * Field tables are sorted by key.
+ */
 
-static status_t
-check_key(jobj_t * jobj, const char * key, json_type jtype)
-{
-	if (!jobj_key_exists(jobj, key))
-	{
-		logger(LOG_TYPE_ERROR,
-		       "Identities record is missing required key '%s'", key);
-		return failure;
-	}
+#define WHAT "Identities record"
 
-	if (jobj_get_type(jobj, key) != jtype)
-	{
-		logger(LOG_TYPE_ERROR,
-		       "Identities record has wrong type for required key '%s'", key);
-		return failure;
-	}
-	return success;
-}
+static const struct decode_field identity_provider_fields[] = {
+	DECODE_CONTAINER(struct identity_provider, alternative_names, array, DECODE_REQUIRED, decode_strings, NULL),
+	DECODE_CONTAINER(struct identity_provider, domains,           array, DECODE_REQUIRED, decode_strings, NULL),
+	DECODE_VALUE(struct identity_provider, id,         string, DECODE_REQUIRED),
+	DECODE_VALUE(struct identity_provider, name,       string, DECODE_REQUIRED),
+	DECODE_VALUE(struct identity_provider, short_name, string, DECODE_REQUIRED),
+};
 
-typedef status_t (*func_t)(jobj_t * jobj, void * value);
+static const struct decoder identity_provider_decoder =
+	DECODER(struct identity_provider, WHAT, identity_provider_fields);
 
-#define GET_CONTAINER(j, i, key, type) \
-     get_value(j, #key, json_type_##type, &i->key, get_##key)
+static const struct decode_field included_fields[] = {
+	DECODE_CONTAINER(struct included, identity_providers, array, DECODE_REQUIRED, decode_records, &identity_provider_decoder),
+};
 
-#define GET_VALUE(j, i, key, type) \
-     get_value(j, #key, json_type_##type, &i->key, NULL)
+static const struct decoder included_decoder =
+	DECODER(struct included, WHAT, included_fields);
 
-static status_t
-get_value(jobj_t     * jobj,
-          const char * key,
-          json_type    jtype,
-          void       * value,
-          func_t       func)
-{
-	if (check_key(jobj, key, jtype) == failure)
-		return failure;
+// XXX some IDPs can hide certain values
+static const struct decode_field identity_fields[] = {
+//	DECODE_VALUE(struct identity, email,             string, DECODE_REQUIRED),
+	DECODE_VALUE(struct identity, id,                string, DECODE_REQUIRED),
+	DECODE_VALUE(struct identity, identity_provider, string, DECODE_REQUIRED),
+//	DECODE_VALUE(struct identity, name,              string, DECODE_REQUIRED),
+//	DECODE_VALUE(struct identity, organization,      string, DECODE_REQUIRED),
+	DECODE_VALUE(struct identity, status,            string, DECODE_REQUIRED),
+	DECODE_VALUE(struct identity, username,          string, DECODE_REQUIRED),
+};
+
+static const struct decoder identity_decoder =
+	DECODER(struct identity, WHAT, identity_fields);
+
+static const struct decode_field identities_fields[] = {
+	DECODE_CONTAINER(struct identities, identities, array,  DECODE_REQUIRED, decode_records, &identity_decoder),
+	DECODE_CONTAINER(struct identities, included,   object, DECODE_REQUIRED, decode_record,  &included_decoder),
+};
+
+static const struct decoder identities_decoder =
+	DECODER(struct identities, WHAT, identities_fields);
 
-	const char * tmp;
+struct identities *
+identities_init(jobj_t * jobj)
+{
+	struct identities * i = arena_calloc(1, sizeof(*i));
 
-	switch (jtype)
+	if (!decode_object(jobj, &identities_decoder, i))
 	{
-	case json_type_int:
-		*(int *)value = jobj_get_int(jobj, key);
-		break;
-	case json_type_string:
-		tmp = jobj_get_string(jobj, key);
-		if (tmp)
-			*(char **)value = strdup(tmp);
-		break;
-	case json_type_boolean:
-		*(bool *)value = jobj_get_bool(jobj, key);
-		break;
-
-	case json_type_array:
-	case json_type_object:
-		return func(jobj_get_value(jobj, key), value);
-
-	case json_type_double:
-	case json_type_null:
-		ASSERT(0);
-		return failure;
+		identities_fini(i);
+		return NULL;
 	}
-	return success;
+	return i;
 }
 
-status_t
-get_domains(jarr_t * jarr, void * value)
+static const struct identity_set_detail *
+_find_detail(const struct introspect * introspect, const char * id)
 {
-	char ** domains = calloc(jarr_get_length(jarr)+1, sizeof(char *));
-	*(char ***)value = domains;
-
-	for (int k = 0; k < jarr_get_length(jarr); k++)
+	for (int k = 0; introspect->identity_set_detail[k]; k++)
 	{
-		if (jarr_get_type(jarr, k) != json_type_string)
-		{
-			logger(LOG_TYPE_ERROR, "'domains' is malformed");
-			return failure;
-		}
-		domains[k] = strdup(jarr_get_string(jarr, k));
+		if (strcmp(introspect->identity_set_detail[k]->sub, id) == 0)
+			return introspect->identity_set_detail[k];
 	}
-	return success;
+	return NULL;
 }
 
-status_t
-get_alternative_names(jarr_t * jarr, void * value)
+struct identities *
+identities_from_introspect(const struct introspect * introspect)
 {
-	char ** names = calloc(jarr_get_length(jarr)+1, sizeof(char *));
-	*(char ***)value = names;
+	if (!introspect->identities_set || !introspect->identity_set_detail)
+		return NULL;
 
-	for (int k = 0; k < jarr_get_length(jarr); k++)
+	int count = 0;
+	for (; introspect->identities_set[count]; count++)
 	{
-		if (jarr_get_type(jarr, k) != json_type_string)
-		{
-			logger(LOG_TYPE_ERROR, "'alternative_names' is malformed");
-			return failure;
-		}
-		names[k] = strdup(jarr_get_string(jarr, k));
+		if (!_find_detail(introspect, introspect->identities_set[count]))
+			return NULL;
 	}
-	return success;
-}
 
-status_t
-get_identity_providers(jarr_t * jarr, void * value)
-{
-	struct identity_provider ** idp =
-	                     calloc(jarr_get_length(jarr)+1, sizeof(*idp));
-	*(struct identity_provider ***)value = idp;
+	struct identities * i = arena_calloc(1, sizeof(*i));
+	i->identities = arena_calloc(count+1, sizeof(*i->identities));
+	i->included.identity_providers = arena_calloc(count+1,
+	                                              sizeof(*i->included.identity_providers));
 
-	for (int k = 0; k < jarr_get_length(jarr); k++)
+	int idp_count = 0;
+	for (int k = 0; k < count; k++)
 	{
-		if (jarr_get_type(jarr, k) != json_type_object)
-		{
-			logger(LOG_TYPE_ERROR, "'identity_providers' is malformed");
-			return failure;
-		}
-
-		jobj_t * jobj = jarr_get_index(jarr, k);
+		const struct identity_set_detail * d = NULL;
+		d = _find_detail(introspect, introspect->identities_set[k]);
 
-		idp[k] = calloc(1, sizeof(struct identity_provider));
-
-		if (GET_CONTAINER(jobj, idp[k], domains,           array) == failure  ||
-		    GET_CONTAINER(jobj, idp[k], alternative_names, array) == failure  ||
-		    GET_VALUE(jobj,     idp[k], id,                string) == failure ||
-		    GET_VALUE(jobj,     idp[k], short_name,        string) == failure ||
-		    GET_VALUE(jobj,     idp[k], name,              string) == failure)
-		{
-			return failure;
-		}
-	}
-	return success;
-}
+		i->identities[k] = arena_calloc(1, sizeof(struct identity));
+		i->identities[k]->username = arena_strdup(d->username);
+		i->identities[k]->status   = arena_strdup(d->status ? d->status : "used");
+		i->identities[k]->id       = arena_strdup(d->sub);
+		i->identities[k]->identity_provider = arena_strdup(d->identity_provider);
 
-status_t
-get_included(jobj_t * jobj, void * value)
-{
-	struct included * i = value;
-	return GET_CONTAINER(jobj, i, identity_providers, array);
-}
-
-status_t
-get_identities(jarr_t * jarr, void * value)
-{
-	struct identity ** i = calloc(jarr_get_length(jarr)+1, sizeof(*i));
-	*(struct identity ***)value = i;
-
-	for (int k = 0; k < jarr_get_length(jarr); k++)
-	{
-		if (jarr_get_type(jarr, k) != json_type_object)
+		int j = 0;
+		for (; j < idp_count; j++)
 		{
-			logger(LOG_TYPE_ERROR, "'identities' is malformed");
-			return failure;
+			if (strcmp(i->included.identity_providers[j]->id, d->identity_provider) == 0)
+				break;
 		}
 
-		jobj_t * jobj = jarr_get_index(jarr, k);
-
-		i[k] = calloc(1, sizeof(struct identity));
-// XXX some IDPs can hide certain values
-		if (GET_VALUE(jobj, i[k], username,          string) == failure ||
-		    GET_VALUE(jobj, i[k], status,            string) == failure ||
-		    GET_VALUE(jobj, i[k], id,                string) == failure ||
-		    GET_VALUE(jobj, i[k], identity_provider, string) == failure)
-		    //GET_VALUE(jobj, i[k], name,              string) == failure ||
-		    //GET_VALUE(jobj, i[k], organization,      string) == failure ||
-		    //GET_VALUE(jobj, i[k], email,             string) == failure)
+		if (j == idp_count)
 		{
-			return failure;
+			struct identity_provider * idp = arena_calloc(1, sizeof(*idp));
+			idp->id   = arena_strdup(d->identity_provider);
+			idp->name = arena_strdup(d->identity_provider_display_name ?
+			                         d->identity_provider_display_name : "");
+			i->included.identity_providers[idp_count++] = idp;
 		}
 	}
-	return success;
-}
-
-struct identities *
-identities_init(jobj_t * jobj)
-{
-	struct identities * i = calloc(1, sizeof(*i));
-
-	if (GET_CONTAINER(jobj, i, included,   object) == failure ||
-	    GET_CONTAINER(jobj, i, identities, array)  == failure)
-	{
-		identities_fini(i);
-		return NULL;
-	}
 	return i;
 }
 
 void
 identities_fini(struct identities * i)
 {
+	// Released by arena_end()
+	if (i && arena_owns(i))
+		return;
+
 	if (i)
 	{
 		if (i->included.identity_providers)
 		{
 			for (int j = 0; i->included.identity_providers[j]; j++)
 			{
+				free_array(i->included.identity_providers[j]->domains);
 				free(i->included.identity_providers[j]->id);
+				free_array(i->included.identity_providers[j]->alternative_names);
+				free(i->included.identity_providers[j]->short_name);
 				free(i->included.identity_providers[j]->name);
 				free(i->included.identity_providers[j]);
 			}
@@ -4,6 +4,7 @@
 /*
  * Local includes.
  */
+#include "introspect.h"
 #include "json.h"
 
 struct identities {
@@ -29,6 +30,12 @@ struct identities {
 };
 
 struct identities * identities_init(json_t *);
+
+// Build the identities from the introspect record's identity_set_detail.
+// Returns NULL if the detail is missing or does not cover every identity in
+// identities_set. Identity providers only have 'id' and 'name' set.
+struct identities * identities_from_introspect(const struct introspect *);
+
 void identities_fini(struct identities *);
 
 #endif /* _IDENTITIES_H_ */
@@ -9,6 +9,8 @@
  * Local includes.
  */
 #include "introspect.h"
+#include "decoder.h"
+#include "arena.h"
 #include "strings.h"
 #include "logger.h"
 #include "json.h"
@@ -16,222 +18,138 @@
 
 /*
  * Parse token introspect results. See introspect.h for details on which members
- * are required and which are optional.
+ * are required and which are optional. Field tables are sorted by key.
  */
 
-typedef enum { success, failure } status_t;
+#define WHAT "Introspect record"
 
-enum { required = true, optional = false};
-
-typedef status_t (*func_t)(jobj_t * jobj, void * member_ptr);
-
-#define GET_CONTAINER(j, i, key, type, required) \
-     get_value(j, #key, json_type_##type, &i->key, get_##key, required)
-
-#define GET_VALUE(j, i, key, type, required) \
-     get_value(j, #key, json_type_##type, &i->key, NULL, required)
-
-static status_t
-get_value(jobj_t     * jobj,
-          const char * key,
-          json_type    jtype,
-          void       * member_ptr,
-          func_t       func,
-          bool         required)
-{
-	// Check if the key exists in the JSON object
-	if (!jobj_key_exists(jobj, key))
-	{
-		// It doesn't exist but we don't require it anyways
-		if (!required)
-			return success;
-
-		// It is required, so the parsing has failed
-		logger(LOG_TYPE_ERROR, "Introspect record is missing required key '%s'", key);
-		return failure;
-	}
-
-	// Check the element's type
-	if (jobj_get_type(jobj, key) != jtype)
-	{
-		// Special case were optional keys have value 'null'
-		if (!required && jobj_get_type(jobj, key) == json_type_null)
-			return success;
-
-		logger(LOG_TYPE_ERROR, "Introspect record has wrong type for required key '%s'", key);
-		return failure;
-	}
-
-	switch (jtype)
-	{
-	case json_type_int:
-		*(int *)member_ptr = jobj_get_int(jobj, key);
-		break;
-	case json_type_string:
-	{
-		const char * tmp = jobj_get_string(jobj, key);
-		if (tmp)
-			*(char **)member_ptr = strdup(tmp);
-		break;
-	}
-	case json_type_boolean:
-		*(bool *)member_ptr = jobj_get_bool(jobj, key);
-		break;
-
-	case json_type_array:
-	case json_type_object:
-		return func(jobj_get_value(jobj, key), member_ptr);
-
-	case json_type_double:
-	case json_type_null:
-		ASSERT(0);
-		return failure;
-	}
-	return success;
-}
-
-status_t
-get_aud(jarr_t * jarr, void * member_ptr)
-{
-	char ** ptr = calloc(jarr_get_length(jarr)+1, sizeof(char*));
-	*((char ***)member_ptr) = ptr;
-
-	for (int k = 0; k < jarr_get_length(jarr); k++)
-	{
-		if (jarr_get_type(jarr, k) != json_type_string)
-		{
-			logger(LOG_TYPE_ERROR, "Introspect field 'aud' is malformed");
-			return failure;
-		}
-		ptr[k] = strdup(jarr_get_string(jarr, k));
-	}
-	return success;
-}
-
-status_t
-get_amr(jarr_t * jarr, void * member_ptr)
+static bool
+_decode_amr(jarr_t * jarr, const struct decode_field * field, void * member)
 {
-	struct amr * amr = (struct amr *)member_ptr;
+	struct amr * amr = member;
 
 	for (int k = 0; k < jarr_get_length(jarr); k++)
 	{
 		if (jarr_get_type(jarr, k) != json_type_string)
 		{
-			logger(LOG_TYPE_ERROR,
-			       "Introspect field 'identities_set' is malformed");
-			return failure;
+			logger(LOG_TYPE_ERROR, "'%s' is malformed", field->key);
+			return false;
 		}
 		const char * claim = jarr_get_string(jarr, k);
 		if (strcmp(claim, "mfa") == 0)
 			amr->mfa = true;
 	}
-	return success;
+	return true;
 }
 
-status_t
-get_identities_set(jarr_t * jarr, void * member_ptr)
-{
-	char ** ptr = calloc(jarr_get_length(jarr)+1, sizeof(char*));
-	*((char ***)member_ptr) = ptr;
+static const struct decode_field authentication_fields[] = {
+	// TODO: Not positive if this is required or optional
+	DECODE_CONTAINER(struct authentication, amr, array, DECODE_OPTIONAL, _decode_amr, NULL),
+	DECODE_VALUE(struct authentication, auth_time, int,    DECODE_REQUIRED),
+	DECODE_VALUE(struct authentication, idp,       string, DECODE_REQUIRED),
+};
 
-	for (int k = 0; k < jarr_get_length(jarr); k++)
-	{
-		if (jarr_get_type(jarr, k) != json_type_string)
-		{
-			logger(LOG_TYPE_ERROR,
-			       "Introspect field 'identities_set' is malformed");
-			return failure;
-		}
-		ptr[k] = strdup(jarr_get_string(jarr, k));
-	}
-	return success;
-}
+static const struct decoder authentication_decoder =
+	DECODER(struct authentication, WHAT, authentication_fields);
 
-status_t
-get_authentications(jobj_t * jobj, void * member_ptr)
+// Keyed by identity id rather than a list
+static bool
+_decode_authentications(jobj_t * jobj, const struct decode_field * field, void * member)
 {
-	struct authentication ** a = calloc(1, sizeof(*a));
+	struct authentication ** a = arena_calloc(json_object_object_length(jobj)+1, sizeof(*a));
+	*(struct authentication ***)member = a;
 
 	int cnt = 0;
 	json_object_object_foreach(jobj, k, v)
 	{
-		a = realloc(a, sizeof(*a) * (cnt+2));
-		a[cnt] = calloc(1, sizeof(**a));
-
-		a[cnt]->identity_id = strdup(k);
-		if (GET_VALUE(v, a[cnt], idp,       string, required) == failure ||
-		    GET_VALUE(v, a[cnt], auth_time, int,    required) == failure)
+		if (json_object_get_type(v) != json_type_object)
 		{
-			return failure;
+			logger(LOG_TYPE_ERROR, "'%s' is malformed", field->key);
+			return false;
 		}
 
-		// TODO: Not positive if this is required or optional
-		if (GET_CONTAINER(v, a[cnt], amr, array, optional)  == failure)
-			return failure;
+		a[cnt] = arena_calloc(1, sizeof(**a));
+		a[cnt]->identity_id = arena_strdup(k);
 
-		a[++cnt] = NULL;
+		if (!decode_object(v, &authentication_decoder, a[cnt++]))
+			return false;
 	}
-	*(struct authentication ***)member_ptr = a;
-	return success;
+	return true;
 }
 
-status_t
-get_session_info(jobj_t * jobj, void * member_ptr)
-{
-	struct session_info * s = calloc(1, sizeof(*s));
-	*(struct session_info **) member_ptr = s;
+static const struct decode_field session_info_fields[] = {
+	// TODO: not sure if this is required or optional
+	DECODE_CONTAINER(struct session_info, authentications, object, DECODE_OPTIONAL, _decode_authentications, NULL),
+	DECODE_VALUE(struct session_info, session_id, string, DECODE_REQUIRED),
+};
 
-	if (GET_VALUE(jobj, s, session_id, string, required) == failure)
-		return failure;
+static const struct decoder session_info_decoder =
+	DECODER(struct session_info, WHAT, session_info_fields);
 
-	// TODO: not sure if this is required or optional
-	return GET_CONTAINER(jobj, s, authentications, object, optional);
+static bool
+_decode_session_info(jobj_t * jobj, const struct decode_field * field, void * member)
+{
+	struct session_info * s = arena_calloc(1, sizeof(*s));
+	*(struct session_info **)member = s;
+	return decode_object(jobj, &session_info_decoder, s);
 }
 
+static const struct decode_field identity_set_detail_fields[] = {
+	DECODE_VALUE(struct identity_set_detail, identity_provider,              string, DECODE_REQUIRED),
+	DECODE_VALUE(struct identity_set_detail, identity_provider_display_name, string, DECODE_OPTIONAL),
+	DECODE_VALUE(struct identity_set_detail, status,                         string, DECODE_OPTIONAL),
+	DECODE_VALUE(struct identity_set_detail, sub,                            string, DECODE_REQUIRED),
+	DECODE_VALUE(struct identity_set_detail, username,                       string, DECODE_REQUIRED),
+};
+
+static const struct decoder identity_set_detail_decoder =
+	DECODER(struct identity_set_detail, WHAT, identity_set_detail_fields);
+
+static const struct decode_field introspect_fields[] = {
+	DECODE_VALUE(struct introspect, active, boolean, DECODE_GATE),
+	DECODE_CONTAINER(struct introspect, aud, array, DECODE_REQUIRED, decode_strings, NULL),
+	DECODE_VALUE(struct introspect, client_id, string, DECODE_REQUIRED),
+	DECODE_VALUE(struct introspect, email,     string, DECODE_REQUIRED),
+	DECODE_VALUE(struct introspect, exp,       int,    DECODE_REQUIRED),
+	DECODE_VALUE(struct introspect, iat,       int,    DECODE_REQUIRED),
+	DECODE_CONTAINER(struct introspect, identities_set,      array, DECODE_OPTIONAL, decode_strings, NULL),
+	DECODE_CONTAINER(struct introspect, identity_set_detail, array, DECODE_OPTIONAL, decode_records, &identity_set_detail_decoder),
+	DECODE_VALUE(struct introspect, iss,       string, DECODE_REQUIRED),
+	DECODE_VALUE(struct introspect, nbf,       int,    DECODE_REQUIRED),
+	DECODE_VALUE(struct introspect, scope,     string, DECODE_REQUIRED),
+	DECODE_CONTAINER(struct introspect, session_info, object, DECODE_OPTIONAL, _decode_session_info, NULL),
+	DECODE_VALUE(struct introspect, sub,       string, DECODE_REQUIRED),
+	DECODE_VALUE(struct introspect, username,  string, DECODE_REQUIRED),
+};
+
+static const struct decoder introspect_decoder =
+	DECODER(struct introspect, WHAT, introspect_fields);
+
 struct introspect *
 introspect_init(jobj_t * jobj)
 {
-	struct introspect * i = calloc(1, sizeof(struct introspect));
-	status_t status;
-
-	if ((status = GET_VALUE(jobj, i, active, boolean, required)) == failure)
-		goto cleanup;
-
-	if (i->active == false)
-		goto cleanup;
+	struct introspect * i = arena_calloc(1, sizeof(struct introspect));
 
-	if ((status = GET_VALUE(jobj, i, scope,     string, required)) == failure ||
-	    (status = GET_VALUE(jobj, i, client_id, string, required)) == failure ||
-	    (status = GET_VALUE(jobj, i, sub,       string, required)) == failure ||
-	    (status = GET_VALUE(jobj, i, username,  string, required)) == failure ||
-	    (status = GET_VALUE(jobj, i, iss,       string, required)) == failure ||
-	    (status = GET_VALUE(jobj, i, email,     string, required)) == failure ||
-	    (status = GET_VALUE(jobj, i, exp,       int,    required)) == failure ||
-	    (status = GET_VALUE(jobj, i, iat,       int,    required)) == failure ||
-	    (status = GET_VALUE(jobj, i, nbf,       int,    required)) == failure)
+	if (!decode_object(jobj, &introspect_decoder, i))
 	{
-		goto cleanup;
+		introspect_fini(i);
+		return NULL;
 	}
 
-	if ((status = GET_CONTAINER(jobj, i, aud,            array,  required)) == failure ||
-	    (status = GET_CONTAINER(jobj, i, identities_set, array,  optional)) == failure ||
-	    (status = GET_CONTAINER(jobj, i, session_info,   object, optional)) == failure)
+	// Inactive tokens have no other fields; ignore any that were sent
+	if (!i->active)
 	{
-		goto cleanup;
+		introspect_fini(i);
+		i = arena_calloc(1, sizeof(struct introspect));
 	}
-
-cleanup:
-	if (status == success)
-		return i;
-
-	introspect_fini(i);
-	return NULL;
-};
+	return i;
+}
 
 void
 introspect_fini(struct introspect * i)
 {
-	if (i)
+	// Released by arena_end()
+	if (i && !arena_owns(i))
 	{
 		free(i->scope);
 		free(i->client_id);
@@ -243,6 +161,17 @@ introspect_fini(struct introspect * i)
 		free_array(i->aud);
 		free_array(i->identities_set);
 
+		for (int j = 0; i->identity_set_detail && i->identity_set_detail[j]; j++)
+		{
+			free(i->identity_set_detail[j]->sub);
+			free(i->identity_set_detail[j]->username);
+			free(i->identity_set_detail[j]->identity_provider);
+			free(i->identity_set_detail[j]->identity_provider_display_name);
+			free(i->identity_set_detail[j]->status);
+			free(i->identity_set_detail[j]);
+		}
+		free(i->identity_set_detail);
+
 		if (i->session_info)
 		{
 			free(i->session_info->session_id);
@@ -38,7 +38,13 @@ struct introspect {
 	time_t  nbf;                        // Required
 	char *  email;                      // Required
 	char ** identities_set;             // Optional
-//	struct identity_set_detail **;      // Ignored
+	struct identity_set_detail {        // Optional
+		char * sub;                 // Required
+		char * username;            // Required
+		char * identity_provider;   // Required
+		char * identity_provider_display_name; // Optional
+		char * status;              // Optional
+	} ** identity_set_detail;
 	struct session_info {               // Optional
 		char * session_id;          // Required
 		struct authentication {
@@ -2,6 +2,7 @@
  * System includes.
  */
 #include <json-c/json.h>
+#include <stdlib.h>
 #include <string.h>
 
 /*
@@ -13,21 +14,54 @@
 
 jobj_t *
 jobj_init(const char * jstring, char ** error_msg)
+{
+	struct jparser * parser = jparser_init();
+	jparser_feed(parser, jstring, strlen(jstring));
+	return jparser_fini(parser, jstring, error_msg);
+}
+
+struct jparser {
+	struct json_tokener     * tokener;
+	struct json_object      * jobj;
+	enum json_tokener_error   jerr;
+};
+
+struct jparser *
+jparser_init()
+{
+	struct jparser * parser = calloc(1, sizeof(*parser));
+	parser->tokener = json_tokener_new();
+	parser->jerr    = json_tokener_continue;
+	return parser;
+}
+
+void
+jparser_feed(struct jparser * parser, const char * chunk, size_t length)
+{
+	// Like jobj_init(), anything after the first complete value is ignored
+	if (parser->jerr != json_tokener_continue)
+		return;
+
+	parser->jobj = json_tokener_parse_ex(parser->tokener, chunk, length);
+	parser->jerr = json_tokener_get_error(parser->tokener);
+}
+
+jobj_t *
+jparser_fini(struct jparser * parser, const char * jstring, char ** error_msg)
 {
 	if (error_msg) *error_msg = NULL;
 
-	struct json_object * jobj = NULL;
-	struct json_tokener * tokener = json_tokener_new();
-	jobj = json_tokener_parse_ex(tokener, jstring, strlen(jstring));
+	if (!parser)
+		return NULL;
 
-	enum json_tokener_error jerr;
-	jerr = json_tokener_get_error(tokener);
-	if (jerr != json_tokener_success && error_msg)
+	struct json_object * jobj = parser->jobj;
+	if (parser->jerr != json_tokener_success && error_msg)
 		*error_msg = sformat("Could not convert JSON string %s: %s",
-		                      jstring,
-		                      json_tokener_error_desc(jerr));
+		                      jstring ? jstring : "",
+		                      json_tokener_error_desc(parser->jerr));
 
-	json_tokener_free(tokener);
+	json_tokener_free(parser->tokener);
+	free(parser);
 	return jobj;
 }
 
@@ -27,6 +27,18 @@ jobj_t * jobj_init(const char * jstring, char ** error_msg);
 // destructor. call this only on json_init() returned values.
 void     jobj_fini(jobj_t *);
 
+/*
+ * Incremental parsing, for documents that arrive in pieces. Feed each piece
+ * to jparser_feed() as it arrives; jparser_fini() releases the parser and
+ * returns the document exactly as jobj_init() would have. 'jstring' is the
+ * whole document and is only used for error_msg. Both are optional.
+ */
+struct jparser;
+
+struct jparser * jparser_init();
+void             jparser_feed(struct jparser *, const char * chunk, size_t length);
+jobj_t *         jparser_fini(struct jparser *, const char * jstring, char ** error_msg);
+
 // Call this on the key prior to any 'get' routines.
 bool jobj_key_exists(jobj_t *, const char * key);
 
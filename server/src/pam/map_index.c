@@ -0,0 +1,366 @@
+/*
+ * System includes.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+/*
+ * Local includes.
+ */
+#include "map_index.h"
+#include "strings.h"
+#include "parser.h"
+#include "logger.h"
+#include "cache.h"
+#include "debug.h" // always last
+
+/*******************************************************************************
+ * Internal (Private) Functions
+ ******************************************************************************/
+
+#define MAP_INDEX_MAGIC   0x4f534d49 // 'OSMI'
+#define MAP_INDEX_VERSION 1
+
+/*
+ * Index layout. All offsets are in bytes from the start of the index, so 0
+ * (the header) doubles as 'none'.
+ *
+ *   struct map_index_header
+ *   uint32_t                buckets[nbuckets]  first entry in each bucket
+ *   struct map_index_entry  entries[nentries]
+ *   uint32_t                values[]           offsets of account strings
+ *   char                    strings[]          NUL-terminated keys / accounts
+ */
+struct map_index_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t length;
+
+	// The map file this index was compiled from
+	uint64_t src_dev;
+	uint64_t src_ino;
+	int64_t  src_size;
+	int64_t  src_mtime_sec;
+	int64_t  src_mtime_nsec;
+
+	uint32_t nbuckets;
+	uint32_t nentries;
+};
+
+struct map_index_entry {
+	uint32_t next;
+	uint32_t key;
+	uint32_t nvalues;
+	uint32_t values;
+};
+
+struct map_index {
+	char   * base;
+	size_t   length;
+	bool     mapped;
+};
+
+// FNV-1a
+static uint32_t
+_map_index_hash(const char * key)
+{
+	uint32_t hash = 2166136261u;
+	for (; *key; key++)
+	{
+		hash ^= (unsigned char)*key;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * Map files may live anywhere; name the index after a hash of the path.
+ */
+static char *
+_map_index_name(const char * path)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (; *path; path++)
+	{
+		hash ^= (unsigned char)*path;
+		hash *= 1099511628211ull;
+	}
+	return sformat("map-%016llx.idx", (unsigned long long)hash);
+}
+
+static bool
+_map_index_is_current(const struct map_index_header * header,
+                      size_t                          length,
+                      const struct stat             * st)
+{
+	return length >= sizeof(*header) &&
+	       header->magic          == MAP_INDEX_MAGIC &&
+	       header->version        == MAP_INDEX_VERSION &&
+	       header->length         == length &&
+	       header->nbuckets       >  0 &&
+	       header->src_dev        == st->st_dev &&
+	       header->src_ino        == st->st_ino &&
+	       header->src_size       == st->st_size &&
+	       header->src_mtime_sec  == st->st_mtim.tv_sec &&
+	       header->src_mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+static struct map_index *
+_map_index_load(const char * name, const struct stat * src_st)
+{
+	struct stat st;
+	int fd = cache_file_open(name, &st);
+	if (fd == -1)
+		return NULL;
+
+	struct map_index * index = NULL;
+	void * base = MAP_FAILED;
+
+	if (st.st_size >= sizeof(struct map_index_header))
+		base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED)
+		return NULL;
+
+	if (!_map_index_is_current(base, st.st_size, src_st))
+	{
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	index = calloc(1, sizeof(*index));
+	index->base   = base;
+	index->length = st.st_size;
+	index->mapped = true;
+	return index;
+}
+
+/*
+ * Keys are merged while the map file is read, mirroring what
+ * account_map_init() did when it scanned the file itself.
+ */
+struct build_entry {
+	char               *  key;
+	char               ** values;
+	struct build_entry *  next;
+};
+
+static uint32_t
+_map_index_copy(char * base, char ** pool, const char * string)
+{
+	uint32_t offset = *pool - base;
+	size_t length = strlen(string) + 1;
+	memcpy(*pool, string, length);
+	*pool += length;
+	return offset;
+}
+
+static struct map_index *
+_map_index_compile(const char * path, const struct stat * src_st)
+{
+	FILE * fptr = fopen(path, "r");
+	if (!fptr)
+		return NULL;
+
+	// Roughly one bucket per line
+	size_t nbuckets = src_st->st_size/64 + 1;
+	struct build_entry ** table = calloc(nbuckets, sizeof(*table));
+	struct map_index * index = NULL;
+
+	size_t nentries = 0;
+	size_t nvalues  = 0;
+	size_t nstrings = 0;
+
+	char * key = NULL;
+	char ** values = NULL;
+	while (read_next_pair(fptr, &key, &values))
+	{
+		struct build_entry ** bucket = &table[_map_index_hash(key) % nbuckets];
+		struct build_entry * entry = *bucket;
+		while (entry && strcmp(entry->key, key) != 0)
+			entry = entry->next;
+
+		if (!entry)
+		{
+			entry = calloc(1, sizeof(*entry));
+			entry->key  = key;
+			entry->next = *bucket;
+			*bucket = entry;
+			nentries++;
+			nstrings += strlen(key) + 1;
+			key = NULL;
+		}
+
+		for (int v = 0; values && values[v]; v++)
+		{
+			if (key_in_list(CONST(char *, entry->values), values[v]))
+				continue;
+			insert(&entry->values, values[v]);
+			nvalues++;
+			nstrings += strlen(values[v]) + 1;
+		}
+		free(key);
+		free_array(values);
+	}
+	fclose(fptr);
+
+	size_t length = sizeof(struct map_index_header) +
+	                nbuckets * sizeof(uint32_t) +
+	                nentries * sizeof(struct map_index_entry) +
+	                nvalues  * sizeof(uint32_t) +
+	                nstrings;
+
+	if (length > UINT32_MAX)
+	{
+		logger(LOG_TYPE_ERROR, "%s is too large to index", path);
+		goto cleanup;
+	}
+
+	char * base = calloc(length, sizeof(char));
+
+	struct map_index_header * header = (struct map_index_header *)base;
+	header->magic          = MAP_INDEX_MAGIC;
+	header->version        = MAP_INDEX_VERSION;
+	header->length         = length;
+	header->src_dev        = src_st->st_dev;
+	header->src_ino        = src_st->st_ino;
+	header->src_size       = src_st->st_size;
+	header->src_mtime_sec  = src_st->st_mtim.tv_sec;
+	header->src_mtime_nsec = src_st->st_mtim.tv_nsec;
+	header->nbuckets       = nbuckets;
+	header->nentries       = nentries;
+
+	uint32_t * buckets = (uint32_t *)(header + 1);
+	struct map_index_entry * entries = (struct map_index_entry *)(buckets + nbuckets);
+	uint32_t * offsets = (uint32_t *)(entries + nentries);
+	char * pool = (char *)(offsets + nvalues);
+
+	for (size_t b = 0; b < nbuckets; b++)
+	{
+		for (struct build_entry * entry = table[b]; entry; entry = entry->next)
+		{
+			struct map_index_entry * out = entries++;
+			out->next   = buckets[b];
+			out->key    = _map_index_copy(base, &pool, entry->key);
+			out->values = (char *)offsets - base;
+			buckets[b]  = (char *)out - base;
+
+			for (int v = 0; entry->values && entry->values[v]; v++)
+			{
+				*offsets++ = _map_index_copy(base, &pool, entry->values[v]);
+				out->nvalues++;
+			}
+		}
+	}
+
+	index = calloc(1, sizeof(*index));
+	index->base   = base;
+	index->length = length;
+	index->mapped = false;
+
+cleanup:
+	for (size_t b = 0; b < nbuckets; b++)
+	{
+		struct build_entry * entry;
+		while ((entry = table[b]))
+		{
+			table[b] = entry->next;
+			free(entry->key);
+			free_array(entry->values);
+			free(entry);
+		}
+	}
+	free(table);
+	return index;
+}
+
+/*******************************************************************************
+ * Public Functions
+ ******************************************************************************/
+
+struct map_index *
+map_index_open(const char * path)
+{
+	struct stat st;
+	if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+		return NULL;
+
+	char * name = _map_index_name(path);
+	struct map_index * index = _map_index_load(name, &st);
+	if (index)
+		goto cleanup;
+
+	// Only one login compiles the index; the others scan the map file until
+	// it is ready.
+	int lock = cache_file_trylock(name);
+	if (lock == -1)
+		goto cleanup;
+
+	// It may have been finished while we were checking
+	index = _map_index_load(name, &st);
+	if (!index)
+	{
+		logger(LOG_TYPE_INFO, "Compiling the index for %s", path);
+
+		index = _map_index_compile(path, &st);
+		if (index)
+			cache_file_store(name, index->base, index->length);
+	}
+	close(lock);
+
+cleanup:
+	free(name);
+	return index;
+}
+
+void
+map_index_close(struct map_index * index)
+{
+	if (!index)
+		return;
+
+	if (index->mapped)
+		munmap(index->base, index->length);
+	else
+		free(index->base);
+	free(index);
+}
+
+const struct map_index_entry *
+map_index_find(const struct map_index * index, const char * key)
+{
+	const struct map_index_header * header = (struct map_index_header *)index->base;
+	const uint32_t * buckets = (const uint32_t *)(header + 1);
+
+	uint32_t offset = buckets[_map_index_hash(key) % header->nbuckets];
+	while (offset)
+	{
+		const struct map_index_entry * entry =
+		    (const struct map_index_entry *)(index->base + offset);
+
+		if (strcmp(index->base + entry->key, key) == 0)
+			return entry;
+		offset = entry->next;
+	}
+	return NULL;
+}
+
+const char *
+map_index_value(const struct map_index       * index,
+                const struct map_index_entry * entry,
+                int                            n)
+{
+	if (n < 0 || n >= entry->nvalues)
+		return NULL;
+
+	const uint32_t * offsets = (const uint32_t *)(index->base + entry->values);
+	return index->base + offsets[n];
+}
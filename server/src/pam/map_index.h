@@ -0,0 +1,34 @@
+#ifndef _MAP_INDEX_H_
+#define _MAP_INDEX_H_
+
+/*
+ * Compiled form of a map_file. The first login after a map file changes
+ * parses it once and writes a hash table keyed on identity id / username to
+ * CACHE_DEFAULT_DIR. Later logins map that table and look up each linked
+ * identity directly instead of scanning every line of the map file.
+ *
+ * The index is rebuilt whenever the map file's device, inode, size or mtime
+ * no longer match the values recorded when it was compiled.
+ */
+struct map_index;
+struct map_index_entry;
+
+// Return the index for map file 'path', compiling it if it is missing or
+// stale. Returns NULL if an index is not available, in which case the caller
+// should read the map file directly.
+struct map_index *
+map_index_open(const char * path);
+
+void
+map_index_close(struct map_index *);
+
+// Return the entry for 'key' or NULL if the map file does not mention it.
+const struct map_index_entry *
+map_index_find(const struct map_index *, const char * key);
+
+// Return the n-th account mapped by 'entry' or NULL past the last one. The
+// string remains valid until map_index_close().
+const char *
+map_index_value(const struct map_index *, const struct map_index_entry *, int n);
+
+#endif /* _MAP_INDEX_H_ */
@@ -0,0 +1,260 @@
+/*
+ * System includes.
+ */
+#include <security/pam_appl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*
+ * Local includes.
+ */
+#include "metrics.h"
+#include "logger.h"
+#include "debug.h" // always last
+
+/*******************************************************************************
+ * Internal (Private) Functions
+ ******************************************************************************/
+
+#define METRICS_MAGIC   0x4f53484d // 'OSHM'
+#define METRICS_VERSION 3
+
+struct metrics_segment {
+	uint32_t       magic;
+	uint32_t       version;
+	struct metrics metrics;
+};
+
+static pthread_once_t           metrics_once    = PTHREAD_ONCE_INIT;
+static struct metrics_segment * metrics_segment = NULL;
+
+static const struct {
+	const char * name;
+	const char * labels;
+} counter_names[METRIC_COUNTER_COUNT] = {
+	[METRIC_STATUS_SUCCESS]          = {"oauth_ssh_logins_total", "status=\"success\""},
+	[METRIC_STATUS_AUTH_ERR]         = {"oauth_ssh_logins_total", "status=\"auth_err\""},
+	[METRIC_STATUS_AUTHINFO_UNAVAIL] = {"oauth_ssh_logins_total", "status=\"authinfo_unavail\""},
+	[METRIC_STATUS_MAXTRIES]         = {"oauth_ssh_logins_total", "status=\"maxtries\""},
+	[METRIC_STATUS_OTHER]            = {"oauth_ssh_logins_total", "status=\"other\""},
+
+	[METRIC_OP_LOGIN]               = {"oauth_ssh_commands_total", "op=\"login\""},
+	[METRIC_OP_GET_SECURITY_POLICY] = {"oauth_ssh_commands_total", "op=\"get_security_policy\""},
+	[METRIC_OP_GET_ACCOUNT_MAP]     = {"oauth_ssh_commands_total", "op=\"get_account_map\""},
+	[METRIC_OP_RESOLVE_AND_LOGIN]   = {"oauth_ssh_commands_total", "op=\"resolve_and_login\""},
+	[METRIC_OP_PASTED_TOKEN]        = {"oauth_ssh_commands_total", "op=\"pasted_token\""},
+	[METRIC_OP_UNKNOWN]             = {"oauth_ssh_commands_total", "op=\"unknown\""},
+
+	[METRIC_UPSTREAM_REQUESTS] = {"oauth_ssh_upstream_requests_total", ""},
+	[METRIC_UPSTREAM_ERRORS]   = {"oauth_ssh_upstream_errors_total",   ""},
+
+	[METRIC_CACHE_INTROSPECT_HIT]  = {"oauth_ssh_cache_lookups_total", "resource=\"introspect\",result=\"hit\""},
+	[METRIC_CACHE_INTROSPECT_MISS] = {"oauth_ssh_cache_lookups_total", "resource=\"introspect\",result=\"miss\""},
+	[METRIC_CACHE_CLIENT_HIT]      = {"oauth_ssh_cache_lookups_total", "resource=\"client\",result=\"hit\""},
+	[METRIC_CACHE_CLIENT_MISS]     = {"oauth_ssh_cache_lookups_total", "resource=\"client\",result=\"miss\""},
+	[METRIC_CACHE_IDENTITIES_HIT]  = {"oauth_ssh_cache_lookups_total", "resource=\"identities\",result=\"hit\""},
+	[METRIC_CACHE_IDENTITIES_MISS] = {"oauth_ssh_cache_lookups_total", "resource=\"identities\",result=\"miss\""},
+	[METRIC_CACHE_PASSWD_HIT]      = {"oauth_ssh_cache_lookups_total", "resource=\"passwd\",result=\"hit\""},
+	[METRIC_CACHE_PASSWD_MISS]     = {"oauth_ssh_cache_lookups_total", "resource=\"passwd\",result=\"miss\""},
+};
+
+static const char * histogram_names[METRIC_HISTOGRAM_COUNT] = {
+	[METRIC_LOGIN_SECONDS]    = "oauth_ssh_login_duration_seconds",
+	[METRIC_COMMAND_SECONDS]  = "oauth_ssh_command_duration_seconds",
+	[METRIC_UPSTREAM_SECONDS] = "oauth_ssh_upstream_duration_seconds",
+};
+
+/*
+ * Map METRICS_DEFAULT_FILE, creating it if necessary. Same rules as the cache
+ * segment: it must be a private regular file owned by us.
+ */
+static struct metrics_segment *
+_metrics_map(int flags)
+{
+	int fd = open(METRICS_DEFAULT_FILE,
+	              flags|O_NOFOLLOW|O_CLOEXEC,
+	              S_IRUSR|S_IWUSR);
+	if (fd == -1)
+	{
+		logger(LOG_TYPE_DEBUG, "Could not open %s: %m", METRICS_DEFAULT_FILE);
+		return NULL;
+	}
+
+	struct metrics_segment * segment = NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 ||
+	    !S_ISREG(st.st_mode) ||
+	    st.st_uid != geteuid() ||
+	    (st.st_mode & (S_IRWXG|S_IRWXO)))
+	{
+		logger(LOG_TYPE_ERROR,
+		       "Ignoring %s: not a private regular file",
+		       METRICS_DEFAULT_FILE);
+		goto cleanup;
+	}
+
+	flock(fd, LOCK_EX);
+
+	// Only ever grow the file; shrinking it would fault other mappings.
+	if (st.st_size < sizeof(struct metrics_segment) &&
+	    ((flags & O_ACCMODE) == O_RDONLY ||
+	     ftruncate(fd, sizeof(struct metrics_segment)) == -1))
+	{
+		goto unlock;
+	}
+
+	segment = mmap(NULL,
+	               sizeof(struct metrics_segment),
+	               (flags & O_ACCMODE) == O_RDONLY ? PROT_READ : PROT_READ|PROT_WRITE,
+	               MAP_SHARED,
+	               fd,
+	               0);
+	if (segment == MAP_FAILED)
+	{
+		logger(LOG_TYPE_ERROR, "Could not map %s: %m", METRICS_DEFAULT_FILE);
+		segment = NULL;
+		goto unlock;
+	}
+
+	if (segment->magic != METRICS_MAGIC || segment->version != METRICS_VERSION)
+	{
+		if ((flags & O_ACCMODE) == O_RDONLY)
+		{
+			munmap(segment, sizeof(struct metrics_segment));
+			segment = NULL;
+			goto unlock;
+		}
+
+		memset(segment, 0, sizeof(*segment));
+		segment->magic   = METRICS_MAGIC;
+		segment->version = METRICS_VERSION;
+	}
+
+unlock:
+	flock(fd, LOCK_UN);
+cleanup:
+	close(fd);
+	return segment;
+}
+
+static void
+_metrics_open()
+{
+	metrics_segment = _metrics_map(O_RDWR|O_CREAT);
+}
+
+static struct metrics *
+_metrics()
+{
+	pthread_once(&metrics_once, _metrics_open);
+	return metrics_segment ? &metrics_segment->metrics : NULL;
+}
+
+static void
+_metrics_add(uint64_t * value, uint64_t amount)
+{
+	__atomic_fetch_add(value, amount, __ATOMIC_RELAXED);
+}
+
+static uint64_t
+_metrics_load(const uint64_t * value)
+{
+	return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * Public Functions
+ ******************************************************************************/
+
+void
+metrics_count(metric_counter_t counter)
+{
+	struct metrics * metrics = _metrics();
+	if (metrics)
+		_metrics_add(&metrics->counters[counter], 1);
+}
+
+void
+metrics_observe(metric_histogram_t histogram, double seconds)
+{
+	struct metrics * metrics = _metrics();
+	if (!metrics)
+		return;
+
+	uint64_t usec = seconds > 0 ? (uint64_t)(seconds * 1000000) : 0;
+
+	int bucket = 0;
+	while (bucket < METRICS_BUCKETS-1 && usec >= (1ull << bucket))
+		bucket++;
+
+	struct metrics_histogram * h = &metrics->histograms[histogram];
+	_metrics_add(&h->buckets[bucket], 1);
+	_metrics_add(&h->sum_usec, usec);
+}
+
+metric_counter_t
+metrics_status(int pam_status)
+{
+	switch (pam_status)
+	{
+	case PAM_SUCCESS:
+		return METRIC_STATUS_SUCCESS;
+	case PAM_AUTH_ERR:
+		return METRIC_STATUS_AUTH_ERR;
+	case PAM_AUTHINFO_UNAVAIL:
+		return METRIC_STATUS_AUTHINFO_UNAVAIL;
+	case PAM_MAXTRIES:
+		return METRIC_STATUS_MAXTRIES;
+	}
+	return METRIC_STATUS_OTHER;
+}
+
+bool
+metrics_read(struct metrics * metrics)
+{
+	struct metrics_segment * segment = _metrics_map(O_RDONLY);
+	if (!segment)
+		return false;
+
+	const struct metrics * shared = &segment->metrics;
+
+	for (int c = 0; c < METRIC_COUNTER_COUNT; c++)
+		metrics->counters[c] = _metrics_load(&shared->counters[c]);
+
+	for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++)
+	{
+		metrics->histograms[h].sum_usec = _metrics_load(&shared->histograms[h].sum_usec);
+		for (int b = 0; b < METRICS_BUCKETS; b++)
+			metrics->histograms[h].buckets[b] = _metrics_load(&shared->histograms[h].buckets[b]);
+	}
+
+	munmap(segment, sizeof(*segment));
+	return true;
+}
+
+const char *
+metrics_counter_name(metric_counter_t counter)
+{
+	return counter_names[counter].name;
+}
+
+const char *
+metrics_counter_labels(metric_counter_t counter)
+{
+	return counter_names[counter].labels;
+}
+
+const char *
+metrics_histogram_name(metric_histogram_t histogram)
+{
+	return histogram_names[histogram];
+}
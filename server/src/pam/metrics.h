@@ -0,0 +1,107 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Process-wide metrics shared by every sshd child and oauth-ssh-helperd.
+ * Counters and histograms live in a file mapped by every process and are
+ * updated with atomic adds, so logins never wait on each other to record
+ * them. oauth-ssh-stats reads the segment.
+ *
+ * Like the cache, metrics are best effort; if the segment cannot be mapped,
+ * updates are dropped.
+ */
+#define METRICS_DEFAULT_FILE "/dev/shm/oauth_ssh_metrics"
+
+// The segment layout follows this enum; bump METRICS_VERSION in metrics.c
+// whenever it changes so that existing segments are reset.
+typedef enum {
+	// pam_sm_authenticate() results
+	METRIC_STATUS_SUCCESS,
+	METRIC_STATUS_AUTH_ERR,
+	METRIC_STATUS_AUTHINFO_UNAVAIL,
+	METRIC_STATUS_MAXTRIES, // replies to commands other than 'login'
+	METRIC_STATUS_OTHER,
+
+	// Commands processed, by the module or oauth-ssh-helperd
+	METRIC_OP_LOGIN,
+	METRIC_OP_GET_SECURITY_POLICY,
+	METRIC_OP_GET_ACCOUNT_MAP,
+	METRIC_OP_RESOLVE_AND_LOGIN,
+	METRIC_OP_PASTED_TOKEN,
+	METRIC_OP_UNKNOWN,
+
+	// Requests to Globus Auth
+	METRIC_UPSTREAM_REQUESTS,
+	METRIC_UPSTREAM_ERRORS,
+
+	// Replies found in the caches (or shared by a concurrent login) vs fetched
+	METRIC_CACHE_INTROSPECT_HIT,
+	METRIC_CACHE_INTROSPECT_MISS,
+	METRIC_CACHE_CLIENT_HIT,
+	METRIC_CACHE_CLIENT_MISS,
+	METRIC_CACHE_IDENTITIES_HIT,
+	METRIC_CACHE_IDENTITIES_MISS,
+	METRIC_CACHE_PASSWD_HIT,
+	METRIC_CACHE_PASSWD_MISS,
+
+	METRIC_COUNTER_COUNT,
+} metric_counter_t;
+
+typedef enum {
+	METRIC_LOGIN_SECONDS,    // pam_sm_authenticate()
+	METRIC_COMMAND_SECONDS,  // process_command()
+	METRIC_UPSTREAM_SECONDS, // each request to Globus Auth
+	METRIC_HISTOGRAM_COUNT,
+} metric_histogram_t;
+
+/*
+ * Histogram bucket 'b' counts observations under 2^b microseconds; the last
+ * bucket also takes everything larger.
+ */
+#define METRICS_BUCKETS 25 // 2^24us ~= 16.8s
+
+// The number of observations is the sum of the buckets.
+struct metrics_histogram {
+	uint64_t sum_usec;
+	uint64_t buckets[METRICS_BUCKETS];
+};
+
+struct metrics {
+	uint64_t                 counters[METRIC_COUNTER_COUNT];
+	struct metrics_histogram histograms[METRIC_HISTOGRAM_COUNT];
+};
+
+void
+metrics_count(metric_counter_t);
+
+void
+metrics_observe(metric_histogram_t, double seconds);
+
+// Map a PAM result onto its METRIC_STATUS_* counter.
+metric_counter_t
+metrics_status(int pam_status);
+
+// Copy the current values into 'metrics'. Returns false if there are none.
+bool
+metrics_read(struct metrics * metrics);
+
+/*
+ * Prometheus names for oauth-ssh-stats. Counters with the same name differ by
+ * their labels, ie. 'status="success"'.
+ */
+const char *
+metrics_counter_name(metric_counter_t);
+
+const char *
+metrics_counter_labels(metric_counter_t);
+
+const char *
+metrics_histogram_name(metric_histogram_t);
+
+#endif /* _METRICS_H_ */
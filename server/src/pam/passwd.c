@@ -0,0 +1,173 @@
+/*
+ * System includes.
+ */
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pwd.h>
+
+/*
+ * Local includes.
+ */
+#include "passwd.h"
+#include "metrics.h"
+#include "logger.h"
+#include "timing.h"
+#include "cache.h"
+#include "debug.h" // always last
+
+/*******************************************************************************
+ * Internal (Private) Functions
+ ******************************************************************************/
+
+// Upper bound on passwd_lookup_threads
+#define PASSWD_MAX_THREADS 16
+
+// getpwnam_r() buffer; doubled on ERANGE up to PASSWD_MAX_BUFFER
+#define PASSWD_BUFFER     (16*1024)
+#define PASSWD_MAX_BUFFER (1024*1024)
+
+typedef enum {
+	ACCT_ABSENT,
+	ACCT_EXISTS,
+	ACCT_ERROR, // the name service did not answer, ie. LDAP is unreachable
+} acct_state_t;
+
+struct lookup {
+	const char * const * accts;
+	acct_state_t       * states;
+	int                * pending; // indexes into 'accts'
+	int                  count;   // of 'pending'
+	int                  next;    // next entry of 'pending' to look up
+};
+
+static acct_state_t
+_acct_state(const char * acct)
+{
+	// Each lookup thread needs its own buffer
+	struct passwd   pwd;
+	struct passwd * result = NULL;
+	char          * buffer = NULL;
+	size_t          size   = PASSWD_BUFFER;
+	int             rc;
+
+	do
+	{
+		char * tmp = realloc(buffer, size);
+		if (!tmp)
+		{
+			rc = ENOMEM;
+			break;
+		}
+		buffer = tmp;
+
+		rc = getpwnam_r(acct, &pwd, buffer, size, &result);
+		size *= 2;
+	} while (rc == ERANGE && size <= PASSWD_MAX_BUFFER);
+
+	free(buffer);
+
+	if (rc != 0)
+	{
+		errno = rc;
+		logger(LOG_TYPE_ERROR, "Could not look up local account %s: %m", acct);
+		return ACCT_ERROR;
+	}
+	return result ? ACCT_EXISTS : ACCT_ABSENT;
+}
+
+static void *
+_lookup_thread(void * arg)
+{
+	struct lookup * lookup = arg;
+	int n;
+
+	while ((n = __atomic_fetch_add(&lookup->next, 1, __ATOMIC_RELAXED)) < lookup->count)
+	{
+		int i = lookup->pending[n];
+		lookup->states[i] = _acct_state(lookup->accts[i]);
+	}
+	return NULL;
+}
+
+// Look up each pending account, in parallel if allowed
+static void
+_lookup_pending(const struct config * config, struct lookup * lookup)
+{
+	int nthreads = config->passwd_lookup_threads;
+	if (nthreads > PASSWD_MAX_THREADS)
+		nthreads = PASSWD_MAX_THREADS;
+	if (nthreads > lookup->count)
+		nthreads = lookup->count;
+
+	// This thread is one of them
+	pthread_t threads[PASSWD_MAX_THREADS];
+	int started = 0;
+	for (; started < nthreads - 1; started++)
+	{
+		if (pthread_create(&threads[started], NULL, _lookup_thread, lookup) != 0)
+			break;
+	}
+
+	_lookup_thread(lookup);
+
+	for (int t = 0; t < started; t++)
+		pthread_join(threads[t], NULL);
+}
+
+/*******************************************************************************
+ * Public Functions
+ ******************************************************************************/
+
+void
+passwd_lookup(const struct config * config,
+              const char * const  * accts,
+              int                   count,
+              bool                * exists)
+{
+	struct lookup lookup = {
+		.accts   = accts,
+		.states  = calloc(count, sizeof(acct_state_t)),
+		.pending = calloc(count, sizeof(int)),
+	};
+
+	timing_start(TIMING_GETPWNAM);
+
+	for (int i = 0; i < count; i++)
+	{
+		char * cached = NULL;
+		if (config->passwd_cache_ttl > 0)
+		{
+			cached = cache_get("passwd", accts[i]);
+			metrics_count(cached ? METRIC_CACHE_PASSWD_HIT : METRIC_CACHE_PASSWD_MISS);
+		}
+
+		if (cached)
+			exists[i] = (strcmp(cached, "1") == 0);
+		else
+			lookup.pending[lookup.count++] = i;
+		free(cached);
+	}
+
+	if (lookup.count)
+		_lookup_pending(config, &lookup);
+
+	time_t expires = time(NULL) + config->passwd_cache_ttl;
+	for (int n = 0; n < lookup.count; n++)
+	{
+		int i = lookup.pending[n];
+		exists[i] = (lookup.states[i] == ACCT_EXISTS);
+
+		// Only remember real answers; errors are retried on the next login
+		if (config->passwd_cache_ttl > 0 && lookup.states[i] != ACCT_ERROR)
+			cache_put("passwd", accts[i], exists[i] ? "1" : "0", expires);
+	}
+
+	timing_stop(TIMING_GETPWNAM);
+	free(lookup.states);
+	free(lookup.pending);
+}
@@ -0,0 +1,31 @@
+#ifndef _PASSWD_H_
+#define _PASSWD_H_
+
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+
+/*
+ * Local includes.
+ */
+#include "config.h"
+
+/*
+ * Local account checks for get_account_map. Each answer, positive or
+ * negative, is kept in the shared cache for passwd_cache_ttl seconds so that
+ * repeated logins do not wait on a slow name service (ie. SSSD backed by
+ * LDAP). Accounts that are not cached are looked up from up to
+ * passwd_lookup_threads threads at once.
+ */
+
+// Set exists[i] if accts[i] is in the passwd database, for each of the
+// 'count' accounts. Accounts the name service fails to answer for are treated
+// as missing for this call but are not cached.
+void
+passwd_lookup(const struct config * config,
+              const char * const  * accts,
+              int                   count,
+              bool                * exists);
+
+#endif /* _PASSWD_H_ */
@@ -0,0 +1,195 @@
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Local includes.
+ */
+#include "commands.h"
+#include "strings.h"
+#include "policy.h"
+#include "base64.h"
+#include "config.h"
+#include "hash.h"
+#include "debug.h" // always last
+
+/*******************************************************************************
+ * Internal (Private) Functions
+ ******************************************************************************/
+
+/*
+ * Protocol features and the client version that may use them. Each is
+ * advertised in the reply to get_security_policy so that clients can pick the
+ * fastest flow that both sides support.
+ */
+static const struct capability {
+	const char * name;
+	int          version;
+} capabilities[] = {
+	{"multi_command",     2}, // more commands after a reply; see pam_sm_authenticate()
+	{"resolve_and_login", 2},
+};
+
+#define CAPABILITY_COUNT (sizeof(capabilities)/sizeof(*capabilities))
+
+// Append '"string"' to a comma-separated list
+static void
+_append_json_string(char ** list, const char * string)
+{
+	if (*list)
+		append(list, ", ");
+	append(list, "\"");
+	append(list, string);
+	append(list, "\"");
+}
+
+static char *
+_build_etag(const char * members)
+{
+	return sformat("%08x-%zx", hash_string(members), strlen(members));
+}
+
+// ie. {"permitted_idps": [...], "authentication_timeout": 60}
+static char *
+_build_policy_json(const struct config * config)
+{
+	char * idp_list = NULL;
+	for (int i = 0; config->permitted_idps && config->permitted_idps[i]; i++)
+		_append_json_string(&idp_list, config->permitted_idps[i]);
+
+	char * sidps = sformat("%s%s%s", idp_list?"[":"",
+	                                 idp_list?idp_list:"null",
+	                                 idp_list?"]":"");
+	char * stmp = sformat("%d", config->authentication_timeout);
+	char * stimeout = sformat("%s", config->authentication_timeout?stmp:"null");
+	char * pformat = "{"
+	                     "\"permitted_idps\": %s,"
+	                     "\"authentication_timeout\": %s"
+	                 "}";
+
+	char * policy = sformat(pformat, sidps, stimeout);
+
+	free(idp_list);
+	free(sidps);
+	free(stmp);
+	free(stimeout);
+	return policy;
+}
+
+/*******************************************************************************
+ * Public Functions
+ ******************************************************************************/
+
+struct policy *
+policy_init(const struct config * config)
+{
+	char * names   = NULL;
+	char * members = NULL;
+	char * reply   = NULL;
+	char * not_modified = NULL;
+
+	struct policy * policy = calloc(1, sizeof(*policy));
+	if (!policy)
+		goto cleanup;
+
+	for (int i = 0; i < CAPABILITY_COUNT; i++)
+		_append_json_string(&names, capabilities[i].name);
+
+	policy->json = _build_policy_json(config);
+	if (!policy->json)
+		goto cleanup;
+
+	char * format = "\"policy\": %s,"
+	                "\"version\": %d,"
+	                "\"capabilities\": [%s]";
+
+	members = sformat(format, policy->json, PROTOCOL_VERSION, names ? names : "");
+	if (!members)
+		goto cleanup;
+
+	policy->etag = _build_etag(members);
+	reply = policy_cacheable_reply(members, config->policy_max_age, NULL);
+	not_modified = policy_cacheable_reply(members,
+	                                      config->policy_max_age,
+	                                      policy->etag);
+	if (!policy->etag || !reply || !not_modified)
+		goto cleanup;
+
+	policy->reply = base64_encode(reply);
+	policy->not_modified = base64_encode(not_modified);
+
+cleanup:
+	if (policy && (!policy->reply || !policy->not_modified))
+	{
+		policy_fini(policy);
+		policy = NULL;
+	}
+	free(names);
+	free(members);
+	free(reply);
+	free(not_modified);
+	return policy;
+}
+
+void
+policy_fini(struct policy * policy)
+{
+	if (policy)
+	{
+		free(policy->json);
+		free(policy->etag);
+		free(policy->reply);
+		free(policy->not_modified);
+	}
+	free(policy);
+}
+
+const char *
+policy_reply(const struct policy * policy, const char * etag)
+{
+	if (etag && strcmp(etag, policy->etag) == 0)
+		return policy->not_modified;
+	return policy->reply;
+}
+
+bool
+policy_is_capable(const char * name, int version)
+{
+	for (int i = 0; i < CAPABILITY_COUNT; i++)
+	{
+		if (strcmp(capabilities[i].name, name) == 0)
+			return version >= capabilities[i].version;
+	}
+	return false;
+}
+
+char *
+policy_cacheable_reply(const char * members, int max_age, const char * etag)
+{
+	char * current = _build_etag(members);
+	char * reply   = NULL;
+
+	if (etag && strcmp(etag, current) == 0)
+		reply = sformat("{"
+		                    "\"not_modified\": true,"
+		                    "\"max_age\": %d,"
+		                    "\"etag\": \"%s\""
+		                "}",
+		                max_age,
+		                current);
+	else
+		reply = sformat("{"
+		                    "%s,"
+		                    "\"max_age\": %d,"
+		                    "\"etag\": \"%s\""
+		                "}",
+		                members,
+		                max_age,
+		                current);
+
+	free(current);
+	return reply;
+}
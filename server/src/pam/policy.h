@@ -0,0 +1,50 @@
+#ifndef _POLICY_H_
+#define _POLICY_H_
+
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+
+/*
+ * Local includes.
+ */
+#include "config.h"
+
+/*
+ * The reply to get_security_policy depends only on the config, so it is built
+ * and base64-encoded once each time the config is loaded. Policy probes, the
+ * most frequent command, then only copy it.
+ */
+struct policy {
+	char * json;         // the policy itself, ie. {"permitted_idps": [...], ...}
+	char * etag;
+	char * reply;        // base64-encoded
+	char * not_modified; // base64-encoded reply for clients that hold 'etag'
+};
+
+// Returns NULL if memory is exhausted.
+struct policy *
+policy_init(const struct config * config);
+
+void
+policy_fini(struct policy * policy);
+
+// The base64-encoded reply for a client that sent 'etag', if any.
+const char *
+policy_reply(const struct policy * policy, const char * etag);
+
+// Can a client speaking protocol 'version' use capability 'name'?
+bool
+policy_is_capable(const char * name, int version);
+
+/*
+ * Clients may reuse a reply for 'max_age' seconds and then revalidate it by
+ * sending the reply's etag with the same command. 'members' is the body of the
+ * reply without its braces. If 'etag' still matches, the reply omits it.
+ * Used for any command whose reply clients may cache, ie. get_account_map.
+ */
+char *
+policy_cacheable_reply(const char * members, int max_age, const char * etag);
+
+#endif /* _POLICY_H_ */
@@ -0,0 +1,41 @@
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+/*
+ * USDT probes for tracing logins in production without the 'debug' PAM
+ * argument. Each probe is a single nop until a tracer attaches to it, ie.
+ *
+ *   # bpftrace -l 'usdt:/usr/lib64/security/pam_oauth_ssh.so:*'
+ *   # bpftrace -e 'usdt:/usr/lib64/security/pam_oauth_ssh.so:oauth_ssh:request__done
+ *                  { @usec[str(arg0)] = hist(arg1); }'
+ *
+ * oauth-ssh-helperd contains the same probes. String arguments are
+ * NUL-terminated char pointers.
+ *
+ *   command        (op)                        command dispatch
+ *   request__start (kind)                      before each request to Globus Auth
+ *   request__done  (kind, usec, curl_code)     after it completes
+ *   account__map   (requested_user, permitted) account map lookup
+ *   session__policy(permitted)                 session policy evaluation
+ *   status         (pam_status, usec)          final PAM result and login time
+ *
+ * 'kind' is one of "introspect", "clients", "identities" or "other".
+ *
+ * Without <sys/sdt.h> (systemtap-sdt-devel) the probes compile to nothing.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)       DTRACE_PROBE1(oauth_ssh, name, a)
+#define PROBE2(name, a, b)    DTRACE_PROBE2(oauth_ssh, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(oauth_ssh, name, a, b, c)
+
+#else
+
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#define PROBE3(name, a, b, c)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* _PROBES_H_ */
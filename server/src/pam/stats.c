@@ -0,0 +1,194 @@
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+/*
+ * Local includes.
+ */
+#include "metrics.h"
+#include "strings.h"
+#include "debug.h" // always last
+
+/*
+ * oauth-ssh-stats: prints the counters and histograms that the PAM module and
+ * oauth-ssh-helperd keep in METRICS_DEFAULT_FILE. See metrics.h.
+ *
+ * Usage: oauth-ssh-stats [-p] [-o file]
+ *   -p       Prometheus text format
+ *   -o file  write to 'file' atomically (ie. for node_exporter's textfile
+ *            collector) instead of stdout
+ */
+
+static uint64_t
+_histogram_count(const struct metrics_histogram * h)
+{
+	uint64_t count = 0;
+	for (int b = 0; b < METRICS_BUCKETS; b++)
+		count += h->buckets[b];
+	return count;
+}
+
+// Upper bound of the bucket holding quantile 'q', in seconds
+static double
+_histogram_quantile(const struct metrics_histogram * h, double q)
+{
+	uint64_t count = _histogram_count(h);
+	uint64_t rank  = (uint64_t)(q * count);
+	uint64_t seen  = 0;
+
+	for (int b = 0; b < METRICS_BUCKETS; b++)
+	{
+		seen += h->buckets[b];
+		if (seen > rank)
+			return (double)(1ull << b) / 1000000;
+	}
+	return 0;
+}
+
+static void
+_print_text(FILE * out, const struct metrics * metrics)
+{
+	for (int c = 0; c < METRIC_COUNTER_COUNT; c++)
+	{
+		const char * labels = metrics_counter_labels(c);
+		fprintf(out, "%s%s%s%s %llu\n",
+		        metrics_counter_name(c),
+		        labels[0] ? "{" : "",
+		        labels,
+		        labels[0] ? "}" : "",
+		        (unsigned long long)metrics->counters[c]);
+	}
+
+	for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++)
+	{
+		const struct metrics_histogram * h = &metrics->histograms[i];
+		uint64_t count = _histogram_count(h);
+
+		fprintf(out, "%s count=%llu mean=%.6f p50<=%.6f p99<=%.6f p999<=%.6f\n",
+		        metrics_histogram_name(i),
+		        (unsigned long long)count,
+		        count ? (double)h->sum_usec / count / 1000000 : 0,
+		        _histogram_quantile(h, 0.50),
+		        _histogram_quantile(h, 0.99),
+		        _histogram_quantile(h, 0.999));
+	}
+}
+
+static void
+_print_prometheus(FILE * out, const struct metrics * metrics)
+{
+	const char * previous = NULL;
+
+	for (int c = 0; c < METRIC_COUNTER_COUNT; c++)
+	{
+		const char * name   = metrics_counter_name(c);
+		const char * labels = metrics_counter_labels(c);
+
+		if (!previous || strcmp(previous, name) != 0)
+			fprintf(out, "# TYPE %s counter\n", name);
+		previous = name;
+
+		fprintf(out, "%s%s%s%s %llu\n",
+		        name,
+		        labels[0] ? "{" : "",
+		        labels,
+		        labels[0] ? "}" : "",
+		        (unsigned long long)metrics->counters[c]);
+	}
+
+	for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++)
+	{
+		const char * name = metrics_histogram_name(i);
+		const struct metrics_histogram * h = &metrics->histograms[i];
+
+		fprintf(out, "# TYPE %s histogram\n", name);
+
+		uint64_t cumulative = 0;
+		for (int b = 0; b < METRICS_BUCKETS-1; b++)
+		{
+			cumulative += h->buckets[b];
+			fprintf(out, "%s_bucket{le=\"%g\"} %llu\n",
+			        name,
+			        (double)(1ull << b) / 1000000,
+			        (unsigned long long)cumulative);
+		}
+		cumulative += h->buckets[METRICS_BUCKETS-1];
+
+		fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+		fprintf(out, "%s_sum %.6f\n", name, (double)h->sum_usec / 1000000);
+		fprintf(out, "%s_count %llu\n", name, (unsigned long long)cumulative);
+	}
+}
+
+int
+main(int argc, char * argv[])
+{
+	bool         prometheus = false;
+	const char * path       = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "po:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p':
+			prometheus = true;
+			break;
+		case 'o':
+			path = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-p] [-o file]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	struct metrics metrics;
+	memset(&metrics, 0, sizeof(metrics));
+
+	// Nothing has logged in yet
+	if (!metrics_read(&metrics) && access(METRICS_DEFAULT_FILE, F_OK) == 0)
+	{
+		fprintf(stderr, "Could not read %s\n", METRICS_DEFAULT_FILE);
+		return 1;
+	}
+
+	FILE * out = stdout;
+	char * tmp_path = NULL;
+
+	// Readers of 'path' must never see a partial file
+	if (path)
+	{
+		tmp_path = sformat("%s.%d", path, (int)getpid());
+		out = fopen(tmp_path, "w");
+		if (!out)
+		{
+			perror(tmp_path);
+			free(tmp_path);
+			return 1;
+		}
+	}
+
+	if (prometheus)
+		_print_prometheus(out, &metrics);
+	else
+		_print_text(out, &metrics);
+
+	int rc = 0;
+	if (path)
+	{
+		if (fclose(out) != 0 || rename(tmp_path, path) == -1)
+		{
+			perror(path);
+			unlink(tmp_path);
+			rc = 1;
+		}
+		free(tmp_path);
+	}
+	return rc;
+}
@@ -123,11 +123,12 @@ test_suffix_match_globusid(void ** state)
 	struct config config = {.idp_suffix = "globusid.org", .map_files = NULL};
 	struct account_map * map = account_map_init(&config, &identities);
 
-	assert_string_equal(map->username, "jane@globusid.org");
-	assert_string_equal(map->id, "e9873f94-032a-11e6-afde-cb613ccc97a9");
-	assert_string_equal(map->accounts[0], "jane");
-	assert_null(map->accounts[1]);
-	assert_null(map->next);
+	assert_string_equal(map->mappings->username, "jane@globusid.org");
+	assert_string_equal(map->mappings->id, "e9873f94-032a-11e6-afde-cb613ccc97a9");
+	assert_string_equal(map->mappings->accounts[0], "jane");
+	assert_null(map->mappings->accounts[1]);
+	assert_null(map->mappings->next);
+	assert_int_equal(map->count, 1);
 	account_map_fini(map);
 }
 
@@ -178,7 +179,7 @@ test_id_match_in_map_file(void ** state)
 	};
 
 	struct account_map * map = account_map_init(&config, &identities);
-	assert_string_equal(map->accounts[0], "acct");
+	assert_string_equal(map->mappings->accounts[0], "acct");
 	account_map_fini(map);
 }
 
@@ -197,7 +198,7 @@ test_username_match_in_map_file(void ** state)
 	};
 
 	struct account_map * map = account_map_init(&config, &identities);
-	assert_string_equal(map->accounts[0], "acct");
+	assert_string_equal(map->mappings->accounts[0], "acct");
 	account_map_fini(map);
 }
 
@@ -297,26 +298,73 @@ test_acct_not_in_null_map(void ** state)
 void
 test_acct_not_in_map(void ** state)
 {
-	struct account_map map = {
-		.username = "username",
-		.id = "id",
-		.accounts = (char *[]){"acct1", NULL},
-		.next = NULL
-	};
-
-	assert_false(is_acct_in_map(&map, "acct2"));
+	struct config config = {.idp_suffix = "globusid.org", .map_files = NULL};
+	struct account_map * map = account_map_init(&config, &identities);
+	assert_false(is_acct_in_map(map, "acct2"));
+	assert_null(acct_to_username(map, "acct2"));
+	account_map_fini(map);
 }
 
 void
 test_acct_in_map(void ** state)
 {
-	struct account_map map = {
-		.username = "username",
-		.id = "id",
-		.accounts = (char *[]){"acct", NULL},
-		.next = NULL
+	struct config config = {.idp_suffix = "globusid.org", .map_files = NULL};
+	struct account_map * map = account_map_init(&config, &identities);
+	assert_true(is_acct_in_map(map, "jane"));
+	assert_string_equal(acct_to_username(map, "jane"), "jane@globusid.org");
+	account_map_fini(map);
+}
+
+void
+test_map_order_and_duplicates(void ** state)
+{
+	struct config config = {
+		.map_files = (char *[]){
+			(char *) &(struct file) {
+				MAGIC,
+				0,
+				(char *[]){
+					"john@example.com acct2 acct1\n",
+					"e9873f94-032a-11e6-afde-cb613ccc97a9 acct1 acct3\n",
+					"da0fcfb8-1231-4999-9b99-627f58f609c7 acct2\n",
+					NULL
+				}
+			},
+			NULL
+		}
 	};
-	assert_true(is_acct_in_map(&map, "acct"));
+
+	struct account_map * map = account_map_init(&config, &identities);
+
+	// Identities in the order found
+	struct account_mapping * john = map->mappings;
+	struct account_mapping * jane = john->next;
+	assert_string_equal(john->username, "john@example.com");
+	assert_string_equal(jane->username, "jane@globusid.org");
+	assert_null(jane->next);
+
+	// Each identity's accounts once, in the order found
+	assert_int_equal(john->count, 2);
+	assert_string_equal(john->accounts[0], "acct2");
+	assert_string_equal(john->accounts[1], "acct1");
+	assert_null(john->accounts[2]);
+	assert_int_equal(jane->count, 2);
+	assert_string_equal(jane->accounts[0], "acct1");
+	assert_string_equal(jane->accounts[1], "acct3");
+
+	// Distinct accounts, in the order found
+	assert_int_equal(map->count, 3);
+	assert_string_equal(map->accounts->acct, "acct2");
+	assert_string_equal(map->accounts->next->acct, "acct1");
+	assert_string_equal(map->accounts->next->next->acct, "acct3");
+	assert_null(map->accounts->next->next->next);
+
+	// acct1 is shared; the first identity wins
+	assert_string_equal(acct_to_username(map, "acct1"), "john@example.com");
+	assert_string_equal(acct_to_username(map, "acct3"), "jane@globusid.org");
+	assert_false(is_acct_in_map(map, "acct4"));
+
+	account_map_fini(map);
 }
 
 int
@@ -340,6 +388,7 @@ main()
 		{"acct not in null map",           test_acct_not_in_null_map},
 		{"acct not in map",                test_acct_not_in_map},
 		{"acct in map",                    test_acct_in_map},
+		{"map order and duplicates",       test_map_order_and_duplicates},
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,86 @@
+/*
+ * System includes.
+ */
+#include <string.h>
+#include <stdlib.h>
+
+/*
+ * Local includes.
+ */
+#include "buffer.h"
+#include "debug.h" // always last
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+void
+test_buffer_empty(void ** state)
+{
+	struct buffer buffer = {0};
+	assert_null(buffer_steal(&buffer));
+	buffer_fini(&buffer);
+}
+
+void
+test_buffer_append(void ** state)
+{
+	struct buffer buffer = {0};
+	assert_true(buffer_append(&buffer, "ABC", 3));
+	assert_true(buffer_append(&buffer, "DEFG", 4));
+
+	char * output = buffer_steal(&buffer);
+	assert_string_equal(output, "ABCDEFG");
+	free(output);
+
+	assert_int_equal(buffer.length, 0);
+	assert_null(buffer.data);
+}
+
+void
+test_buffer_grow(void ** state)
+{
+	struct buffer buffer = {0};
+	char chunk[1000];
+	memset(chunk, 'x', sizeof(chunk));
+
+	for (int i = 0; i < 100; i++)
+		assert_true(buffer_append(&buffer, chunk, sizeof(chunk)));
+
+	assert_int_equal(buffer.length, 100000);
+	assert_true(buffer.capacity > buffer.length);
+
+	char * output = buffer_steal(&buffer);
+	assert_int_equal(strlen(output), 100000);
+	free(output);
+}
+
+void
+test_buffer_max(void ** state)
+{
+	struct buffer buffer = {.max = 8};
+	assert_true(buffer_append(&buffer, "ABCDE", 5));
+	assert_false(buffer_append(&buffer, "FGHI", 4));
+	assert_true(buffer_append(&buffer, "FGH", 3));
+	assert_false(buffer_append(&buffer, "I", 1));
+
+	char * output = buffer_steal(&buffer);
+	assert_string_equal(output, "ABCDEFGH");
+	free(output);
+}
+
+/*******************************************
+ *              FIXTURES
+ *******************************************/
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"buffer empty",  test_buffer_empty},
+		{"buffer append", test_buffer_append},
+		{"buffer grow",   test_buffer_grow},
+		{"buffer max",    test_buffer_max},
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
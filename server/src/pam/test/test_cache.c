@@ -0,0 +1,466 @@
+#define _GNU_SOURCE // mkostemp()
+/*
+ * System includes.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <syslog.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Local includes.
+ */
+#include "cache.h"
+#include "debug.h" // always last
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+void
+vsyslog(int priority, const char *format, va_list ap) { }
+
+// Keep the segment out of /dev/shm and the files out of CACHE_DEFAULT_DIR
+static char segment_path[] = "/tmp/test_cache.XXXXXX";
+static char cache_dir[]    = "/tmp/test_cache_dir.XXXXXX";
+
+// Returns 'path' or, if it belongs to the cache, its stand-in within 'buffer'
+static char *
+_redirect(const char * path, char buffer[PATH_MAX])
+{
+	size_t length = strlen(CACHE_DEFAULT_DIR);
+
+	if (strcmp(path, CACHE_DEFAULT_FILE) == 0)
+		path = segment_path;
+	else if (strncmp(path, CACHE_DEFAULT_DIR, length) == 0 &&
+	         (path[length] == '/' || path[length] == '\0'))
+	{
+		snprintf(buffer, PATH_MAX, "%s%s", cache_dir, path+length);
+		return buffer;
+	}
+	return (char *)path;
+}
+
+int
+open(const char * path, int flags, ...)
+{
+	va_list ap;
+	va_start(ap, flags);
+	mode_t mode = va_arg(ap, int);
+	va_end(ap);
+
+	char buffer[PATH_MAX];
+	return openat(AT_FDCWD, _redirect(path, buffer), flags, mode);
+}
+
+int
+mkdir(const char * path, mode_t mode)
+{
+	char buffer[PATH_MAX];
+	return mkdirat(AT_FDCWD, _redirect(path, buffer), mode);
+}
+
+int
+mkstemp(char * template)
+{
+	char buffer[PATH_MAX];
+	char * path = _redirect(template, buffer);
+	int fd = mkostemp(path, 0);
+
+	// Hand back the name that was picked
+	if (fd != -1 && path != template)
+		strcpy(template + strlen(template) - 6, path + strlen(path) - 6);
+	return fd;
+}
+
+int
+rename(const char * oldpath, const char * newpath)
+{
+	char oldbuffer[PATH_MAX];
+	char newbuffer[PATH_MAX];
+	return renameat(AT_FDCWD,
+	                _redirect(oldpath, oldbuffer),
+	                AT_FDCWD,
+	                _redirect(newpath, newbuffer));
+}
+
+int
+unlink(const char * path)
+{
+	char buffer[PATH_MAX];
+	return unlinkat(AT_FDCWD, _redirect(path, buffer), 0);
+}
+
+/*******************************************
+ *              HELPERS
+ *******************************************/
+
+static int
+group_setup(void ** state)
+{
+	close(mkstemp(segment_path));
+	mkdtemp(cache_dir);
+	return 0;
+}
+
+static int
+group_teardown(void ** state)
+{
+	DIR * dir = opendir(cache_dir);
+	struct dirent * entry;
+	while (dir && (entry = readdir(dir)))
+	{
+		if (entry->d_name[0] != '.')
+			unlinkat(dirfd(dir), entry->d_name, 0);
+	}
+	if (dir)
+		closedir(dir);
+
+	rmdir(cache_dir);
+	unlink(segment_path);
+	return 0;
+}
+
+static char *
+_cache_dir_path(const char * name)
+{
+	static char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", cache_dir, name);
+	return path;
+}
+
+// Fork a child that exits with func(ready). Children must not use cmocka's
+// assertions; failures are reported through the exit status.
+static pid_t
+_fork(int (*func)(int ready[2]), int ready[2])
+{
+	pid_t pid = fork();
+	if (pid == 0)
+		_exit(func(ready));
+	return pid;
+}
+
+static int
+_wait(pid_t pid)
+{
+	int status = -1;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+
+// Waits on the claim made by test_claim_and_publish()
+static int
+_coalesced_waiter(int ready[2])
+{
+	char c;
+	if (read(ready[0], &c, 1) != 1)
+		return 1;
+
+	bool claimed = true;
+	char * value = cache_get_or_claim("test", "coalesced", true, &claimed);
+	return (!claimed && value && strcmp(value, "shared") == 0) ? 0 : 1;
+}
+
+/*
+ * Must run first. The waiter is forked before we map the segment so that it
+ * maps it itself; a descriptor inherited from us would share our flock().
+ */
+void
+test_claim_and_publish(void ** state)
+{
+	int ready[2];
+	assert_int_equal(pipe(ready), 0);
+
+	pid_t pid = _fork(_coalesced_waiter, ready);
+	assert_true(pid > 0);
+
+	bool claimed = false;
+	assert_null(cache_get_or_claim("test", "coalesced", true, &claimed));
+	assert_true(claimed);
+
+	// Let the waiter block on our claim
+	assert_int_equal(write(ready[1], "x", 1), 1);
+	usleep(500*1000);
+
+	// Published only for the waiter; later callers don't see it
+	cache_put("test", "coalesced", "shared", time(NULL));
+	assert_int_equal(_wait(pid), 0);
+	assert_null(cache_get("test", "coalesced"));
+
+	close(ready[0]);
+	close(ready[1]);
+}
+
+void
+test_get_put(void ** state)
+{
+	assert_null(cache_get("test", "key"));
+
+	cache_put("test", "key", "value", time(NULL) + 60);
+	char * value = cache_get("test", "key");
+	assert_string_equal(value, "value");
+	free(value);
+
+	// Namespaces are kept apart
+	assert_null(cache_get("other", "key"));
+
+	// Replacing a value
+	cache_put("test", "key", "new value", time(NULL) + 60);
+	value = cache_get("test", "key");
+	assert_string_equal(value, "new value");
+	free(value);
+}
+
+void
+test_expiry(void ** state)
+{
+	cache_put("test", "expired", "value", time(NULL));
+	assert_null(cache_get("test", "expired"));
+
+	cache_put("test", "expiring", "value", time(NULL) + 1);
+	char * value = cache_get("test", "expiring");
+	assert_string_equal(value, "value");
+	free(value);
+
+	sleep(2);
+	assert_null(cache_get("test", "expiring"));
+}
+
+void
+test_value_too_large(void ** state)
+{
+	size_t length = 64*1024;
+	char * large = calloc(length+1, sizeof(char));
+	memset(large, 'x', length);
+
+	cache_put("test", "large", large, time(NULL) + 60);
+	assert_null(cache_get("test", "large"));
+	free(large);
+}
+
+void
+test_reuse(void ** state)
+{
+	cache_put("test", "reuse", "value", time(NULL) + 60);
+
+	bool claimed = false;
+	char * value = cache_get_or_claim("test", "reuse", true, &claimed);
+	assert_string_equal(value, "value");
+	assert_false(claimed);
+	free(value);
+
+	// Caching was disabled after the value was stored
+	assert_null(cache_get_or_claim("test", "reuse", false, &claimed));
+	assert_true(claimed);
+	cache_unclaim("test", "reuse");
+}
+
+/*
+ * Whichever keys share a set with 'keep', the entries expiring sooner are
+ * evicted ahead of it. Far more keys are stored than the segment holds.
+ */
+void
+test_eviction(void ** state)
+{
+	time_t now = time(NULL);
+	int count = 1024;
+	int kept  = 0;
+	char key[32];
+
+	cache_put("test", "keep", "value", now + 3600);
+	for (int i = 0; i < count; i++)
+	{
+		snprintf(key, sizeof(key), "evict%d", i);
+		cache_put("test", key, "value", now + 60 + i);
+	}
+
+	char * value = cache_get("test", "keep");
+	assert_string_equal(value, "value");
+	free(value);
+
+	for (int i = 0; i < count; i++)
+	{
+		snprintf(key, sizeof(key), "evict%d", i);
+		value = cache_get("test", key);
+		kept += (value != NULL);
+		free(value);
+	}
+	assert_true(kept > 0);
+	assert_true(kept < count/2);
+
+	// The newest entry always lands
+	snprintf(key, sizeof(key), "evict%d", count-1);
+	value = cache_get("test", key);
+	assert_non_null(value);
+	free(value);
+}
+
+// Claims the key and sits on it until killed
+static int
+_stalled_owner(int ready[2])
+{
+	bool claimed = false;
+	char * value = cache_get_or_claim("test", "stalled", true, &claimed);
+	if (write(ready[1], (claimed && !value) ? "y" : "n", 1) != 1)
+		return 1;
+	pause();
+	return 0;
+}
+
+void
+test_claim_timeout(void ** state)
+{
+	int ready[2];
+	assert_int_equal(pipe(ready), 0);
+
+	pid_t pid = _fork(_stalled_owner, ready);
+	assert_true(pid > 0);
+
+	char c = 0;
+	assert_int_equal(read(ready[0], &c, 1), 1);
+	assert_int_equal(c, 'y');
+
+	time_t start = time(NULL);
+	bool claimed = true;
+	assert_null(cache_get_or_claim("test", "stalled", true, &claimed));
+	assert_false(claimed);
+	assert_true(time(NULL) - start >= CACHE_CLAIM_TIMEOUT - 1);
+
+	kill(pid, SIGKILL);
+	_wait(pid);
+	close(ready[0]);
+	close(ready[1]);
+}
+
+// Claims the key and exits without publishing
+static int
+_dead_owner(int ready[2])
+{
+	bool claimed = false;
+	char * value = cache_get_or_claim("test", "dead", true, &claimed);
+	return (claimed && !value) ? 0 : 1;
+}
+
+void
+test_dead_owner(void ** state)
+{
+	pid_t pid = _fork(_dead_owner, NULL);
+	assert_true(pid > 0);
+	assert_int_equal(_wait(pid), 0);
+
+	// kill(pid, 0) fails so we take the claim over without waiting
+	time_t start = time(NULL);
+	bool claimed = false;
+	assert_null(cache_get_or_claim("test", "dead", true, &claimed));
+	assert_true(claimed);
+	assert_true(time(NULL) - start < CACHE_CLAIM_TIMEOUT);
+
+	cache_put("test", "dead", "value", time(NULL) + 60);
+	char * value = cache_get("test", "dead");
+	assert_string_equal(value, "value");
+	free(value);
+}
+
+void
+test_file_read_write(void ** state)
+{
+	struct stat st;
+	assert_null(cache_file_read("file", &st));
+
+	cache_file_write("file", "contents");
+	char * contents = cache_file_read("file", &st);
+	assert_string_equal(contents, "contents");
+	assert_true(time(NULL) - st.st_mtime <= 1);
+	assert_int_equal(st.st_size, strlen("contents"));
+	free(contents);
+
+	assert_int_equal(stat(_cache_dir_path("file"), &st), 0);
+	assert_int_equal(st.st_mode & (S_IRWXG|S_IRWXO), 0);
+
+	// Replaced in place
+	cache_file_write("file", "new contents");
+	contents = cache_file_read("file", &st);
+	assert_string_equal(contents, "new contents");
+	free(contents);
+}
+
+void
+test_file_permissions(void ** state)
+{
+	struct stat st;
+
+	cache_file_write("writable", "contents");
+	assert_int_equal(chmod(_cache_dir_path("writable"), 0664), 0);
+	assert_null(cache_file_read("writable", &st));
+
+	cache_file_write("target", "contents");
+	assert_int_equal(symlinkat("target", AT_FDCWD, _cache_dir_path("link")), 0);
+	assert_null(cache_file_read("link", &st));
+
+	assert_int_equal(mkdir(_cache_dir_path("directory"), 0700), 0);
+	assert_null(cache_file_read("directory", &st));
+	rmdir(_cache_dir_path("directory"));
+}
+
+void
+test_file_paths(void ** state)
+{
+	struct stat st;
+
+	// Names may not leave the cache directory
+	cache_file_write("../escaped", "contents");
+	assert_int_equal(access(_cache_dir_path("../escaped"), F_OK), -1);
+	assert_null(cache_file_read("../escaped", &st));
+	assert_int_equal(cache_file_trylock("../escaped"), -1);
+}
+
+void
+test_file_trylock(void ** state)
+{
+	int fd = cache_file_trylock("locked");
+	assert_true(fd >= 0);
+	assert_int_equal(cache_file_trylock("locked"), -1);
+	close(fd);
+
+	fd = cache_file_trylock("locked");
+	assert_true(fd >= 0);
+	close(fd);
+}
+
+/*******************************************
+ *              FIXTURES
+ *******************************************/
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"claim and publish",  test_claim_and_publish}, // must be first
+		{"get put",            test_get_put},
+		{"expiry",             test_expiry},
+		{"value too large",    test_value_too_large},
+		{"reuse",              test_reuse},
+		{"eviction",           test_eviction},
+		{"claim timeout",      test_claim_timeout},
+		{"dead owner",         test_dead_owner},
+		{"file read write",    test_file_read_write},
+		{"file permissions",   test_file_permissions},
+		{"file paths",         test_file_paths},
+		{"file trylock",       test_file_trylock},
+	};
+
+	return cmocka_run_group_tests(tests, group_setup, group_teardown);
+}
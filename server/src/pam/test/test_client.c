@@ -0,0 +1,138 @@
+/*
+ * System includes.
+ */
+#include <syslog.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+/*
+ * Local includes.
+ */
+#include "client.h"
+#include "arena.h"
+#include "json.h"
+#include "debug.h" // always last
+
+static const char * client_reply =
+	"{"
+	"  \"client\": {"
+	"    \"fqdns\": [\"host1.example.com\", \"host2.example.com\"],"
+	"    \"grant_types\": [\"client_credentials\"],"
+	"    \"id\": \"a1b2c3\","
+	"    \"name\": \"SSH Server\","
+	"    \"project\": \"p\","
+	"    \"public_client\": false,"
+	"    \"redirect_uris\": [],"
+	"    \"scopes\": [],"
+	"    \"visibility\": \"private\""
+	"  }"
+	"}";
+
+static struct client *
+_client_init(struct ssh_scopes * ssh_scopes)
+{
+	jobj_t * jobj = jobj_init(client_reply, NULL);
+	struct client * client = client_init(jobj, ssh_scopes);
+	jobj_fini(jobj);
+	return client;
+}
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+void
+vsyslog(int priority, const char *format, va_list ap) { }
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+void
+test_client_init(void ** state)
+{
+	struct client * client = _client_init(NULL);
+	assert_non_null(client);
+	assert_string_equal(client->id, "a1b2c3");
+	assert_string_equal(client->fqdns[1], "host2.example.com");
+	assert_int_equal(client->ssh_scopes->count, 3);
+	assert_string_equal(client->ssh_scopes->scopes[0].scope,
+	                    "https://auth.globus.org/scopes/host1.example.com/ssh");
+	client_fini(client);
+}
+
+void
+test_ssh_scope_match(void ** state)
+{
+	struct client * client = _client_init(NULL);
+
+	assert_true(client_has_ssh_scope(client,
+	                                 "https://auth.globus.org/scopes/host2.example.com/ssh"));
+	assert_true(client_has_ssh_scope(client,
+	                                 "openid  email https://auth.globus.org/scopes/a1b2c3/ssh "));
+
+	// Prefixes and suffixes of an ssh scope do not match
+	assert_false(client_has_ssh_scope(client,
+	                                  "https://auth.globus.org/scopes/host1.example.com/ss"));
+	assert_false(client_has_ssh_scope(client,
+	                                  "https://auth.globus.org/scopes/host1.example.com/ssh2"));
+	assert_false(client_has_ssh_scope(client,
+	                                  "https://auth.globus.org/scopes/other.example.com/ssh"));
+	assert_false(client_has_ssh_scope(client, "openid email"));
+	assert_false(client_has_ssh_scope(client, ""));
+	assert_false(client_has_ssh_scope(client, NULL));
+
+	client_fini(client);
+}
+
+void
+test_client_in_arena(void ** state)
+{
+	arena_begin();
+	struct client * client = _client_init(NULL);
+	assert_true(arena_owns(client));
+
+	// The scope set outlives the request
+	struct ssh_scopes * ssh_scopes = ssh_scopes_hold(client->ssh_scopes);
+	assert_false(arena_owns(ssh_scopes));
+	assert_false(arena_owns(ssh_scopes->scopes[0].scope));
+	client_fini(client);
+	arena_end();
+
+	client = _client_init(ssh_scopes);
+	assert_true(client_has_ssh_scope(client,
+	                                 "https://auth.globus.org/scopes/host1.example.com/ssh"));
+	client_fini(client);
+	ssh_scopes_release(ssh_scopes);
+}
+
+void
+test_shared_ssh_scopes(void ** state)
+{
+	struct client * client1 = _client_init(NULL);
+	struct client * client2 = _client_init(client1->ssh_scopes);
+
+	assert_ptr_equal(client1->ssh_scopes, client2->ssh_scopes);
+	assert_int_equal(client1->ssh_scopes->refcount, 2);
+
+	client_fini(client1);
+	assert_true(client_has_ssh_scope(client2,
+	                                 "https://auth.globus.org/scopes/a1b2c3/ssh"));
+	client_fini(client2);
+}
+
+/*******************************************
+ *              FIXTURES
+ *******************************************/
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"client init",       test_client_init},
+		{"ssh scope match",   test_ssh_scope_match},
+		{"client in arena",   test_client_in_arena},
+		{"shared ssh scopes", test_shared_ssh_scopes},
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,438 @@
+/*
+ * System includes.
+ */
+#include <security/pam_appl.h>
+#include <sys/types.h>
+#include <syslog.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+/*
+ * Local includes.
+ */
+#include "globus_auth.h"
+#include "introspect.h"
+#include "commands.h"
+#include "metrics.h"
+#include "client.h"
+#include "config.h"
+#include "passwd.h"
+#include "policy.h"
+#include "base64.h"
+#include "json.h"
+#include "debug.h" // always last
+
+/*
+ * These tests drive resolve_and_login through process_command(). Globus Auth
+ * and the passwd database are mocked; the linked identities are mapped to
+ * local accounts by idp_suffix, ie. alice@example.org => alice.
+ */
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+
+// prevents our test from generating syslog messages
+void vsyslog(int priority, const char *format, va_list ap) {}
+
+// Keep the metrics segment out of /dev/shm
+static char metrics_path[] = "/tmp/test_commands_metrics.XXXXXX";
+
+int
+open(const char * path, int flags, ...)
+{
+	va_list ap;
+	va_start(ap, flags);
+	mode_t mode = va_arg(ap, int);
+	va_end(ap);
+
+	if (strcmp(path, METRICS_DEFAULT_FILE) == 0)
+		path = metrics_path;
+	return openat(AT_FDCWD, path, flags, mode);
+}
+
+static const char * client_reply =
+	"{"
+	"  \"client\": {"
+	"    \"fqdns\": [\"host.example.org\"],"
+	"    \"grant_types\": [\"client_credentials\"],"
+	"    \"id\": \"a1b2c3\","
+	"    \"name\": \"SSH Server\","
+	"    \"project\": \"p\","
+	"    \"public_client\": false,"
+	"    \"redirect_uris\": [],"
+	"    \"scopes\": [],"
+	"    \"visibility\": \"private\""
+	"  }"
+	"}";
+
+// The usernames of the token's linked identities
+static const char * alice_and_bob[]   = {"alice@example.org", "bob@example.org", NULL};
+static const char * alice_and_ghost[] = {"alice@example.org", "ghost@example.org", NULL};
+static const char * alice[]           = {"alice@example.org", NULL};
+static const char * carol[]           = {"carol@other.org", NULL};
+
+static const char ** linked_identities = alice_and_bob;
+static bool          token_active      = true;
+static int           resources_fetched = 0;
+
+void
+get_login_resources(const struct config *  config,
+                    const char          *  token,
+                    struct introspect   ** introspect,
+                    struct client       ** client)
+{
+	char ids[512]      = "";
+	char details[2048] = "";
+
+	resources_fetched++;
+
+	for (int i = 0; linked_identities[i]; i++)
+	{
+		size_t length = strlen(ids);
+		snprintf(ids + length, sizeof(ids) - length,
+		         "%s\"id%d\"", i ? "," : "", i);
+
+		length = strlen(details);
+		snprintf(details + length, sizeof(details) - length,
+		         "%s{\"sub\": \"id%d\", \"username\": \"%s\","
+		         " \"identity_provider\": \"idp\", \"status\": \"used\"}",
+		         i ? "," : "", i, linked_identities[i]);
+	}
+
+	time_t now = time(NULL);
+	char jstring[4096];
+	snprintf(jstring, sizeof(jstring),
+	         "{ \"active\": %s,"
+	         "  \"scope\": \"https://auth.globus.org/scopes/host.example.org/ssh\","
+	         "  \"client_id\": \"c\", \"username\": \"%s\", \"email\": \"e\","
+	         "  \"iss\": \"iss\", \"sub\": \"id0\", \"aud\": [\"a1b2c3\"],"
+	         "  \"exp\": %ld, \"iat\": %ld, \"nbf\": %ld,"
+	         "  \"identities_set\": [%s],"
+	         "  \"identity_set_detail\": [%s] }",
+	         token_active ? "true" : "false",
+	         linked_identities[0],
+	         (long)now + 3600, (long)now, (long)now,
+	         ids,
+	         details);
+
+	jobj_t * jobj = jobj_init(jstring, NULL);
+	*introspect = introspect_init(jobj);
+	jobj_fini(jobj);
+
+	jobj = jobj_init(client_reply, NULL);
+	*client = client_init(jobj, NULL);
+	jobj_fini(jobj);
+}
+
+// Every account exists except 'ghost'
+void
+passwd_lookup(const struct config * config,
+              const char * const  * accts,
+              int                   count,
+              bool                * exists)
+{
+	for (int i = 0; i < count; i++)
+		exists[i] = strcmp(accts[i], "ghost") != 0;
+}
+
+/*******************************************
+ *              HELPERS
+ *******************************************/
+
+static struct policy policy = {.json = "{\"permitted_idps\": null}"};
+
+static struct config config = {
+	.auth_method         = (char *[]){"globus_auth", NULL},
+	.idp_suffix          = "example.org",
+	.account_map_max_age = 3600,
+	.policy              = &policy,
+};
+
+/*
+ * Run resolve_and_login as 'requested_user' with the encoded
+ * 'preferred_accounts' list, if any. Returns the PAM status and sets '*reply'
+ * to the decoded reply.
+ */
+static int
+_resolve_and_login(const char * requested_user,
+                   const char * preferred_accounts,
+                   int          version,
+                   jobj_t    ** reply)
+{
+	char command[512];
+	snprintf(command, sizeof(command),
+	         "{\"command\": {\"op\": \"resolve_and_login\","
+	         " \"access_token\": \"token\"%s%s},"
+	         " \"version\": %d}",
+	         preferred_accounts ? ", \"preferred_accounts\": " : "",
+	         preferred_accounts ? preferred_accounts : "",
+	         version);
+
+	char * user_input    = base64_encode(command);
+	char * encoded_reply = NULL;
+	int    command_version = 0;
+
+	int pam_status = process_command(&config,
+	                                 requested_user,
+	                                 user_input,
+	                                 &encoded_reply,
+	                                 &command_version);
+	assert_int_equal(command_version, version);
+
+	*reply = NULL;
+	if (encoded_reply)
+	{
+		char * decoded_reply = base64_decode(encoded_reply);
+		*reply = jobj_init(decoded_reply, NULL);
+		free(decoded_reply);
+	}
+
+	free(user_input);
+	free(encoded_reply);
+	return pam_status;
+}
+
+static jobj_t *
+_resolved(jobj_t * reply)
+{
+	assert_non_null(reply);
+	jobj_t * resolved = jobj_get_value(reply, "resolve_and_login");
+	assert_non_null(resolved);
+	return resolved;
+}
+
+// Asserts that the reply permits exactly 'accounts'
+static void
+_assert_permitted(jobj_t * resolved, const char ** accounts)
+{
+	jarr_t * permitted = jobj_get_value(resolved, "permitted_accounts");
+	assert_non_null(permitted);
+
+	int count = 0;
+	for (; accounts[count]; count++)
+		assert_string_equal(jarr_get_string(permitted, count), accounts[count]);
+	assert_int_equal(jarr_get_length(permitted), count);
+}
+
+static const char *
+_account(jobj_t * resolved)
+{
+	assert_true(jobj_key_exists(resolved, "account"));
+	if (jobj_get_type(resolved, "account") == json_type_null)
+		return NULL;
+	return jobj_get_string(resolved, "account");
+}
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+
+void
+test_authorized(void ** state)
+{
+	jobj_t * reply = NULL;
+	linked_identities = alice_and_bob;
+
+	assert_int_equal(_resolve_and_login("alice", NULL, 2, &reply), PAM_SUCCESS);
+
+	jobj_t * resolved = _resolved(reply);
+	jobj_t * policy = jobj_get_value(resolved, "policy");
+	assert_non_null(policy);
+	assert_true(jobj_key_exists(policy, "permitted_idps"));
+	_assert_permitted(resolved, (const char *[]){"alice", "bob", NULL});
+	assert_string_equal(_account(resolved), "alice");
+	assert_true(jobj_get_bool(resolved, "authorized"));
+	assert_int_equal(jobj_get_int(resolved, "max_age"), 3600);
+
+	jobj_fini(reply);
+}
+
+void
+test_unauthorized(void ** state)
+{
+	jobj_t * reply = NULL;
+	linked_identities = alice_and_bob;
+
+	assert_int_equal(_resolve_and_login("carol", NULL, 2, &reply), PAM_AUTH_ERR);
+
+	// The client still learns which accounts it may use
+	jobj_t * resolved = _resolved(reply);
+	_assert_permitted(resolved, (const char *[]){"alice", "bob", NULL});
+	assert_null(_account(resolved));
+	assert_false(jobj_get_bool(resolved, "authorized"));
+
+	jobj_fini(reply);
+}
+
+void
+test_requested_user_first(void ** state)
+{
+	jobj_t * reply = NULL;
+	linked_identities = alice_and_bob;
+
+	assert_int_equal(_resolve_and_login("alice", "[\"bob\"]", 2, &reply), PAM_SUCCESS);
+	assert_string_equal(_account(_resolved(reply)), "alice");
+
+	jobj_fini(reply);
+}
+
+void
+test_preferred_accounts(void ** state)
+{
+	jobj_t * reply = NULL;
+	linked_identities = alice_and_bob;
+
+	// The first preferred account that is permitted
+	assert_int_equal(_resolve_and_login("carol", "[\"dave\", \"bob\", \"alice\"]", 2, &reply),
+	                 PAM_AUTH_ERR);
+	assert_string_equal(_account(_resolved(reply)), "bob");
+	jobj_fini(reply);
+
+	// None are permitted
+	assert_int_equal(_resolve_and_login("carol", "[\"dave\"]", 2, &reply), PAM_AUTH_ERR);
+	assert_null(_account(_resolved(reply)));
+	jobj_fini(reply);
+}
+
+void
+test_single_permitted_account(void ** state)
+{
+	jobj_t * reply = NULL;
+
+	// 'ghost' is mapped but does not exist locally
+	linked_identities = alice_and_ghost;
+
+	assert_int_equal(_resolve_and_login("carol", NULL, 2, &reply), PAM_AUTH_ERR);
+
+	jobj_t * resolved = _resolved(reply);
+	_assert_permitted(resolved, (const char *[]){"alice", NULL});
+	assert_string_equal(_account(resolved), "alice");
+
+	jobj_fini(reply);
+}
+
+void
+test_no_permitted_accounts(void ** state)
+{
+	jobj_t * reply = NULL;
+	linked_identities = carol;
+
+	assert_int_equal(_resolve_and_login("carol", "[\"carol\"]", 2, &reply), PAM_AUTH_ERR);
+
+	jobj_t * resolved = _resolved(reply);
+	_assert_permitted(resolved, (const char *[]){NULL});
+	assert_null(_account(resolved));
+	assert_false(jobj_get_bool(resolved, "authorized"));
+
+	jobj_fini(reply);
+}
+
+void
+test_invalid_token(void ** state)
+{
+	jobj_t * reply = NULL;
+	linked_identities = alice;
+	token_active = false;
+
+	assert_int_equal(_resolve_and_login("alice", NULL, 2, &reply), PAM_AUTH_ERR);
+
+	assert_non_null(reply);
+	jobj_t * error = jobj_get_value(reply, "error");
+	assert_non_null(error);
+	assert_string_equal(jobj_get_string(error, "code"), "INVALID_TOKEN");
+
+	token_active = true;
+	jobj_fini(reply);
+}
+
+// Version 1 clients do not know resolve_and_login
+void
+test_version_1_client(void ** state)
+{
+	jobj_t * reply = NULL;
+	linked_identities = alice;
+
+	resources_fetched = 0;
+	assert_int_equal(_resolve_and_login("alice", NULL, 1, &reply), PAM_AUTHINFO_UNAVAIL);
+	assert_int_equal(resources_fetched, 0);
+
+	jobj_t * error = jobj_get_value(reply, "error");
+	assert_non_null(error);
+	assert_string_equal(jobj_get_string(error, "code"), "UNKNOWN_COMMAND");
+
+	jobj_fini(reply);
+}
+
+// SciTokens are logins without an account map or a reply
+void
+test_scitoken(void ** state)
+{
+	char * user_input = base64_encode(
+		"{\"command\": {\"op\": \"resolve_and_login\","
+		" \"access_token\": \"header.payload.signature\"},"
+		" \"version\": 2}");
+	char * reply   = NULL;
+	int    version = 0;
+
+	resources_fetched = 0;
+
+	// Not configured for SciTokens
+	assert_int_equal(process_command(&config, "alice", user_input, &reply, &version),
+	                 PAM_AUTHINFO_UNAVAIL);
+	assert_null(reply);
+
+	struct config scitokens_config = config;
+	scitokens_config.auth_method = (char *[]){"scitokens", NULL};
+
+#ifndef WITH_SCITOKENS
+	// Configured, but this build can not verify it
+	assert_int_equal(process_command(&scitokens_config, "alice", user_input, &reply, &version),
+	                 PAM_AUTH_ERR);
+	assert_null(reply);
+#endif // WITH_SCITOKENS
+
+	assert_int_equal(resources_fetched, 0);
+	free(user_input);
+}
+
+/*******************************************
+ *              FIXTURES
+ *******************************************/
+
+static int
+group_setup(void ** state)
+{
+	close(mkstemp(metrics_path));
+	return 0;
+}
+
+static int
+group_teardown(void ** state)
+{
+	unlink(metrics_path);
+	return 0;
+}
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"authorized",               test_authorized},
+		{"unauthorized",             test_unauthorized},
+		{"requested user first",     test_requested_user_first},
+		{"preferred accounts",       test_preferred_accounts},
+		{"single permitted account", test_single_permitted_account},
+		{"no permitted accounts",    test_no_permitted_accounts},
+		{"invalid token",            test_invalid_token},
+		{"version 1 client",         test_version_1_client},
+		{"scitoken",                 test_scitoken},
+	};
+
+	return cmocka_run_group_tests(tests, group_setup, group_teardown);
+}
@@ -0,0 +1,391 @@
+/*
+ * System includes.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <stdio.h>
+
+/*
+ * Local includes.
+ */
+#include "config.h"
+#include "debug.h" // always last
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+
+// prevents our test from generating syslog messages
+void vsyslog(int priority, const char *format, va_list ap) {}
+
+/*
+ * A fake config file at 'file_path'. Tests 'edit' it by changing its contents and
+ * its stat() results.
+ */
+static const char * file_path     = CONFIG_DEFAULT_FILE;
+static char **      file_contents = NULL;
+static int          file_lineno   = 0;
+static int          file_opens    = 0;
+static bool         file_exists   = true;
+static struct stat  file_stat;
+
+FILE *
+fopen(const char *path, const char *mode)
+{
+	if (!file_exists || strcmp(path, file_path) != 0)
+		return NULL;
+
+	file_opens++;
+	file_lineno = 0;
+	return (FILE *)&file_contents;
+}
+
+char *
+fgets(char *s, int size, FILE *stream)
+{
+	if (!file_contents[file_lineno])
+		return NULL;
+
+	strcpy(s, file_contents[file_lineno++]);
+	return s;
+}
+
+int
+fclose(FILE *fp)
+{
+	return 0;
+}
+
+int
+stat(const char * path, struct stat * st)
+{
+	if (!file_exists || strcmp(path, file_path) != 0)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+	*st = file_stat;
+	return 0;
+}
+
+/*******************************************
+ *              HELPERS
+ *******************************************/
+
+static char * globus_config[] = {
+	"auth_method globus_auth\n",
+	"client_id client_id\n",
+	"client_secret client_secret\n",
+	"idp_suffix example.com\n",
+	NULL
+};
+
+static char * edited_config[] = {
+	"auth_method globus_auth\n",
+	"client_id client_id\n",
+	"client_secret client_secret\n",
+	"idp_suffix example.org\n",
+	NULL
+};
+
+static char * max_response_size_config[] = {
+	"auth_method globus_auth\n",
+	"client_id client_id\n",
+	"client_secret client_secret\n",
+	"idp_suffix example.com\n",
+	"max_response_size 4096\n",
+	NULL
+};
+
+static char * passwd_config[] = {
+	"auth_method globus_auth\n",
+	"client_id client_id\n",
+	"client_secret client_secret\n",
+	"idp_suffix example.com\n",
+	"passwd_cache_ttl 60\n",
+	"passwd_lookup_threads 4\n",
+	NULL
+};
+
+static char * invalid_passwd_config[] = {
+	"auth_method globus_auth\n",
+	"client_id client_id\n",
+	"client_secret client_secret\n",
+	"idp_suffix example.com\n",
+	"passwd_lookup_threads 0\n",
+	NULL
+};
+
+static char * max_age_config[] = {
+	"auth_method globus_auth\n",
+	"client_id client_id\n",
+	"client_secret client_secret\n",
+	"idp_suffix example.com\n",
+	"policy_max_age 0\n",
+	"account_map_max_age 60\n",
+	NULL
+};
+
+static char * invalid_config[] = {
+	"auth_method globus_auth\n",
+	"unknown_directive value\n",
+	NULL
+};
+
+static int
+setup(void ** state)
+{
+	// Start every test with a file the process has not seen before
+	file_stat.st_ino++;
+	file_stat.st_size = 100;
+	file_stat.st_mtim.tv_sec = 1000;
+	file_path = CONFIG_DEFAULT_FILE;
+	file_contents = globus_config;
+	file_exists = true;
+	file_opens = 0;
+	return 0;
+}
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+
+void
+test_parse(void ** state)
+{
+	struct config * config = config_init(0, 0, NULL);
+	assert_non_null(config);
+	assert_string_equal(config->client_id, "client_id");
+	assert_string_equal(config->client_secret, "client_secret");
+	assert_string_equal(config->idp_suffix, "example.com");
+	assert_false(config->debug);
+	assert_null(config->environment);
+	assert_int_equal(config->max_response_size, CONFIG_DEFAULT_MAX_RESPONSE_SIZE);
+	assert_int_equal(config->passwd_cache_ttl, 0);
+	assert_int_equal(config->passwd_lookup_threads, CONFIG_DEFAULT_PASSWD_LOOKUP_THREADS);
+	assert_int_equal(config->policy_max_age, CONFIG_DEFAULT_POLICY_MAX_AGE);
+	assert_int_equal(config->account_map_max_age, CONFIG_DEFAULT_ACCOUNT_MAP_MAX_AGE);
+	config_fini(config);
+}
+
+void
+test_max_response_size(void ** state)
+{
+	file_contents = max_response_size_config;
+	struct config * config = config_init(0, 0, NULL);
+	assert_non_null(config);
+	assert_int_equal(config->max_response_size, 4096);
+	config_fini(config);
+}
+
+void
+test_passwd_options(void ** state)
+{
+	file_contents = passwd_config;
+	struct config * config = config_init(0, 0, NULL);
+	assert_non_null(config);
+	assert_int_equal(config->passwd_cache_ttl, 60);
+	assert_int_equal(config->passwd_lookup_threads, 4);
+	config_fini(config);
+
+	setup(state);
+	file_contents = invalid_passwd_config;
+	assert_null(config_init(0, 0, NULL));
+}
+
+void
+test_max_age_options(void ** state)
+{
+	file_contents = max_age_config;
+	struct config * config = config_init(0, 0, NULL);
+	assert_non_null(config);
+	assert_int_equal(config->policy_max_age, 0);
+	assert_int_equal(config->account_map_max_age, 60);
+	config_fini(config);
+}
+
+// Garbage, negative and out-of-range numbers are errors, not 0
+void
+test_invalid_numbers(void ** state)
+{
+	char * options[] = {
+		"introspect_cache_ttl thirty\n",
+		"client_cache_ttl -1\n",
+		"max_response_size 1M\n",
+		"passwd_cache_ttl 99999999999\n",
+		"passwd_lookup_threads 0\n",
+		"policy_max_age -3600\n",
+		"account_map_max_age 60s\n",
+	};
+
+	for (int i = 0; i < sizeof(options)/sizeof(*options); i++)
+	{
+		char * invalid_number_config[] = {
+			"auth_method globus_auth\n",
+			"client_id client_id\n",
+			"client_secret client_secret\n",
+			"idp_suffix example.com\n",
+			options[i],
+			NULL
+		};
+
+		setup(state);
+		file_contents = invalid_number_config;
+		assert_null(config_init(0, 0, NULL));
+	}
+}
+
+void
+test_missing_file(void ** state)
+{
+	file_exists = false;
+	assert_null(config_init(0, 0, NULL));
+}
+
+void
+test_unchanged_file_is_not_reparsed(void ** state)
+{
+	struct config * config1 = config_init(0, 0, NULL);
+	struct config * config2 = config_init(0, 0, NULL);
+
+	assert_non_null(config1);
+	assert_ptr_equal(config1, config2);
+	assert_int_equal(file_opens, 1);
+
+	config_fini(config1);
+	config_fini(config2);
+
+	// Releasing every user must not discard the parsed file
+	config_fini(config_init(0, 0, NULL));
+	assert_int_equal(file_opens, 1);
+}
+
+void
+test_reload_after_edit(void ** state)
+{
+	struct config * config1 = config_init(0, 0, NULL);
+	assert_non_null(config1);
+
+	file_contents = edited_config;
+	file_stat.st_mtim.tv_sec++;
+
+	struct config * config2 = config_init(0, 0, NULL);
+	assert_non_null(config2);
+	assert_ptr_not_equal(config1, config2);
+	assert_int_equal(file_opens, 2);
+	assert_string_equal(config2->idp_suffix, "example.org");
+
+	// Existing users keep the config they were given
+	assert_string_equal(config1->idp_suffix, "example.com");
+
+	config_fini(config1);
+	config_fini(config2);
+}
+
+void
+test_reload_after_size_change(void ** state)
+{
+	config_fini(config_init(0, 0, NULL));
+
+	file_contents = edited_config;
+	file_stat.st_size++;
+
+	struct config * config = config_init(0, 0, NULL);
+	assert_non_null(config);
+	assert_int_equal(file_opens, 2);
+	assert_string_equal(config->idp_suffix, "example.org");
+	config_fini(config);
+}
+
+void
+test_reload_after_replace(void ** state)
+{
+	config_fini(config_init(0, 0, NULL));
+
+	// ie. 'mv oauth-ssh.conf.new oauth-ssh.conf'
+	file_contents = edited_config;
+	file_stat.st_ino++;
+
+	struct config * config = config_init(0, 0, NULL);
+	assert_non_null(config);
+	assert_int_equal(file_opens, 2);
+	assert_string_equal(config->idp_suffix, "example.org");
+	config_fini(config);
+}
+
+void
+test_args_are_not_shared(void ** state)
+{
+	const char * argv[] = {"debug", "environment=sandbox"};
+
+	struct config * config1 = config_init(0, 2, argv);
+	struct config * config2 = config_init(0, 0, NULL);
+	struct config * config3 = config_init(0, 0, NULL);
+
+	assert_true(config1->debug);
+	assert_string_equal(config1->environment, "sandbox");
+	assert_false(config2->debug);
+	assert_null(config2->environment);
+	assert_ptr_equal(config2, config3);
+
+	config_fini(config1);
+	config_fini(config2);
+	config_fini(config3);
+}
+
+void
+test_config_file_argument(void ** state)
+{
+	const char * argv[] = {"config_file=/tmp/oauth-ssh.conf"};
+
+	assert_null(config_init(0, 1, argv));
+
+	file_path = "/tmp/oauth-ssh.conf";
+	struct config * config = config_init(0, 1, argv);
+	assert_non_null(config);
+	assert_string_equal(config->config_file, "/tmp/oauth-ssh.conf");
+	config_fini(config);
+
+	assert_null(config_init(0, 0, NULL));
+}
+
+void
+test_invalid_file_is_not_cached(void ** state)
+{
+	file_contents = invalid_config;
+	assert_null(config_init(0, 0, NULL));
+	assert_null(config_init(0, 0, NULL));
+	assert_int_equal(file_opens, 2);
+
+	// Fixed without changing any stat() fields
+	file_contents = globus_config;
+	struct config * config = config_init(0, 0, NULL);
+	assert_non_null(config);
+	config_fini(config);
+}
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"parse",                           test_parse,                          setup},
+		{"max_response_size",               test_max_response_size,              setup},
+		{"passwd options",                  test_passwd_options,                 setup},
+		{"max_age options",                 test_max_age_options,                setup},
+		{"invalid numbers",                 test_invalid_numbers,                setup},
+		{"missing file",                    test_missing_file,                   setup},
+		{"unchanged file is not reparsed",  test_unchanged_file_is_not_reparsed, setup},
+		{"reload after edit",               test_reload_after_edit,              setup},
+		{"reload after size change",        test_reload_after_size_change,       setup},
+		{"reload after replace",            test_reload_after_replace,           setup},
+		{"args are not shared",             test_args_are_not_shared,            setup},
+		{"config_file argument",            test_config_file_argument,           setup},
+		{"invalid file is not cached",      test_invalid_file_is_not_cached,     setup},
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,173 @@
+/*
+ * System includes.
+ */
+#include <syslog.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+
+/*
+ * Local includes.
+ */
+#include "decoder.h"
+#include "strings.h"
+#include "json.h"
+#include "debug.h" // always last
+
+struct child {
+	char * name;
+};
+
+struct record {
+	bool            enabled;
+	int             count;
+	time_t          when;
+	char *          name;
+	char **         tags;
+	struct child ** children;
+};
+
+static const struct decode_field child_fields[] = {
+	DECODE_VALUE(struct child, name, string, DECODE_REQUIRED),
+};
+
+static const struct decoder child_decoder =
+	DECODER(struct child, "Child", child_fields);
+
+// Sorted by key
+static const struct decode_field record_fields[] = {
+	DECODE_CONTAINER(struct record, children, array, DECODE_OPTIONAL, decode_records, &child_decoder),
+	DECODE_VALUE(struct record, count,   int,     DECODE_REQUIRED),
+	DECODE_VALUE(struct record, enabled, boolean, DECODE_GATE),
+	DECODE_VALUE(struct record, name,    string,  DECODE_OPTIONAL),
+	DECODE_CONTAINER(struct record, tags, array, DECODE_REQUIRED, decode_strings, NULL),
+	DECODE_VALUE(struct record, when,    int,     DECODE_REQUIRED),
+};
+
+static const struct decoder record_decoder =
+	DECODER(struct record, "Record", record_fields);
+
+static void
+record_fini(struct record * r)
+{
+	free(r->name);
+	free_array(r->tags);
+	for (int i = 0; r->children && r->children[i]; i++)
+	{
+		free(r->children[i]->name);
+		free(r->children[i]);
+	}
+	free(r->children);
+}
+
+static bool
+decode(const char * jstring, struct record * r)
+{
+	memset(r, 0, sizeof(*r));
+	jobj_t * jobj = jobj_init(jstring, NULL);
+	bool ok = decode_object(jobj, &record_decoder, r);
+	jobj_fini(jobj);
+	return ok;
+}
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+void
+vsyslog(int priority, const char *format, va_list ap) { }
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+void
+test_decode_all(void ** state)
+{
+	struct record r;
+	assert_true(decode("{ \"unknown\": 1, \"enabled\": true, \"count\": 3,"
+	                   "  \"when\": 4102444800, \"name\": \"n\","
+	                   "  \"tags\": [\"a\", \"b\"],"
+	                   "  \"children\": [{\"name\": \"c1\"}, {\"name\": \"c2\"}] }", &r));
+	assert_true(r.enabled);
+	assert_int_equal(r.count, 3);
+	assert_int_equal(r.when, 4102444800);
+	assert_string_equal(r.name, "n");
+	assert_string_equal(r.tags[1], "b");
+	assert_null(r.tags[2]);
+	assert_string_equal(r.children[1]->name, "c2");
+	assert_null(r.children[2]);
+	record_fini(&r);
+}
+
+void
+test_decode_optional(void ** state)
+{
+	struct record r;
+	assert_true(decode("{ \"enabled\": true, \"count\": 3, \"when\": 4, \"tags\": [],"
+	                   "  \"name\": null }", &r));
+	assert_null(r.name);
+	assert_null(r.children);
+	record_fini(&r);
+}
+
+void
+test_decode_required(void ** state)
+{
+	struct record r;
+
+	// Missing
+	assert_false(decode("{ \"enabled\": true, \"count\": 3, \"tags\": [] }", &r));
+	record_fini(&r);
+
+	// null
+	assert_false(decode("{ \"enabled\": true, \"count\": 3, \"when\": null, \"tags\": [] }", &r));
+	record_fini(&r);
+
+	// Wrong type
+	assert_false(decode("{ \"enabled\": true, \"count\": \"3\", \"when\": 4, \"tags\": [] }", &r));
+	record_fini(&r);
+
+	// Malformed container
+	assert_false(decode("{ \"enabled\": true, \"count\": 3, \"when\": 4, \"tags\": [1] }", &r));
+	record_fini(&r);
+
+	// Nested record
+	assert_false(decode("{ \"enabled\": true, \"count\": 3, \"when\": 4, \"tags\": [],"
+	                    "  \"children\": [{}] }", &r));
+	record_fini(&r);
+}
+
+void
+test_decode_gate(void ** state)
+{
+	struct record r;
+
+	// Other required fields may be missing when the gate is false
+	assert_true(decode("{ \"enabled\": false }", &r));
+	assert_false(r.enabled);
+	record_fini(&r);
+
+	// But the gate itself is required
+	assert_false(decode("{ \"count\": 3, \"when\": 4, \"tags\": [] }", &r));
+	record_fini(&r);
+
+	assert_false(decode("{ \"enabled\": true }", &r));
+	record_fini(&r);
+}
+
+/*******************************************
+ *              FIXTURES
+ *******************************************/
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"decode all",      test_decode_all},
+		{"decode optional", test_decode_optional},
+		{"decode required", test_decode_required},
+		{"decode gate",     test_decode_gate},
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,108 @@
+/*
+ * System includes.
+ */
+#include <syslog.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+/*
+ * Local includes.
+ */
+#include "hash.h"
+#include "arena.h"
+#include "debug.h" // always last
+
+struct record {
+	char             key[16];
+	int              value;
+	struct hash_node node;
+};
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+void
+vsyslog(int priority, const char *format, va_list ap) { }
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+void
+test_hash_empty(void ** state)
+{
+	struct hash hash = {0};
+	assert_null(hash_find(&hash, "key"));
+	assert_null(hash_entry(hash_find(&hash, "key"), struct record, node));
+	hash_fini(&hash);
+}
+
+void
+test_hash_string(void ** state)
+{
+	// FNV-1a test vectors
+	assert_int_equal(hash_string(""), 0x811c9dc5);
+	assert_int_equal(hash_string("a"), 0xe40c292c);
+	assert_int_equal(hash_string("foobar"), 0xbf9cf968);
+}
+
+static void
+_insert_and_find(int count)
+{
+	struct hash hash = {0};
+	struct record * records = calloc(count, sizeof(*records));
+
+	// Enough to grow the table several times
+	for (int i = 0; i < count; i++)
+	{
+		snprintf(records[i].key, sizeof(records[i].key), "key%d", i);
+		records[i].value = i;
+		assert_true(hash_insert(&hash, &records[i].node, records[i].key));
+	}
+	assert_int_equal(hash.count, count);
+
+	for (int i = 0; i < count; i++)
+	{
+		char key[16];
+		snprintf(key, sizeof(key), "key%d", i);
+		struct record * r = hash_entry(hash_find(&hash, key), struct record, node);
+		assert_non_null(r);
+		assert_int_equal(r->value, i);
+	}
+	assert_null(hash_find(&hash, "missing"));
+
+	hash_fini(&hash);
+	free(records);
+}
+
+void
+test_hash_insert_and_find(void ** state)
+{
+	_insert_and_find(1000);
+}
+
+void
+test_hash_in_arena(void ** state)
+{
+	arena_begin();
+	_insert_and_find(1000);
+	arena_end();
+}
+
+/*******************************************
+ *              FIXTURES
+ *******************************************/
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"hash empty",           test_hash_empty},
+		{"hash string",          test_hash_string},
+		{"hash insert and find", test_hash_insert_and_find},
+		{"hash in arena",        test_hash_in_arena},
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,122 @@
+/*
+ * System includes.
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+/*
+ * Local includes.
+ */
+#include "helper.h"
+#include "debug.h" // always last
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+
+// prevents our test from generating syslog messages
+void vsyslog(int priority, const char *format, va_list ap) {}
+
+/*******************************************
+ *              HELPERS
+ *******************************************/
+
+static int fds[2];
+
+static int
+setup(void ** state)
+{
+	return socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+}
+
+static int
+teardown(void ** state)
+{
+	close(fds[0]);
+	close(fds[1]);
+	return 0;
+}
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+
+void
+test_uint32(void ** state)
+{
+	uint32_t value = 0;
+	assert_true(helper_write_uint32(fds[0], 0xDEADBEEF));
+	assert_true(helper_read_uint32(fds[1], &value));
+	assert_int_equal(value, 0xDEADBEEF);
+}
+
+void
+test_string(void ** state)
+{
+	char * string = NULL;
+	assert_true(helper_write_string(fds[0], "hello"));
+	assert_true(helper_read_string(fds[1], &string));
+	assert_string_equal(string, "hello");
+	free(string);
+}
+
+void
+test_empty_string(void ** state)
+{
+	char * string = NULL;
+	assert_true(helper_write_string(fds[0], ""));
+	assert_true(helper_read_string(fds[1], &string));
+	assert_string_equal(string, "");
+	free(string);
+}
+
+void
+test_null_string(void ** state)
+{
+	char * string = "not null";
+	assert_true(helper_write_string(fds[0], NULL));
+	assert_true(helper_read_string(fds[1], &string));
+	assert_null(string);
+}
+
+void
+test_oversized_string(void ** state)
+{
+	char * string = NULL;
+	assert_true(helper_write_uint32(fds[0], HELPER_MAX_STRING+1));
+	assert_false(helper_read_string(fds[1], &string));
+	assert_null(string);
+}
+
+void
+test_short_string(void ** state)
+{
+	char * string = NULL;
+	assert_true(helper_write_uint32(fds[0], 10));
+	assert_int_equal(write(fds[0], "abc", 3), 3);
+	close(fds[0]);
+	fds[0] = -1;
+
+	assert_false(helper_read_string(fds[1], &string));
+	assert_null(string);
+}
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"uint32",           test_uint32,           setup, teardown},
+		{"string",           test_string,           setup, teardown},
+		{"empty string",     test_empty_string,     setup, teardown},
+		{"null string",      test_null_string,      setup, teardown},
+		{"oversized string", test_oversized_string, setup, teardown},
+		{"short string",     test_short_string,     setup, teardown},
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
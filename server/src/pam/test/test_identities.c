@@ -74,6 +74,47 @@ test_valid(void ** state)
 	jobj_fini(j);
 }
 
+void
+test_from_introspect(void ** state)
+{
+	struct introspect introspect = {
+		.identities_set = (char *[]){"id1", "id2", NULL},
+		.identity_set_detail = (struct identity_set_detail *[]){
+			&(struct identity_set_detail){
+				.sub = "id2",
+				.username = "username2",
+				.identity_provider = "idp1",
+			},
+			&(struct identity_set_detail){
+				.sub = "id1",
+				.username = "username1",
+				.identity_provider = "idp1",
+				.identity_provider_display_name = "name1",
+				.status = "used",
+			},
+			NULL
+		},
+	};
+
+	struct identities * i = identities_from_introspect(&introspect);
+	assert_non_null(i);
+	assert_string_equal(i->identities[0]->id, "id1");
+	assert_string_equal(i->identities[0]->username, "username1");
+	assert_string_equal(i->identities[1]->id, "id2");
+	assert_string_equal(i->identities[1]->status, "used");
+	assert_null(i->identities[2]);
+	assert_string_equal(i->included.identity_providers[0]->id, "idp1");
+	assert_string_equal(i->included.identity_providers[0]->name, "name1");
+	assert_null(i->included.identity_providers[1]);
+	identities_fini(i);
+
+	// The detail must cover every identity in the set
+	introspect.identities_set = (char *[]){"id1", "id3", NULL};
+	assert_null(identities_from_introspect(&introspect));
+
+	introspect.identity_set_detail = NULL;
+	assert_null(identities_from_introspect(&introspect));
+}
 
 /*******************************************
  *              FIXTURES
@@ -84,6 +125,7 @@ main()
 {
 	const struct CMUnitTest tests[] = {
 		{"valid", test_valid},
+		{"from introspect", test_from_introspect},
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
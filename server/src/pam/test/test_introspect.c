@@ -201,6 +201,7 @@ test_inactive_token(void ** state)
 	assert_null(i->nbf);
 	assert_null(i->email);
 	assert_null(i->identities_set);
+	assert_null(i->identity_set_detail);
 	assert_null(i->session_info);
 
 	introspect_fini(i);
@@ -402,6 +403,74 @@ test_identities_set(void ** state)
 	free(json_string);
 }
 
+void
+test_identity_set_detail(void ** state)
+{
+	//
+	// Test '"identity_set_detail": null'
+	//
+	minimum_required_fields[OTHER] = "'identity_set_detail': null";
+	// Creat the JSON string
+	char * json_string = create_json_string(minimum_required_fields);
+	// Create the introspect struct
+	struct introspect * i = create_introspect_doc(json_string);
+	// Check that introspect parsing succeeded
+	assert_non_null(i);
+	// Detail should be null since it is optional
+	assert_null(i->identity_set_detail);
+	// Restore the good field value
+	minimum_required_fields[OTHER] = NULL;
+	// Free the introspect record
+	introspect_fini(i);
+	// Free the JSON string
+	free(json_string);
+
+	//
+	// Test two identities, one without the optional fields
+	//
+	minimum_required_fields[OTHER] =
+		"'identity_set_detail': [                   "
+		"  {                                        "
+		"    'sub': 'id1',                          "
+		"    'username': 'user1@idp1.org',          "
+		"    'identity_provider': 'idp1',           "
+		"    'identity_provider_display_name': 'I1',"
+		"    'status': 'used'                       "
+		"  },                                       "
+		"  {                                        "
+		"    'sub': 'id2',                          "
+		"    'username': 'user2@idp2.org',          "
+		"    'identity_provider': 'idp2',           "
+		"    'status': null                         "
+		"  }                                        "
+		"]                                          ";
+
+	// Creat the JSON string
+	json_string = create_json_string(minimum_required_fields);
+	// Create the introspect struct
+	i = create_introspect_doc(json_string);
+	// Check that introspect parsing succeeded
+	assert_non_null(i);
+	// Verify identity 1
+	assert_string_equal(i->identity_set_detail[0]->sub, "id1");
+	assert_string_equal(i->identity_set_detail[0]->username, "user1@idp1.org");
+	assert_string_equal(i->identity_set_detail[0]->identity_provider, "idp1");
+	assert_string_equal(i->identity_set_detail[0]->identity_provider_display_name, "I1");
+	assert_string_equal(i->identity_set_detail[0]->status, "used");
+	// Verify identity 2
+	assert_string_equal(i->identity_set_detail[1]->sub, "id2");
+	assert_null(i->identity_set_detail[1]->identity_provider_display_name);
+	assert_null(i->identity_set_detail[1]->status);
+	// Detail should be length 2
+	assert_null(i->identity_set_detail[2]);
+	// Restore the good field value
+	minimum_required_fields[OTHER] = NULL;
+	// Free the introspect record
+	introspect_fini(i);
+	// Free the JSON string
+	free(json_string);
+}
+
 void
 test_session_info(void ** state)
 {
@@ -615,6 +684,7 @@ main()
 		{"missing required field", test_missing_required_field},
 		{"wrong field type", test_wrong_field_type},
 		{"identities_set", test_identities_set},
+		{"identity_set_detail", test_identity_set_detail},
 		{"session_info", test_session_info},
 		{"authentications", test_authentications},
 	};
@@ -172,6 +172,49 @@ test_jarr_get_string(void ** state)
 	jobj_fini(jobj);
 }
 
+void
+test_jparser_chunks(void ** state)
+{
+	const char * s = "{ \"k1\": \"hello world\", \"k2\": [1, 2, 3] }\n";
+
+	// One byte at a time splits every token
+	struct jparser * parser = jparser_init();
+	for (int i = 0; s[i]; i++)
+		jparser_feed(parser, &s[i], 1);
+
+	char * error_msg = NULL;
+	jobj_t * jobj = jparser_fini(parser, s, &error_msg);
+	assert_non_null(jobj);
+	assert_null(error_msg);
+	assert_string_equal(jobj_get_string(jobj, "k1"), "hello world");
+	assert_int_equal(jarr_get_length(jobj_get_value(jobj, "k2")), 3);
+	jobj_fini(jobj);
+}
+
+void
+test_jparser_errors(void ** state)
+{
+	char * error_msg = NULL;
+
+	// Truncated
+	struct jparser * parser = jparser_init();
+	jparser_feed(parser, "{ \"k\": ", 7);
+	assert_null(jparser_fini(parser, "{ \"k\": ", &error_msg));
+	assert_non_null(error_msg);
+	free(error_msg);
+
+	// Invalid
+	parser = jparser_init();
+	jparser_feed(parser, "{ k }", 5);
+	assert_null(jparser_fini(parser, "{ k }", &error_msg));
+	assert_non_null(strstr(error_msg, "{ k }"));
+	free(error_msg);
+
+	// No parser, ie. it was never created
+	assert_null(jparser_fini(NULL, NULL, &error_msg));
+	assert_null(error_msg);
+}
+
 /*******************************************
  *              FIXTURES
  *******************************************/
@@ -192,6 +235,8 @@ main()
 		{"jarr_get_int()",    test_jarr_get_int},
 		{"jarr_get_bool()",   test_jarr_get_bool},
 		{"jarr_get_string()", test_jarr_get_string},
+		{"jparser chunks",    test_jparser_chunks},
+		{"jparser errors",    test_jparser_errors},
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,201 @@
+/*
+ * System includes.
+ */
+#include <sys/stat.h>
+#include <syslog.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+/*
+ * Local includes.
+ */
+#include "map_index.h"
+#include "debug.h" // always last
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+
+// prevents our test from generating syslog messages
+void vsyslog(int priority, const char *format, va_list ap) {}
+
+// Keep the index out of CACHE_DEFAULT_DIR
+static char map_path[]   = "/tmp/test_map_index.map.XXXXXX";
+static char index_path[] = "/tmp/test_map_index.idx.XXXXXX";
+static int  index_writes = 0;
+
+int
+cache_file_open(const char * name, struct stat * st)
+{
+	int fd = open(index_path, O_RDONLY);
+	if (fd != -1)
+		fstat(fd, st);
+	return fd;
+}
+
+void
+cache_file_store(const char * name, const void * data, size_t length)
+{
+	FILE * fptr = fopen(index_path, "w");
+	fwrite(data, 1, length, fptr);
+	fclose(fptr);
+	index_writes++;
+}
+
+int
+cache_file_trylock(const char * name)
+{
+	return open("/dev/null", O_RDONLY);
+}
+
+/*******************************************
+ *              HELPERS
+ *******************************************/
+
+static void
+write_map_file(const char * contents)
+{
+	FILE * fptr = fopen(map_path, "w");
+	fputs(contents, fptr);
+	fclose(fptr);
+}
+
+static int
+setup(void ** state)
+{
+	close(mkstemp(map_path));
+	close(mkstemp(index_path));
+	index_writes = 0;
+	return 0;
+}
+
+static int
+teardown(void ** state)
+{
+	unlink(map_path);
+	unlink(index_path);
+	strcpy(map_path, "/tmp/test_map_index.map.XXXXXX");
+	strcpy(index_path, "/tmp/test_map_index.idx.XXXXXX");
+	return 0;
+}
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+
+void
+test_missing_map_file(void ** state)
+{
+	assert_null(map_index_open("/this/file/does/not/exist"));
+}
+
+void
+test_lookup(void ** state)
+{
+	write_map_file(
+		"# comment\n"
+		"joe@example.com                       joe\n"
+		"8229a82e-d04c-478b-b2a9-f86219eee3d8  joe,bob\n");
+
+	struct map_index * index = map_index_open(map_path);
+	assert_non_null(index);
+
+	const struct map_index_entry * entry;
+
+	entry = map_index_find(index, "joe@example.com");
+	assert_non_null(entry);
+	assert_string_equal(map_index_value(index, entry, 0), "joe");
+	assert_null(map_index_value(index, entry, 1));
+
+	entry = map_index_find(index, "8229a82e-d04c-478b-b2a9-f86219eee3d8");
+	assert_non_null(entry);
+	assert_string_equal(map_index_value(index, entry, 0), "joe");
+	assert_string_equal(map_index_value(index, entry, 1), "bob");
+	assert_null(map_index_value(index, entry, 2));
+
+	assert_null(map_index_find(index, "jane@example.com"));
+	assert_null(map_index_find(index, "# comment"));
+
+	map_index_close(index);
+}
+
+void
+test_duplicate_keys_are_merged(void ** state)
+{
+	write_map_file(
+		"joe@example.com joe\n"
+		"jane@example.com jane\n"
+		"joe@example.com bob joe\n");
+
+	struct map_index * index = map_index_open(map_path);
+	assert_non_null(index);
+
+	const struct map_index_entry * entry = map_index_find(index, "joe@example.com");
+	assert_non_null(entry);
+	assert_string_equal(map_index_value(index, entry, 0), "joe");
+	assert_string_equal(map_index_value(index, entry, 1), "bob");
+	assert_null(map_index_value(index, entry, 2));
+
+	map_index_close(index);
+}
+
+void
+test_index_is_reused(void ** state)
+{
+	write_map_file("joe@example.com joe\n");
+
+	map_index_close(map_index_open(map_path));
+	assert_int_equal(index_writes, 1);
+
+	struct map_index * index = map_index_open(map_path);
+	assert_non_null(index);
+	assert_int_equal(index_writes, 1);
+	assert_non_null(map_index_find(index, "joe@example.com"));
+	map_index_close(index);
+}
+
+void
+test_index_is_rebuilt_after_change(void ** state)
+{
+	write_map_file("joe@example.com joe\n");
+	map_index_close(map_index_open(map_path));
+
+	write_map_file("jane@example.com jane\n");
+
+	struct map_index * index = map_index_open(map_path);
+	assert_non_null(index);
+	assert_int_equal(index_writes, 2);
+	assert_null(map_index_find(index, "joe@example.com"));
+	assert_non_null(map_index_find(index, "jane@example.com"));
+	map_index_close(index);
+}
+
+void
+test_empty_map_file(void ** state)
+{
+	write_map_file("");
+
+	struct map_index * index = map_index_open(map_path);
+	assert_non_null(index);
+	assert_null(map_index_find(index, "joe@example.com"));
+	map_index_close(index);
+}
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"missing map file",          test_missing_map_file},
+		{"lookup",                    test_lookup,                        setup, teardown},
+		{"duplicate keys are merged", test_duplicate_keys_are_merged,     setup, teardown},
+		{"index is reused",           test_index_is_reused,               setup, teardown},
+		{"index is rebuilt",          test_index_is_rebuilt_after_change, setup, teardown},
+		{"empty map file",            test_empty_map_file,                setup, teardown},
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,145 @@
+/*
+ * System includes.
+ */
+#include <security/pam_appl.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+/*
+ * Local includes.
+ */
+#include "metrics.h"
+#include "debug.h" // always last
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+
+// prevents our test from generating syslog messages
+void vsyslog(int priority, const char *format, va_list ap) {}
+
+// Keep the segment out of /dev/shm. The module maps it once per process so
+// every test shares it; tests compare before / after values.
+static char segment_path[] = "/tmp/test_metrics.XXXXXX";
+
+int
+open(const char * path, int flags, ...)
+{
+	va_list ap;
+	va_start(ap, flags);
+	mode_t mode = va_arg(ap, int);
+	va_end(ap);
+
+	if (strcmp(path, METRICS_DEFAULT_FILE) == 0)
+		path = segment_path;
+	return openat(AT_FDCWD, path, flags, mode);
+}
+
+/*******************************************
+ *              HELPERS
+ *******************************************/
+
+static int
+group_setup(void ** state)
+{
+	close(mkstemp(segment_path));
+	return 0;
+}
+
+static int
+group_teardown(void ** state)
+{
+	unlink(segment_path);
+	return 0;
+}
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+
+void
+test_counters(void ** state)
+{
+	struct metrics before;
+	struct metrics after;
+
+	memset(&before, 0, sizeof(before));
+	metrics_read(&before);
+
+	metrics_count(METRIC_OP_LOGIN);
+	metrics_count(METRIC_OP_LOGIN);
+	metrics_count(METRIC_UPSTREAM_ERRORS);
+
+	assert_true(metrics_read(&after));
+	assert_int_equal(after.counters[METRIC_OP_LOGIN] - before.counters[METRIC_OP_LOGIN], 2);
+	assert_int_equal(after.counters[METRIC_UPSTREAM_ERRORS] - before.counters[METRIC_UPSTREAM_ERRORS], 1);
+	assert_int_equal(after.counters[METRIC_OP_UNKNOWN] - before.counters[METRIC_OP_UNKNOWN], 0);
+}
+
+void
+test_histogram_buckets(void ** state)
+{
+	struct metrics before;
+	struct metrics after;
+
+	memset(&before, 0, sizeof(before));
+	metrics_read(&before);
+
+	metrics_observe(METRIC_UPSTREAM_SECONDS, 0);       // bucket 0
+	metrics_observe(METRIC_UPSTREAM_SECONDS, 0.000003); // 3us < 2^2
+	metrics_observe(METRIC_UPSTREAM_SECONDS, 0.020);    // 20000us < 2^15
+	metrics_observe(METRIC_UPSTREAM_SECONDS, 3600);     // last bucket
+
+	assert_true(metrics_read(&after));
+
+	const struct metrics_histogram * b = &before.histograms[METRIC_UPSTREAM_SECONDS];
+	const struct metrics_histogram * a = &after.histograms[METRIC_UPSTREAM_SECONDS];
+
+	assert_int_equal(a->buckets[0]  - b->buckets[0],  1);
+	assert_int_equal(a->buckets[2]  - b->buckets[2],  1);
+	assert_int_equal(a->buckets[15] - b->buckets[15], 1);
+	assert_int_equal(a->buckets[METRICS_BUCKETS-1] - b->buckets[METRICS_BUCKETS-1], 1);
+	assert_int_equal(a->sum_usec - b->sum_usec, 3 + 20000 + 3600000000ull);
+}
+
+void
+test_status(void ** state)
+{
+	assert_int_equal(metrics_status(PAM_SUCCESS),          METRIC_STATUS_SUCCESS);
+	assert_int_equal(metrics_status(PAM_AUTH_ERR),         METRIC_STATUS_AUTH_ERR);
+	assert_int_equal(metrics_status(PAM_AUTHINFO_UNAVAIL), METRIC_STATUS_AUTHINFO_UNAVAIL);
+	assert_int_equal(metrics_status(PAM_MAXTRIES),         METRIC_STATUS_MAXTRIES);
+	assert_int_equal(metrics_status(-1),                   METRIC_STATUS_OTHER);
+}
+
+void
+test_names(void ** state)
+{
+	for (int c = 0; c < METRIC_COUNTER_COUNT; c++)
+	{
+		assert_non_null(metrics_counter_name(c));
+		assert_non_null(metrics_counter_labels(c));
+	}
+
+	for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++)
+		assert_non_null(metrics_histogram_name(h));
+}
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"counters",          test_counters},
+		{"histogram buckets", test_histogram_buckets},
+		{"status",            test_status},
+		{"names",             test_names},
+	};
+
+	return cmocka_run_group_tests(tests, group_setup, group_teardown);
+}
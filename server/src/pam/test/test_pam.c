@@ -1,8 +1,15 @@
 /*
  * System includes.
  */
+#include <sys/types.h>
+#include <syslog.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define PAM_SM_AUTH
 #include <security/pam_modules.h>
@@ -10,81 +17,305 @@
 /*
  * Local includes.
  */
-#include "logger.h"
+#include "commands.h"
+#include "metrics.h"
 #include "config.h"
-#include "reply.h"
 #include "debug.h" // always last
 
-typedef int pam_status_t;
+/*
+ * These tests drive pam_sm_authenticate()'s command loop. process_command()
+ * and the client's side of the conversation are scripted, so each test lists
+ * the inputs the client answers with and what each command returns.
+ */
 
 /*******************************************
  *              MOCKS
  *******************************************/
+
+// prevents our test from generating syslog messages
+void vsyslog(int priority, const char *format, va_list ap) {}
+
+// Keep the metrics segment out of /dev/shm
+static char metrics_path[] = "/tmp/test_pam_metrics.XXXXXX";
+
+int
+open(const char * path, int flags, ...)
+{
+	va_list ap;
+	va_start(ap, flags);
+	mode_t mode = va_arg(ap, int);
+	va_end(ap);
+
+	if (strcmp(path, METRICS_DEFAULT_FILE) == 0)
+		path = metrics_path;
+	return openat(AT_FDCWD, path, flags, mode);
+}
+
+static struct config config;
+
+struct config *
+config_init(int flags, int argc, const char ** argv)
+{
+	return &config;
+}
+
 void
-logger_init(int flags, int argc, const char ** argv)
+config_fini(struct config * c) {}
+
+// oauth-ssh-helperd is not running
+bool
+helper_process_command(int           argc,
+                       const char ** argv,
+                       const char *  requested_user,
+                       const char *  user_input,
+                       int        *  pam_status,
+                       char       ** reply,
+                       int        *  version)
 {
-	check_expected(flags);
-	check_expected(argc);
-	check_expected(argv);
+	return false;
 }
 
-void logger(log_type_t type, const char * format, ...) {}
-struct config * config_init(int flags, int argc, const char ** argv)
-{return NULL;}
-int pam_get_item(const pam_handle_t *pamh, int item_type,
-                        const void **item) {return 0;}
+int
+process_command(struct config * config,
+                const char    * requested_user,
+                const char    * user_input,
+                char         ** reply,
+                int           * version)
+{
+	check_expected(user_input);
+	*version = mock_type(int);
+	*reply   = strdup(mock_ptr_type(char *));
+	return mock_type(int);
+}
 
-//      struct pam_message {
-//           int msg_style;
-//           const char *msg;
-//       };
+/*
+ * The client answers our prompt with the next scripted input; NULL fails the
+ * conversation. Our replies must be the expected ones.
+ */
+static int
+_conversation(int                         num_msg,
+              const struct pam_message ** msg,
+              struct pam_response      ** resp,
+              void                      * appdata_ptr)
+{
+	if (msg[0]->msg_style == PAM_TEXT_INFO)
+	{
+		const char * reply = msg[0]->msg;
+		check_expected(reply);
+		*resp = NULL;
+		return PAM_SUCCESS;
+	}
 
-//       struct pam_response {
-//           char *resp;
-//           int resp_retcode;
-//       };
+	const char * input = mock_ptr_type(char *);
+	if (!input)
+		return PAM_CONV_ERR;
 
-//       struct pam_conv {
-//           int (*conv)(int num_msg, const struct pam_message **msg,
-//                       struct pam_response **resp, void *appdata_ptr);
-//           void *appdata_ptr;
-//       };
+	*resp = calloc(1, sizeof(struct pam_response));
+	(*resp)->resp = strdup(input);
+	return PAM_SUCCESS;
+}
 
-void config_fini(struct config * c) {}
-void reply_fini(struct reply * r) {}
+static struct pam_conv conv = {_conversation, NULL};
 
-pam_status_t
-process_command(pam_handle_t  *  pamh,
-                struct config *  config,
-                const char    *  user_input,
-                struct reply  ** reply) {return 0;}
+int
+pam_get_item(const pam_handle_t * pamh, int item_type, const void ** item)
+{
+	*item = &conv;
+	return PAM_SUCCESS;
+}
+
+int
+pam_get_user(pam_handle_t * pamh, const char ** user, const char * prompt)
+{
+	*user = "user";
+	return PAM_SUCCESS;
+}
+
+/*******************************************
+ *              HELPERS
+ *******************************************/
 
+// The client answers our next prompt with 'input'
+static void
+_answer(const char * input)
+{
+	will_return(_conversation, input);
+}
 
+// process_command() is given 'input' and returns 'pam_status' and 'reply'
+static void
+_command(const char * input, int version, int pam_status, const char * reply)
+{
+	expect_string(process_command, user_input, input);
+	will_return(process_command, version);
+	will_return(process_command, reply);
+	will_return(process_command, pam_status);
+}
+
+// We send 'reply' to the client
+static void
+_reply(const char * reply)
+{
+	expect_string(_conversation, reply, reply);
+}
+
+static int
+_authenticate()
+{
+	return pam_sm_authenticate(NULL, 0, 0, NULL);
+}
 
 /*******************************************
  *              TESTS
  *******************************************/
+
+void
+test_login(void ** state)
+{
+	_answer("login");
+	_command("login", 2, PAM_SUCCESS, "logged in");
+	_reply("logged in");
+
+	assert_int_equal(_authenticate(), PAM_SUCCESS);
+}
+
+void
+test_commands_then_login(void ** state)
+{
+	_answer("get_security_policy");
+	_command("get_security_policy", 2, PAM_MAXTRIES, "policy");
+	_reply("policy");
+
+	_answer("get_account_map");
+	_command("get_account_map", 2, PAM_MAXTRIES, "account map");
+	_reply("account map");
+
+	_answer("login");
+	_command("login", 2, PAM_SUCCESS, "logged in");
+	_reply("logged in");
+
+	assert_int_equal(_authenticate(), PAM_SUCCESS);
+}
+
+void
+test_failed_login_ends_exchange(void ** state)
+{
+	_answer("get_account_map");
+	_command("get_account_map", 2, PAM_MAXTRIES, "account map");
+	_reply("account map");
+
+	_answer("login");
+	_command("login", 2, PAM_AUTH_ERR, "denied");
+	_reply("denied");
+
+	assert_int_equal(_authenticate(), PAM_AUTH_ERR);
+}
+
+// Version 1 clients open a new connection for each command
+void
+test_version_1_client(void ** state)
+{
+	_answer("get_security_policy");
+	_command("get_security_policy", 1, PAM_MAXTRIES, "policy");
+	_reply("policy");
+
+	assert_int_equal(_authenticate(), PAM_MAXTRIES);
+}
+
 void
-test_(void ** state)
+test_pasted_token(void ** state)
 {
-	int flags = 0;
-	int argc = 0;
-	const char * argv[argc];
-	expect_value(logger_init, flags, flags);
-	expect_value(logger_init, argc, argc);
-	expect_value(logger_init, argv, argv);
+	_answer("token");
+	_command("token", 0, PAM_MAXTRIES, "");
+	_reply("");
+
+	assert_int_equal(_authenticate(), PAM_MAXTRIES);
+}
+
+void
+test_max_commands(void ** state)
+{
+	char inputs[8][16];
+
+	for (int i = 0; i < 8; i++)
+	{
+		snprintf(inputs[i], sizeof(inputs[i]), "command %d", i);
+		_answer(inputs[i]);
+		_command(inputs[i], 2, PAM_MAXTRIES, inputs[i]);
+		_reply(inputs[i]);
+	}
+
+	// The ninth prompt is never sent
+	assert_int_equal(_authenticate(), PAM_MAXTRIES);
+}
+
+// The client is done when it answers with nothing
+void
+test_empty_answer(void ** state)
+{
+	_answer("get_security_policy");
+	_command("get_security_policy", 2, PAM_MAXTRIES, "policy");
+	_reply("policy");
+	_answer("");
+
+	assert_int_equal(_authenticate(), PAM_MAXTRIES);
+}
+
+// Password authentication answers every prompt with the same password
+void
+test_repeated_answer(void ** state)
+{
+	_answer("password");
+	_command("password", 2, PAM_MAXTRIES, "policy");
+	_reply("policy");
+	_answer("password");
+
+	assert_int_equal(_authenticate(), PAM_MAXTRIES);
+}
+
+void
+test_conversation_error(void ** state)
+{
+	_answer("get_security_policy");
+	_command("get_security_policy", 2, PAM_MAXTRIES, "policy");
+	_reply("policy");
+	_answer(NULL);
+
+	assert_int_equal(_authenticate(), PAM_MAXTRIES);
 }
 
 /*******************************************
  *              FIXTURES
  *******************************************/
 
+static int
+group_setup(void ** state)
+{
+	close(mkstemp(metrics_path));
+	return 0;
+}
+
+static int
+group_teardown(void ** state)
+{
+	unlink(metrics_path);
+	return 0;
+}
+
 int
 main()
 {
 	const struct CMUnitTest tests[] = {
-		{"base64", test_},
+		{"login",                      test_login},
+		{"commands then login",        test_commands_then_login},
+		{"failed login ends exchange", test_failed_login_ends_exchange},
+		{"version 1 client",           test_version_1_client},
+		{"pasted token",               test_pasted_token},
+		{"max commands",               test_max_commands},
+		{"empty answer",               test_empty_answer},
+		{"repeated answer",            test_repeated_answer},
+		{"conversation error",         test_conversation_error},
 	};
 
-	return cmocka_run_group_tests(tests, NULL, NULL);
+	return cmocka_run_group_tests(tests, group_setup, group_teardown);
 }
@@ -0,0 +1,196 @@
+/*
+ * System includes.
+ */
+#include <sys/types.h>
+#include <syslog.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pwd.h>
+
+/*
+ * Local includes.
+ */
+#include "passwd.h"
+#include "metrics.h"
+#include "config.h"
+#include "cache.h"
+#include "debug.h" // always last
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+void
+vsyslog(int priority, const char *format, va_list ap) { }
+
+// Keep the cache and metrics segments out of /dev/shm
+static char cache_path[]   = "/tmp/test_passwd_cache.XXXXXX";
+static char metrics_path[] = "/tmp/test_passwd_metrics.XXXXXX";
+
+int
+open(const char * path, int flags, ...)
+{
+	va_list ap;
+	va_start(ap, flags);
+	mode_t mode = va_arg(ap, int);
+	va_end(ap);
+
+	if (strcmp(path, CACHE_DEFAULT_FILE) == 0)
+		path = cache_path;
+	else if (strcmp(path, METRICS_DEFAULT_FILE) == 0)
+		path = metrics_path;
+	return openat(AT_FDCWD, path, flags, mode);
+}
+
+static int lookups = 0;
+
+// Accounts named 'user*' exist. 'big*' exist but need a 64 KiB buffer and
+// the name service fails for 'error*'.
+int
+getpwnam_r(const char     *  name,
+           struct passwd  *  pwd,
+           char           *  buf,
+           size_t            buflen,
+           struct passwd  ** result)
+{
+	__atomic_fetch_add(&lookups, 1, __ATOMIC_RELAXED);
+	*result = NULL;
+
+	if (strncmp(name, "error", 5) == 0)
+		return EIO;
+	if (strncmp(name, "big", 3) == 0)
+	{
+		if (buflen < 64*1024)
+			return ERANGE;
+		*result = pwd;
+		return 0;
+	}
+
+	*result = strncmp(name, "user", 4) == 0 ? pwd : NULL;
+	return 0;
+}
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+
+static void
+_check_accounts(int threads)
+{
+	struct config config = {.passwd_lookup_threads = threads};
+
+	const char * accts[40];
+	bool exists[40];
+	char names[40][16];
+	for (int i = 0; i < 40; i++)
+	{
+		snprintf(names[i], sizeof(names[i]), "%s%d", i % 3 ? "user" : "nobody", i);
+		accts[i] = names[i];
+	}
+
+	lookups = 0;
+	passwd_lookup(&config, accts, 40, exists);
+	assert_int_equal(lookups, 40);
+
+	for (int i = 0; i < 40; i++)
+		assert_int_equal(exists[i], i % 3 != 0);
+}
+
+void
+test_sequential_lookups(void ** state)
+{
+	_check_accounts(1);
+}
+
+void
+test_parallel_lookups(void ** state)
+{
+	_check_accounts(4);
+
+	// More threads than accounts
+	_check_accounts(64);
+}
+
+void
+test_cached_lookups(void ** state)
+{
+	struct config config = {.passwd_lookup_threads = 1, .passwd_cache_ttl = 60};
+	const char * accts[] = {"user_cached", "nobody_cached", "error_cached"};
+	bool exists[3];
+
+	lookups = 0;
+	passwd_lookup(&config, accts, 3, exists);
+	assert_int_equal(lookups, 3);
+	assert_true(exists[0]);
+	assert_false(exists[1]);
+	assert_false(exists[2]);
+
+	// Only the failed lookup is retried
+	lookups = 0;
+	passwd_lookup(&config, accts, 3, exists);
+	assert_int_equal(lookups, 1);
+	assert_true(exists[0]);
+	assert_false(exists[1]);
+	assert_false(exists[2]);
+}
+
+void
+test_large_entry(void ** state)
+{
+	struct config config = {.passwd_lookup_threads = 1};
+	const char * accts[] = {"big_entry"};
+	bool exists[1];
+
+	// 16 KiB, 32 KiB, then 64 KiB
+	lookups = 0;
+	passwd_lookup(&config, accts, 1, exists);
+	assert_int_equal(lookups, 3);
+	assert_true(exists[0]);
+}
+
+void
+test_no_accounts(void ** state)
+{
+	struct config config = {.passwd_lookup_threads = 4};
+	lookups = 0;
+	passwd_lookup(&config, NULL, 0, NULL);
+	assert_int_equal(lookups, 0);
+}
+
+/*******************************************
+ *              FIXTURES
+ *******************************************/
+
+static int
+group_setup(void ** state)
+{
+	close(mkstemp(cache_path));
+	close(mkstemp(metrics_path));
+	return 0;
+}
+
+static int
+group_teardown(void ** state)
+{
+	unlink(cache_path);
+	unlink(metrics_path);
+	return 0;
+}
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"sequential lookups", test_sequential_lookups},
+		{"parallel lookups",   test_parallel_lookups},
+		{"cached lookups",     test_cached_lookups},
+		{"large entry",        test_large_entry},
+		{"no accounts",        test_no_accounts},
+	};
+
+	return cmocka_run_group_tests(tests, group_setup, group_teardown);
+}
@@ -0,0 +1,151 @@
+/*
+ * System includes.
+ */
+#include <syslog.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+/*
+ * Local includes.
+ */
+#include "policy.h"
+#include "config.h"
+#include "strings.h"
+#include "base64.h"
+#include "debug.h" // always last
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+void
+vsyslog(int priority, const char *format, va_list ap) { }
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+void
+test_reply(void ** state)
+{
+	char * idps[] = {"globus.org", "example.com", NULL};
+	struct config config = {
+		.permitted_idps = idps,
+		.authentication_timeout = 60,
+		.policy_max_age = 3600,
+	};
+
+	struct policy * policy = policy_init(&config);
+	assert_non_null(policy);
+	assert_string_equal(policy->json,
+	                    "{"
+	                        "\"permitted_idps\": [\"globus.org\", \"example.com\"],"
+	                        "\"authentication_timeout\": 60"
+	                    "}");
+
+	char * reply = base64_decode(policy_reply(policy, NULL));
+	char * expected = sformat("{"
+	                              "\"policy\": %s,"
+	                              "\"version\": 2,"
+	                              "\"capabilities\": [\"multi_command\", \"resolve_and_login\"],"
+	                              "\"max_age\": 3600,"
+	                              "\"etag\": \"%s\""
+	                          "}",
+	                          policy->json,
+	                          policy->etag);
+	assert_string_equal(reply, expected);
+	free(reply);
+	free(expected);
+
+	// A stale etag gets the full reply
+	assert_ptr_equal(policy_reply(policy, "stale"), policy->reply);
+
+	reply = base64_decode(policy_reply(policy, policy->etag));
+	expected = sformat("{"
+	                       "\"not_modified\": true,"
+	                       "\"max_age\": 3600,"
+	                       "\"etag\": \"%s\""
+	                   "}",
+	                   policy->etag);
+	assert_string_equal(reply, expected);
+	free(reply);
+	free(expected);
+
+	policy_fini(policy);
+}
+
+void
+test_empty_policy(void ** state)
+{
+	struct config config = {0};
+
+	struct policy * policy = policy_init(&config);
+	assert_non_null(policy);
+	assert_string_equal(policy->json,
+	                    "{"
+	                        "\"permitted_idps\": null,"
+	                        "\"authentication_timeout\": null"
+	                    "}");
+	policy_fini(policy);
+}
+
+void
+test_etag_follows_config(void ** state)
+{
+	struct config config = {.authentication_timeout = 60};
+	struct policy * policy1 = policy_init(&config);
+
+	config.authentication_timeout = 30;
+	struct policy * policy2 = policy_init(&config);
+
+	assert_string_not_equal(policy1->etag, policy2->etag);
+	policy_fini(policy1);
+	policy_fini(policy2);
+}
+
+void
+test_is_capable(void ** state)
+{
+	assert_true(policy_is_capable("resolve_and_login", 2));
+	assert_true(policy_is_capable("resolve_and_login", 3));
+	assert_false(policy_is_capable("resolve_and_login", 1));
+	assert_false(policy_is_capable("unknown", 2));
+}
+
+void
+test_cacheable_reply(void ** state)
+{
+	char * reply = policy_cacheable_reply("\"a\": 1", 10, NULL);
+	assert_non_null(strstr(reply, "\"a\": 1,\"max_age\": 10,\"etag\": \""));
+
+	char * etag = strdup(strstr(reply, "\"etag\": \"") + 9);
+	*strchr(etag, '"') = '\0';
+	free(reply);
+
+	reply = policy_cacheable_reply("\"a\": 1", 10, etag);
+	assert_null(strstr(reply, "\"a\""));
+	assert_non_null(strstr(reply, "\"not_modified\": true"));
+	free(reply);
+
+	reply = policy_cacheable_reply("\"a\": 2", 10, etag);
+	assert_non_null(strstr(reply, "\"a\": 2"));
+	free(reply);
+	free(etag);
+}
+
+/*******************************************
+ *              FIXTURES
+ *******************************************/
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"reply",                test_reply},
+		{"empty policy",         test_empty_policy},
+		{"etag follows config",  test_etag_follows_config},
+		{"is capable",           test_is_capable},
+		{"cacheable reply",      test_cacheable_reply},
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
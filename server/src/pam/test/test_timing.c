@@ -0,0 +1,118 @@
+/*
+ * System includes.
+ */
+#include <syslog.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+/*
+ * Local includes.
+ */
+#include "timing.h"
+#include "debug.h" // always last
+
+/*******************************************
+ *              MOCKS
+ *******************************************/
+
+// Capture the summary instead of sending it to syslog
+static char logged[4096];
+
+void
+vsyslog(int priority, const char *format, va_list ap)
+{
+	vsnprintf(logged, sizeof(logged), format, ap);
+}
+
+static int
+setup(void ** state)
+{
+	logged[0] = '\0';
+	return 0;
+}
+
+/*******************************************
+ *              TESTS
+ *******************************************/
+
+void
+test_summary(void ** state)
+{
+	timing_begin();
+	timing_op("login");
+
+	timing_start(TIMING_CONFIG);
+	timing_stop(TIMING_CONFIG);
+
+	timing_start(TIMING_RESOURCES);
+	timing_request("https://auth.globus.org/v2/oauth2/token/introspect",
+	               0.001, 0.002, 0.010, 0.040, 0.0415);
+	timing_request("https://auth.globus.org/v2/api/identities?ids=abc&include=identity_provider",
+	               0, 0, 0, 0.020, 0.021);
+	timing_stop(TIMING_RESOURCES);
+
+	timing_end(7);
+
+	assert_non_null(strstr(logged, "timing: op=login status=7 total="));
+	assert_non_null(strstr(logged, " config="));
+	assert_non_null(strstr(logged, " resources="));
+	assert_null(strstr(logged, " identities="));
+	assert_non_null(strstr(logged,
+	        " request=/v2/oauth2/token/introspect,dns=1.00,connect=2.00,tls=10.00,ttfb=40.00,total=41.50"));
+	assert_non_null(strstr(logged,
+	        " request=/v2/api/identities,dns=0.00,connect=0.00,tls=0.00,ttfb=20.00,total=21.00"));
+}
+
+void
+test_phases_accumulate(void ** state)
+{
+	timing_begin();
+
+	timing_start(TIMING_GETPWNAM);
+	timing_stop(TIMING_GETPWNAM);
+	timing_start(TIMING_GETPWNAM);
+	timing_stop(TIMING_GETPWNAM);
+
+	timing_end(0);
+
+	assert_non_null(strstr(logged, "op=none"));
+	char * first = strstr(logged, " getpwnam=");
+	assert_non_null(first);
+	assert_null(strstr(first + 1, " getpwnam="));
+}
+
+void
+test_end_without_begin(void ** state)
+{
+	timing_begin();
+	timing_end(0);
+
+	logged[0] = '\0';
+	timing_end(0);
+	assert_string_equal(logged, "");
+}
+
+void
+test_many_requests(void ** state)
+{
+	timing_begin();
+	for (int i = 0; i < 10; i++)
+		timing_request("https://auth.globus.org/v2/api/clients/id", 0, 0, 0, 0, 0);
+	timing_end(0);
+
+	assert_non_null(strstr(logged, " requests=10"));
+}
+
+int
+main()
+{
+	const struct CMUnitTest tests[] = {
+		{"summary",             test_summary,           setup},
+		{"phases accumulate",   test_phases_accumulate, setup},
+		{"end without begin",   test_end_without_begin, setup},
+		{"many requests",       test_many_requests,     setup},
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
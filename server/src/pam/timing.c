@@ -0,0 +1,186 @@
+/*
+ * System includes.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Local includes.
+ */
+#include "strings.h"
+#include "logger.h"
+#include "timing.h"
+#include "debug.h" // always last
+
+/*******************************************************************************
+ * Internal (Private) Functions
+ ******************************************************************************/
+
+// A login makes three requests at most; extras are counted but not itemized
+#define TIMING_MAX_REQUESTS 8
+
+static const char * phase_names[TIMING_PHASE_COUNT] = {
+	[TIMING_CONFIG]       = "config",
+	[TIMING_CONVERSATION] = "conversation",
+	[TIMING_HELPER]       = "helper",
+	[TIMING_RESOURCES]    = "resources",
+	[TIMING_IDENTITIES]   = "identities",
+	[TIMING_ACCOUNT_MAP]  = "account_map",
+	[TIMING_GETPWNAM]     = "getpwnam",
+};
+
+struct timing_request {
+	char   path[64];
+	double dns;
+	double connect;
+	double tls;
+	double ttfb;
+	double total;
+};
+
+struct timing {
+	bool   active;
+	double begin;
+	double started[TIMING_PHASE_COUNT];
+	double elapsed[TIMING_PHASE_COUNT];
+	bool   entered[TIMING_PHASE_COUNT];
+	char   op[32];
+	int    nrequests;
+	struct timing_request requests[TIMING_MAX_REQUESTS];
+};
+
+// oauth-ssh-helperd processes one login per thread
+static __thread struct timing timing;
+
+static double
+_timing_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Drop the scheme, host and query string; they add nothing but length.
+static void
+_timing_path(char * path, size_t size, const char * url)
+{
+	const char * start = strstr(url, "://");
+	start = start ? strchr(start + 3, '/') : url;
+	if (!start)
+		start = "/";
+
+	size_t length = strcspn(start, "?");
+	if (length >= size)
+		length = size - 1;
+
+	memcpy(path, start, length);
+	path[length] = '\0';
+}
+
+/*******************************************************************************
+ * Public Functions
+ ******************************************************************************/
+
+void
+timing_begin()
+{
+	memset(&timing, 0, sizeof(timing));
+	timing.active = true;
+	timing.begin  = _timing_now();
+}
+
+void
+timing_start(timing_phase_t phase)
+{
+	timing.started[phase] = _timing_now();
+	timing.entered[phase] = true;
+}
+
+void
+timing_stop(timing_phase_t phase)
+{
+	timing.elapsed[phase] += _timing_now() - timing.started[phase];
+}
+
+void
+timing_op(const char * op)
+{
+	snprintf(timing.op, sizeof(timing.op), "%s", op);
+}
+
+void
+timing_request(const char * url,
+               double       dns,
+               double       connect,
+               double       tls,
+               double       ttfb,
+               double       total)
+{
+	int n = timing.nrequests++;
+	if (n >= TIMING_MAX_REQUESTS)
+		return;
+
+	struct timing_request * request = &timing.requests[n];
+	_timing_path(request->path, sizeof(request->path), url ? url : "");
+	request->dns     = dns;
+	request->connect = connect;
+	request->tls     = tls;
+	request->ttfb    = ttfb;
+	request->total   = total;
+}
+
+double
+timing_elapsed()
+{
+	return _timing_now() - timing.begin;
+}
+
+void
+timing_end(int status)
+{
+	if (!timing.active)
+		return;
+	timing.active = false;
+
+	char * summary = sformat("timing: op=%s status=%d total=%.2f",
+	                         timing.op[0] ? timing.op : "none",
+	                         status,
+	                         (_timing_now() - timing.begin) * 1000);
+
+	for (int i = 0; i < TIMING_PHASE_COUNT; i++)
+	{
+		if (!timing.entered[i])
+			continue;
+
+		char * phase = sformat(" %s=%.2f", phase_names[i], timing.elapsed[i] * 1000);
+		append(&summary, phase);
+		free(phase);
+	}
+
+	for (int i = 0; i < timing.nrequests && i < TIMING_MAX_REQUESTS; i++)
+	{
+		const struct timing_request * r = &timing.requests[i];
+		char * request = sformat(" request=%s,dns=%.2f,connect=%.2f,tls=%.2f,ttfb=%.2f,total=%.2f",
+		                         r->path,
+		                         r->dns     * 1000,
+		                         r->connect * 1000,
+		                         r->tls     * 1000,
+		                         r->ttfb    * 1000,
+		                         r->total   * 1000);
+		append(&summary, request);
+		free(request);
+	}
+
+	if (timing.nrequests > TIMING_MAX_REQUESTS)
+	{
+		char * more = sformat(" requests=%d", timing.nrequests);
+		append(&summary, more);
+		free(more);
+	}
+
+	logger(LOG_TYPE_INFO, "%s", summary);
+	free(summary);
+}
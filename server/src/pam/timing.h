@@ -0,0 +1,54 @@
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+/*
+ * Per-login latency breakdown. Each thread keeps one record for the login it
+ * is processing: the time spent in each phase and libcurl's timings for each
+ * request sent to Globus Auth. timing_end() logs the record as one line:
+ *
+ *   timing: op=login status=0 total=63.21 config=0.08 conversation=0.31
+ *     resources=48.90 identities=0.02 account_map=0.11 getpwnam=0.05
+ *     request=/v2/oauth2/token/introspect,dns=0.03,connect=0.21,tls=12.40,ttfb=47.80,total=48.02
+ *     request=...
+ *
+ * All values are milliseconds. The dns, connect, tls and ttfb values of a
+ * request are measured from the start of that request, as libcurl reports
+ * them, and are zero when a connection was reused.
+ */
+
+typedef enum {
+	TIMING_CONFIG,       // config_init()
+	TIMING_CONVERSATION, // PAM conversation with sshd / the client
+	TIMING_HELPER,       // round trip to oauth-ssh-helperd
+	TIMING_RESOURCES,    // introspect + client record, fetched together
+	TIMING_IDENTITIES,   // linked identities
+	TIMING_ACCOUNT_MAP,  // map_file / idp_suffix lookups
+	TIMING_GETPWNAM,     // local account checks
+	TIMING_PHASE_COUNT,
+} timing_phase_t;
+
+// Start a new record for this thread.
+void timing_begin();
+
+// Phases may be entered more than once; their times accumulate.
+void timing_start(timing_phase_t);
+void timing_stop(timing_phase_t);
+
+// The command being processed, ie. 'login'. Appears in the summary.
+void timing_op(const char * op);
+
+// Times in seconds as returned by CURLINFO_*_TIME.
+void timing_request(const char * url,
+                    double       dns,
+                    double       connect,
+                    double       tls,
+                    double       ttfb,
+                    double       total);
+
+// Seconds since timing_begin().
+double timing_elapsed();
+
+// Log the summary for this thread's record.
+void timing_end(int status);
+
+#endif /* _TIMING_H_ */